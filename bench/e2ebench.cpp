@@ -0,0 +1,250 @@
+/*
+ * e2ebench: 进程内的端到端基准，几秒内跑完，每次构建后都可以跑一遍
+ * 在临时目录里准备资源文件，WebServer监听系统分配的端口(不依赖MySQL，用户验证用本地文件)，
+ * 用loadgen的客户端通过回环地址压测，逐个配置(ET/LT、线程数、文件大小、长连接)输出
+ * 每秒请求数、服务器每个请求的CPU时间和读写类系统调用次数
+ *
+ *   ./e2ebench                  # 全部配置，每个0.3秒
+ *   ./e2ebench -d 1000 -f 64k   # 只跑名字包含64k的配置，每个1秒
+ */
+#include <unistd.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <chrono>
+#include "loadgen.h"
+#include "../code/server/webserver.h"
+
+using namespace std;
+
+struct E2eConfig {
+    string name;
+    int trigMode;
+    int threads;
+    string path;
+    bool keepAlive;
+};
+
+// 服务器线程(除主线程外仍存活的线程)的CPU时间和读写类系统调用次数
+struct ThreadUsage {
+    uint64_t cpuNs = 0;
+    uint64_t rwSyscalls = 0;    // /proc的io中的syscr+syscw
+};
+
+static const struct {
+    const char* name;
+    size_t size;
+} FILES[] = {
+    {"1k", 1024},
+    {"64k", 64 * 1024},
+    {"1m", 1024 * 1024},
+};
+
+static bool WriteFile(const string& path, size_t size) {
+    FILE* fp = fopen(path.c_str(), "w");
+    if(!fp) { return false; }
+    string line(63, 'x');
+    line += '\n';
+    for(size_t n = 0; n < size; n += line.size()) {
+        fwrite(line.data(), 1, min(line.size(), size - n), fp);
+    }
+    fclose(fp);
+    return true;
+}
+
+static uint64_t ReadField(const string& path, const char* key) {
+    FILE* fp = fopen(path.c_str(), "r");
+    if(!fp) { return 0; }
+    char line[256];
+    uint64_t value = 0;
+    size_t keyLen = strlen(key);
+    while(fgets(line, sizeof(line), fp)) {
+        if(key[0] == '\0') {
+            value = strtoull(line, nullptr, 10);    // schedstat第一个字段：运行时间(ns)
+            break;
+        }
+        if(strncmp(line, key, keyLen) == 0) {
+            value = strtoull(line + keyLen, nullptr, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return value;
+}
+
+// /proc/self/task/<tid>/schedstat 和 io(syscr/syscw只统计read/write/readv/writev等，不含epoll)
+static map<int, ThreadUsage> SnapshotThreads() {
+    map<int, ThreadUsage> usage;
+    int self = static_cast<int>(syscall(SYS_gettid));
+    DIR* dir = opendir("/proc/self/task");
+    if(!dir) { return usage; }
+    struct dirent* ent;
+    while((ent = readdir(dir)) != nullptr) {
+        int tid = atoi(ent->d_name);
+        if(tid <= 0 || tid == self) { continue; }
+        string base = string("/proc/self/task/") + ent->d_name;
+        ThreadUsage& u = usage[tid];
+        u.cpuNs = ReadField(base + "/schedstat", "");
+        u.rwSyscalls = ReadField(base + "/io", "syscr:") + ReadField(base + "/io", "syscw:");
+    }
+    closedir(dir);
+    return usage;
+}
+
+static ThreadUsage Diff(const map<int, ThreadUsage>& before, const map<int, ThreadUsage>& after) {
+    ThreadUsage total;
+    for(auto& item: after) {
+        auto it = before.find(item.first);
+        if(it == before.end()) { continue; }
+        total.cpuNs += item.second.cpuNs - it->second.cpuNs;
+        total.rwSyscalls += item.second.rwSyscalls - it->second.rwSyscalls;
+    }
+    return total;
+}
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+static void Usage(const char* prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -d MS         measured duration per configuration (default 300)\n"
+        "  -c N          client connections (default 32)\n"
+        "  -f SUBSTR     only run configurations whose name contains SUBSTR\n"
+        "  -o FMT        output format: text or csv (default text)\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    int durationMs = 300;
+    int connections = 32;
+    string filter;
+    string format = "text";
+    int ch;
+    while((ch = getopt(argc, argv, "d:c:f:o:h")) != -1) {
+        switch(ch) {
+        case 'd': durationMs = atoi(optarg); break;
+        case 'c': connections = atoi(optarg); break;
+        case 'f': filter = optarg; break;
+        case 'o': format = optarg; break;
+        default:
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+    if(durationMs <= 0 || connections <= 0 || (format != "text" && format != "csv")) {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    // WebServer以当前目录下的resources/为资源目录
+    char tmpl[] = "/tmp/e2ebench.XXXXXX";
+    char* tmpDir = mkdtemp(tmpl);
+    char* oldDir = getcwd(nullptr, 0);
+    if(!tmpDir || chdir(tmpDir) < 0 || mkdir("resources", 0755) < 0) {
+        perror("e2ebench: temp dir");
+        return 1;
+    }
+    for(auto& file: FILES) {
+        WriteFile(string("resources/") + file.name + ".txt", file.size);
+    }
+
+    vector<E2eConfig> configs;
+    for(int trigMode: {0, 3}) {
+        for(int threads: {1, 4}) {
+            for(auto& file: FILES) {
+                for(bool keepAlive: {true, false}) {
+                    E2eConfig config;
+                    config.name = string(trigMode == 0 ? "LT" : "ET") + "/t" + to_string(threads) + "/" +
+                                  file.name + (keepAlive ? "/ka" : "/close");
+                    config.trigMode = trigMode;
+                    config.threads = threads;
+                    config.path = string("/") + file.name + ".txt";
+                    config.keepAlive = keepAlive;
+                    if(filter.empty() || config.name.find(filter) != string::npos) {
+                        configs.push_back(config);
+                    }
+                }
+            }
+        }
+    }
+
+    if(format == "csv") {
+        printf("config,trig_mode,threads,path,keepalive,req_per_sec,mb_per_sec,p50_us,p99_us,"
+               "cpu_us_per_req,rw_syscalls_per_req,errors\n");
+    } else {
+        printf("%-16s %10s %9s %8s %8s %12s %15s %7s\n", "config", "req/s", "MB/s", "p50(us)",
+               "p99(us)", "cpu(us)/req", "rw_syscalls/req", "errors");
+    }
+    int failed = 0;
+    for(auto& config: configs) {
+        WebServer server(
+            0, config.trigMode, 60000, false,
+            3306, "", "", "",
+            1, config.threads, false, 1, 0,
+            false, 0, 1.0, true, "./data/user.db");
+        if(server.Port() == 0) {
+            fprintf(stderr, "e2ebench: server init failed\n");
+            failed++;
+            break;
+        }
+        thread serverThread(&WebServer::Start, &server);
+
+        LoadOptions opt;
+        opt.port = server.Port();
+        opt.connections = config.keepAlive ? connections : min(connections, 8);
+        opt.threads = 1;
+        opt.warmupSec = 0;
+        opt.durationSec = durationMs / 1000.0;
+        opt.keepAlive = config.keepAlive;
+        opt.targets.push_back(MakeGetTarget(opt, config.path, 1));
+
+        // 客户端线程在RunLoad内创建和退出，前后两次都存在的线程只有服务器的线程
+        auto before = SnapshotThreads();
+        LoadResult res = RunLoad(opt);
+        auto after = SnapshotThreads();
+        ThreadUsage usage = Diff(before, after);
+
+        // 等服务器处理完客户端断开，再停止、析构服务器
+        for(int i = 0; i < 200 && HttpConn::userCount > 0; i++) {
+            this_thread::sleep_for(chrono::milliseconds(5));
+        }
+        server.Stop();
+        serverThread.join();
+
+        double secs = res.seconds > 0 ? res.seconds : 1;
+        double reqs = res.requests > 0 ? res.requests : 1;
+        uint64_t errors = res.connectErrors + res.ioErrors + res.non2xx;
+        if(res.requests == 0 || errors > 0) { failed++; }
+        if(format == "csv") {
+            printf("%s,%d,%d,%s,%d,%.1f,%.2f,%llu,%llu,%.2f,%.2f,%llu\n",
+                   config.name.c_str(), config.trigMode, config.threads, config.path.c_str(),
+                   config.keepAlive ? 1 : 0, res.requests / secs, res.bytes / secs / 1024 / 1024,
+                   (unsigned long long)res.latency.Percentile(50),
+                   (unsigned long long)res.latency.Percentile(99),
+                   usage.cpuNs / 1000.0 / reqs, usage.rwSyscalls / reqs, (unsigned long long)errors);
+        } else {
+            printf("%-16s %10.0f %9.1f %8llu %8llu %12.2f %15.2f %7llu\n",
+                   config.name.c_str(), res.requests / secs, res.bytes / secs / 1024 / 1024,
+                   (unsigned long long)res.latency.Percentile(50),
+                   (unsigned long long)res.latency.Percentile(99),
+                   usage.cpuNs / 1000.0 / reqs, usage.rwSyscalls / reqs, (unsigned long long)errors);
+        }
+        fflush(stdout);
+    }
+
+    if(oldDir) {
+        if(chdir(oldDir) < 0) { perror("e2ebench: chdir"); }
+        free(oldDir);
+    }
+    nftw(tmpDir, RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    return failed > 0 ? 1 : 0;
+}
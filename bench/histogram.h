@@ -0,0 +1,102 @@
+#ifndef BENCH_HISTOGRAM_H
+#define BENCH_HISTOGRAM_H
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+// HDR风格的延迟直方图(单位us)：按2的幂分段，每段再线性细分为SUB_BUCKETS个桶
+// 小于SUB_BUCKETS的值精确记录；更大的值右移后落在段内后一半的SUB_BUCKETS/2个桶中，
+// 相对误差不超过 2/SUB_BUCKETS，记录O(1)，不同线程各自记录，最后合并
+class Histogram {
+public:
+    static const int SUB_BITS = 7;                  // 每段128个桶(使用其中64个)，精度约1.6%
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_BITS = 40;                 // 最大约 2^40 us
+
+    Histogram() : counts_((MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS, 0), total_(0), max_(0), min_(UINT64_MAX), sum_(0) {}
+
+    void Record(uint64_t value) {
+        counts_[Index_(value)]++;
+        total_++;
+        sum_ += value;
+        if(value > max_) { max_ = value; }
+        if(value < min_) { min_ = value; }
+    }
+
+    // 一次记录count个相同的值(用于修正协调遗漏时补记)
+    void Record(uint64_t value, uint64_t count) {
+        if(count == 0) { return; }
+        counts_[Index_(value)] += count;
+        total_ += count;
+        sum_ += value * count;
+        if(value > max_) { max_ = value; }
+        if(value < min_) { min_ = value; }
+    }
+
+    void Merge(const Histogram& other) {
+        for(size_t i = 0; i < counts_.size(); i++) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        sum_ += other.sum_;
+        if(other.max_ > max_) { max_ = other.max_; }
+        if(other.min_ < min_) { min_ = other.min_; }
+    }
+
+    void Reset() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        total_ = sum_ = max_ = 0;
+        min_ = UINT64_MAX;
+    }
+
+    // q取值 [0, 100]，返回对应桶的上界
+    uint64_t Percentile(double q) const {
+        if(total_ == 0) { return 0; }
+        uint64_t rank = static_cast<uint64_t>(q / 100.0 * total_ + 0.5);
+        if(rank == 0) { rank = 1; }
+        if(rank > total_) { rank = total_; }
+        uint64_t seen = 0;
+        for(size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if(seen >= rank) {
+                uint64_t upper = UpperBound_(i);
+                return upper > max_ ? max_ : upper;
+            }
+        }
+        return max_;
+    }
+
+    uint64_t Count() const { return total_; }
+    uint64_t Max() const { return max_; }
+    uint64_t Min() const { return total_ ? min_ : 0; }
+    double Mean() const { return total_ ? static_cast<double>(sum_) / total_ : 0.0; }
+
+private:
+    static size_t Index_(uint64_t value) {
+        if(value < static_cast<uint64_t>(SUB_BUCKETS)) { return value; }
+        int bits = 64 - __builtin_clzll(value);     // value的二进制位数
+        if(bits > MAX_BITS) {
+            return (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS - 1;
+        }
+        int shift = bits - SUB_BITS;
+        return static_cast<size_t>(shift) * SUB_BUCKETS + (value >> shift);
+    }
+
+    static uint64_t UpperBound_(size_t index) {
+        size_t seg = index / SUB_BUCKETS;
+        if(seg == 0) { return index; }
+        uint64_t sub = index % SUB_BUCKETS;
+        int shift = seg;
+        // 段内: value >> shift 落在 [SUB_BUCKETS/2, SUB_BUCKETS) 中
+        return ((sub + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    uint64_t max_;
+    uint64_t min_;
+    uint64_t sum_;
+};
+
+#endif //BENCH_HISTOGRAM_H
@@ -0,0 +1,602 @@
+#include "loadgen.h"
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <stdio.h>
+#include <assert.h>
+#include <deque>
+#include <thread>
+#include <memory>
+
+using namespace std;
+
+static uint64_t NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+LoadTarget MakeGetTarget(const LoadOptions& opt, const string& path, int weight) {
+    LoadTarget target;
+    target.name = "GET " + path;
+    target.request = "GET " + path + " HTTP/1.1\r\n"
+                     "Host: " + opt.host + ":" + to_string(opt.port) + "\r\n"
+                     "Connection: " + (opt.keepAlive ? "keep-alive" : "close") + "\r\n\r\n";
+    target.weight = weight;
+    return target;
+}
+
+LoadTarget MakeLoginTarget(const LoadOptions& opt, const string& user, const string& pwd, int weight) {
+    string body = "username=" + user + "&password=" + pwd;
+    LoadTarget target;
+    target.name = "POST /login.html (" + user + ")";
+    target.request = "POST /login.html HTTP/1.1\r\n"
+                     "Host: " + opt.host + ":" + to_string(opt.port) + "\r\n"
+                     "Connection: " + (opt.keepAlive ? "keep-alive" : "close") + "\r\n"
+                     "Content-Type: application/x-www-form-urlencoded\r\n"
+                     "Content-Length: " + to_string(body.size()) + "\r\n\r\n" + body;
+    target.weight = weight;
+    return target;
+}
+
+// 一个压测线程：自己的epoll，负责一部分连接
+// 闭环：收到响应后才发送下一个请求；
+// 开环：按固定时间表产生请求，延迟从计划发送时间算起，服务器卡顿时排队的时间也计入延迟(避免协调遗漏)
+class Worker {
+public:
+    // rate为本线程的开环速率，phaseUs错开各线程的时间表，使合起来的请求均匀分布
+    Worker(const LoadOptions& opt, int connCount, uint32_t seed, double rate, double phaseUs);
+    ~Worker();
+    void Run(uint64_t measureStartUs, uint64_t endUs);
+
+    LoadResult result;
+
+private:
+    struct Conn {
+        int fd = -1;
+        string out;             // 待发送的数据
+        size_t outPos = 0;
+        string head;            // 未解析完的响应头
+        deque<uint64_t> sent;   // 已发送、未收到响应的请求的发送时间
+        bool inBody = false;
+        size_t bodyLeft = 0;
+        int status = 0;
+        bool closeAfter = false;    // 响应带 Connection: close
+        bool connecting = false;
+        bool listed = false;        // 开环模式：已在空闲队列中
+    };
+
+    bool Connect_(Conn& conn);
+    void Close_(Conn& conn);
+    void Fill_(Conn& conn);             // 把待发送请求补到pipeline深度
+    void Dispatch_(uint64_t endUs);     // 开环：把到期的请求分给空闲连接
+    uint64_t NextDueUs_() const;
+    void ArmTimer_(uint64_t dueUs);     // 开环：定时器在下一个计划发送时间唤醒epoll
+    bool Flush_(Conn& conn);
+    bool OnReadable_(Conn& conn);
+    bool Consume_(Conn& conn, const char* data, size_t len);
+    void OnResponse_(Conn& conn);
+    void UpdateEvents_(Conn& conn);
+    const LoadTarget& Pick_();
+
+    const LoadOptions& opt_;
+    struct sockaddr_in addr_;
+    int epollFd_;
+    vector<Conn> conns_;
+    vector<int> cumWeights_;
+    uint32_t seed_;
+    uint64_t measureStartUs_;
+    uint64_t nowUs_;
+    bool reconnected_;      // 处理当前事件时连接被重建
+
+    int timerFd_;                   // 开环：epoll_wait只有毫秒精度，用timerfd按微秒唤醒
+    double intervalUs_;             // 开环：本线程相邻请求的计划间隔，0为闭环
+    double phaseUs_;
+    uint64_t scheduleStartUs_;
+    uint64_t scheduled_;            // 已产生的请求数
+    deque<uint64_t> backlog_;       // 已到期、还没有空闲连接可用的请求的计划发送时间
+    vector<Conn*> idle_;            // 还能再发送请求的连接
+};
+
+Worker::Worker(const LoadOptions& opt, int connCount, uint32_t seed, double rate, double phaseUs)
+    : opt_(opt), epollFd_(epoll_create1(0)), conns_(connCount), seed_(seed | 1),
+      measureStartUs_(0), nowUs_(0), reconnected_(false),
+      timerFd_(-1), intervalUs_(rate > 0 ? 1e6 / rate : 0), phaseUs_(phaseUs),
+      scheduleStartUs_(0), scheduled_(0) {
+    assert(epollFd_ >= 0);
+    if(intervalUs_ > 0) {
+        timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        assert(timerFd_ >= 0);
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, timerFd_, &ev);
+    }
+    memset(&addr_, 0, sizeof(addr_));
+    addr_.sin_family = AF_INET;
+    addr_.sin_port = htons(opt.port);
+    inet_pton(AF_INET, opt.host.c_str(), &addr_.sin_addr);
+    int sum = 0;
+    for(auto& target: opt.targets) {
+        sum += target.weight;
+        cumWeights_.push_back(sum);
+    }
+}
+
+Worker::~Worker() {
+    for(auto& conn: conns_) {
+        Close_(conn);
+    }
+    if(timerFd_ >= 0) { close(timerFd_); }
+    close(epollFd_);
+}
+
+const LoadTarget& Worker::Pick_() {
+    if(opt_.targets.size() == 1) { return opt_.targets[0]; }
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    int r = seed_ % cumWeights_.back();
+    size_t i = upper_bound(cumWeights_.begin(), cumWeights_.end(), r) - cumWeights_.begin();
+    return opt_.targets[i];
+}
+
+bool Worker::Connect_(Conn& conn) {
+    bool listed = conn.listed;
+    conn = Conn();
+    conn.listed = listed;
+    conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(conn.fd < 0) {
+        result.connectErrors++;
+        return false;
+    }
+    int one = 1;
+    setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = connect(conn.fd, (struct sockaddr*)&addr_, sizeof(addr_));
+    if(ret < 0 && errno != EINPROGRESS) {
+        result.connectErrors++;
+        close(conn.fd);
+        conn.fd = -1;
+        return false;
+    }
+    conn.connecting = (ret < 0);
+    result.connects++;
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = &conn;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, conn.fd, &ev);
+    Fill_(conn);
+    return true;
+}
+
+// 连接上已发送、没有收到响应的请求不会再有响应，统计阶段的计为未完成(Connect_会清空连接的状态)
+void Worker::Close_(Conn& conn) {
+    for(uint64_t due: conn.sent) {
+        if(due >= measureStartUs_) { result.unfinished++; }
+    }
+    conn.sent.clear();
+    if(conn.fd >= 0) {
+        epoll_ctl(epollFd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+        close(conn.fd);
+        conn.fd = -1;
+    }
+}
+
+void Worker::Fill_(Conn& conn) {
+    int depth = opt_.keepAlive ? opt_.pipeline : 1;
+    if(intervalUs_ > 0) {
+        // 开环：只登记到空闲队列，由Dispatch_按时间表分配请求
+        if(!conn.listed && static_cast<int>(conn.sent.size()) < depth) {
+            conn.listed = true;
+            idle_.push_back(&conn);
+        }
+        return;
+    }
+    while(static_cast<int>(conn.sent.size()) < depth) {
+        conn.out += Pick_().request;
+        conn.sent.push_back(nowUs_);
+    }
+}
+
+uint64_t Worker::NextDueUs_() const {
+    return scheduleStartUs_ + static_cast<uint64_t>(scheduled_ * intervalUs_);
+}
+
+void Worker::ArmTimer_(uint64_t dueUs) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = dueUs / 1000000;
+    its.it_value.tv_nsec = (dueUs % 1000000) * 1000;
+    timerfd_settime(timerFd_, TFD_TIMER_ABSTIME, &its, nullptr);
+}
+
+void Worker::Dispatch_(uint64_t endUs) {
+    // 第k个请求的计划发送时间为 start + k * interval，与服务器何时响应无关
+    for(uint64_t due = NextDueUs_(); due <= nowUs_ && due < endUs; due = NextDueUs_()) {
+        backlog_.push_back(due);
+        scheduled_++;
+    }
+    int depth = opt_.keepAlive ? opt_.pipeline : 1;
+    while(!backlog_.empty() && !idle_.empty()) {
+        Conn& conn = *idle_.back();
+        if(conn.fd < 0 || static_cast<int>(conn.sent.size()) >= depth) {
+            idle_.pop_back();
+            conn.listed = false;
+            continue;
+        }
+        conn.out += Pick_().request;
+        conn.sent.push_back(backlog_.front());
+        backlog_.pop_front();
+        if(static_cast<int>(conn.sent.size()) >= depth) {
+            idle_.pop_back();
+            conn.listed = false;
+        }
+        if(!conn.connecting && !Flush_(conn)) {
+            result.ioErrors++;
+            Close_(conn);
+            continue;
+        }
+        UpdateEvents_(conn);
+    }
+}
+
+bool Worker::Flush_(Conn& conn) {
+    while(conn.outPos < conn.out.size()) {
+        ssize_t len = send(conn.fd, conn.out.data() + conn.outPos,
+                           conn.out.size() - conn.outPos, MSG_NOSIGNAL);
+        if(len < 0) {
+            if(errno == EAGAIN) { return true; }
+            return false;
+        }
+        conn.outPos += len;
+    }
+    conn.out.clear();
+    conn.outPos = 0;
+    return true;
+}
+
+void Worker::UpdateEvents_(Conn& conn) {
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | (conn.out.empty() && !conn.connecting ? 0 : EPOLLOUT);
+    ev.data.ptr = &conn;
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, conn.fd, &ev);
+}
+
+// 解析响应：只关心状态码、Content-length 和 Connection: close，响应体直接丢弃
+bool Worker::Consume_(Conn& conn, const char* data, size_t len) {
+    while(len > 0) {
+        if(conn.inBody) {
+            size_t n = min(len, conn.bodyLeft);
+            conn.bodyLeft -= n;
+            data += n;
+            len -= n;
+            if(conn.bodyLeft == 0) {
+                conn.inBody = false;
+                OnResponse_(conn);
+                if(reconnected_) { return true; }
+            }
+            continue;
+        }
+        size_t old = conn.head.size();
+        conn.head.append(data, len);
+        size_t end = conn.head.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+        if(end == string::npos) { return true; }
+        size_t used = end + 4 - old;
+        data += used;
+        len -= used;
+
+        conn.status = 0;
+        conn.bodyLeft = 0;
+        conn.closeAfter = false;
+        if(conn.head.compare(0, 5, "HTTP/") != 0) { return false; }
+        size_t sp = conn.head.find(' ');
+        if(sp != string::npos) { conn.status = atoi(conn.head.c_str() + sp + 1); }
+        size_t pos = conn.head.find("\r\n");
+        while(pos != string::npos && pos < end) {
+            const char* line = conn.head.c_str() + pos + 2;
+            if(strncasecmp(line, "Content-length:", 15) == 0) {
+                conn.bodyLeft = strtoul(line + 15, nullptr, 10);
+            } else if(strncasecmp(line, "Connection:", 11) == 0) {
+                conn.closeAfter = strncasecmp(line + 11 + strspn(line + 11, " "), "close", 5) == 0;
+            }
+            pos = conn.head.find("\r\n", pos + 2);
+        }
+        conn.head.clear();
+        conn.inBody = true;
+        if(conn.bodyLeft == 0) {
+            conn.inBody = false;
+            OnResponse_(conn);
+            if(reconnected_) { return true; }
+        }
+    }
+    return true;
+}
+
+void Worker::OnResponse_(Conn& conn) {
+    if(conn.sent.empty()) { return; }
+    uint64_t sentUs = conn.sent.front();
+    conn.sent.pop_front();
+    if(sentUs >= measureStartUs_) {
+        result.latency.Record(nowUs_ - sentUs);
+        result.requests++;
+        if(conn.status < 200 || conn.status >= 300) { result.non2xx++; }
+    }
+    if(conn.closeAfter || !opt_.keepAlive) {
+        // 服务器关闭连接，重新建立，旧连接上剩下的数据不再处理
+        Close_(conn);
+        Connect_(conn);
+        reconnected_ = true;
+        return;
+    }
+    Fill_(conn);
+}
+
+bool Worker::OnReadable_(Conn& conn) {
+    static thread_local char buff[65536];
+    while(true) {
+        ssize_t len = recv(conn.fd, buff, sizeof(buff), 0);
+        if(len < 0) {
+            return errno == EAGAIN;
+        }
+        if(len == 0) {
+            return false;   // 对端关闭
+        }
+        if(nowUs_ >= measureStartUs_) { result.bytes += len; }
+        if(!Consume_(conn, buff, len)) { return false; }
+        if(reconnected_) { return true; }
+        if(static_cast<size_t>(len) < sizeof(buff)) { return true; }
+    }
+}
+
+void Worker::Run(uint64_t measureStartUs, uint64_t endUs) {
+    measureStartUs_ = measureStartUs;
+    nowUs_ = NowUs();
+    scheduleStartUs_ = nowUs_ + static_cast<uint64_t>(phaseUs_);
+    for(auto& conn: conns_) {
+        Connect_(conn);
+    }
+    if(timerFd_ >= 0) { ArmTimer_(scheduleStartUs_); }
+    vector<struct epoll_event> events(1024);
+    uint64_t lastRetry = nowUs_;
+    while(true) {
+        nowUs_ = NowUs();
+        if(nowUs_ >= endUs) { break; }
+        int timeoutMs = static_cast<int>(min<uint64_t>((endUs - nowUs_) / 1000 + 1, 100));
+        int n = epoll_wait(epollFd_, events.data(), events.size(), timeoutMs);
+        nowUs_ = NowUs();
+        for(int i = 0; i < n; i++) {
+            if(events[i].data.ptr == nullptr) {
+                uint64_t expirations;
+                ssize_t ret = read(timerFd_, &expirations, sizeof(expirations));
+                (void)ret;
+                continue;
+            }
+            Conn& conn = *static_cast<Conn*>(events[i].data.ptr);
+            if(conn.fd < 0) { continue; }
+            uint32_t ev = events[i].events;
+            bool ok = true;
+            reconnected_ = false;
+            if(conn.connecting && (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if(err != 0) {
+                    result.connectErrors++;
+                    Close_(conn);
+                    continue;
+                }
+                conn.connecting = false;
+            }
+            if(ev & EPOLLIN) { ok = OnReadable_(conn); }
+            else if(ev & (EPOLLERR | EPOLLHUP)) { ok = false; }
+            if(ok && conn.fd >= 0) { ok = Flush_(conn); }
+            if(!ok) {
+                result.ioErrors++;
+                Close_(conn);
+                continue;
+            }
+            if(conn.fd >= 0) { UpdateEvents_(conn); }
+        }
+        if(intervalUs_ > 0) {
+            Dispatch_(endUs);
+            ArmTimer_(NextDueUs_());
+        }
+        // 连接失败的每100ms重试一次
+        if(nowUs_ - lastRetry >= 100000) {
+            lastRetry = nowUs_;
+            for(auto& conn: conns_) {
+                if(conn.fd < 0) { Connect_(conn); }
+            }
+        }
+    }
+    if(intervalUs_ > 0) {
+        for(uint64_t due: backlog_) {
+            if(due >= measureStartUs_) { result.unfinished++; }
+        }
+    }
+    for(auto& conn: conns_) {
+        if(intervalUs_ == 0) { conn.sent.clear(); }    // 闭环：结束时在途的请求只是没有来得及收到响应
+        Close_(conn);
+    }
+}
+
+LoadResult RunLoad(const LoadOptions& opt) {
+    assert(opt.threads > 0 && opt.connections > 0 && !opt.targets.empty());
+    int threads = min(opt.threads, opt.connections);
+    vector<unique_ptr<Worker>> workers;
+    for(int i = 0; i < threads; i++) {
+        int count = opt.connections / threads + (i < opt.connections % threads ? 1 : 0);
+        double phaseUs = opt.rate > 0 ? 1e6 / opt.rate * i : 0;
+        workers.emplace_back(new Worker(opt, count, 2654435761u * (i + 1), opt.rate / threads, phaseUs));
+    }
+    uint64_t start = NowUs();
+    uint64_t measureStart = start + static_cast<uint64_t>(opt.warmupSec * 1000000);
+    uint64_t end = measureStart + static_cast<uint64_t>(opt.durationSec * 1000000);
+    vector<thread> ths;
+    for(auto& worker: workers) {
+        ths.emplace_back(&Worker::Run, worker.get(), measureStart, end);
+    }
+    for(auto& t: ths) {
+        t.join();
+    }
+    LoadResult res;
+    for(auto& worker: workers) {
+        const LoadResult& r = worker->result;
+        res.latency.Merge(r.latency);
+        res.requests += r.requests;
+        res.bytes += r.bytes;
+        res.non2xx += r.non2xx;
+        res.connectErrors += r.connectErrors;
+        res.ioErrors += r.ioErrors;
+        res.unfinished += r.unfinished;
+        res.connects += r.connects;
+    }
+    res.seconds = (end - measureStart) / 1e6;
+    return res;
+}
+
+void PrintResult(const LoadOptions& opt, const LoadResult& res) {
+    printf("Target %s:%d, %d threads, %d connections, keep-alive %s, pipeline %d\n",
+           opt.host.c_str(), opt.port, opt.threads, opt.connections,
+           opt.keepAlive ? "on" : "off", opt.pipeline);
+    if(opt.rate > 0) {
+        printf("Open loop at %.0f req/s, latency measured from intended send time\n", opt.rate);
+    }
+    for(auto& target: opt.targets) {
+        printf("  %-40s weight %d\n", target.name.c_str(), target.weight);
+    }
+    double secs = res.seconds > 0 ? res.seconds : 1;
+    printf("Requests: %llu in %.1fs (warmup %.1fs), %.1f req/s, %.2f MB/s\n",
+           (unsigned long long)res.requests, res.seconds, opt.warmupSec,
+           res.requests / secs, res.bytes / secs / 1024 / 1024);
+    printf("Errors: connect %llu, io %llu, non-2xx %llu, connects %llu\n",
+           (unsigned long long)res.connectErrors, (unsigned long long)res.ioErrors,
+           (unsigned long long)res.non2xx, (unsigned long long)res.connects);
+    if(opt.rate > 0 || res.unfinished > 0) {
+        printf("Unfinished: %llu\n", (unsigned long long)res.unfinished);
+    }
+    const Histogram& h = res.latency;
+    printf("Latency(us): min %llu, mean %.1f, p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, p99.99 %llu, max %llu\n",
+           (unsigned long long)h.Min(), h.Mean(),
+           (unsigned long long)h.Percentile(50), (unsigned long long)h.Percentile(90),
+           (unsigned long long)h.Percentile(99), (unsigned long long)h.Percentile(99.9),
+           (unsigned long long)h.Percentile(99.99), (unsigned long long)h.Max());
+}
+
+static bool IsSaturated(double rate, const LoadResult& res, uint64_t baseP99, double kneeFactor) {
+    double secs = res.seconds > 0 ? res.seconds : 1;
+    if(res.requests / secs < rate * 0.95) { return true; }
+    return baseP99 > 0 && res.latency.Percentile(99) > baseP99 * kneeFactor;
+}
+
+vector<SweepPoint> RunSweep(LoadOptions opt, double from, double to, double step,
+                            double kneeFactor) {
+    assert(from > 0 && step > 0);
+    vector<SweepPoint> points;
+    uint64_t baseP99 = 0;
+    int saturatedRun = 0;
+    for(double rate = from; rate <= to + step / 2; rate += step) {
+        opt.rate = rate;
+        SweepPoint point;
+        point.rate = rate;
+        point.result = RunLoad(opt);
+        if(points.empty()) { baseP99 = point.result.latency.Percentile(99); }
+        point.saturated = IsSaturated(rate, point.result, baseP99, kneeFactor);
+        double secs = point.result.seconds > 0 ? point.result.seconds : 1;
+        fprintf(stderr, "rate %.0f: achieved %.0f req/s, p99 %lluus%s\n", rate,
+                point.result.requests / secs,
+                (unsigned long long)point.result.latency.Percentile(99),
+                point.saturated ? ", saturated" : "");
+        points.push_back(point);
+        saturatedRun = point.saturated ? saturatedRun + 1 : 0;
+        if(saturatedRun >= 2) { break; }
+    }
+    return points;
+}
+
+int FindKnee(const vector<SweepPoint>& points) {
+    int knee = -1;
+    for(size_t i = 0; i < points.size(); i++) {
+        if(points[i].saturated) { break; }
+        knee = static_cast<int>(i);
+    }
+    return knee;
+}
+
+void WriteCsv(FILE* fp, const string& label, const LoadOptions& opt,
+              const vector<SweepPoint>& points, bool header) {
+    if(header) {
+        fprintf(fp, "label,threads,connections,pipeline,keepalive,rate,achieved,requests,unfinished,"
+                    "non2xx,connect_errors,io_errors,p50_us,p90_us,p99_us,p999_us,max_us,mean_us,saturated\n");
+    }
+    string quoted = "\"";
+    for(char ch: label) {
+        if(ch == '"') { quoted += '"'; }
+        quoted += ch;
+    }
+    quoted += '"';
+    for(auto& point: points) {
+        const LoadResult& res = point.result;
+        const Histogram& h = res.latency;
+        double secs = res.seconds > 0 ? res.seconds : 1;
+        fprintf(fp, "%s,%d,%d,%d,%d,%.0f,%.1f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.1f,%d\n",
+                quoted.c_str(), opt.threads, opt.connections, opt.pipeline, opt.keepAlive ? 1 : 0,
+                point.rate, res.requests / secs,
+                (unsigned long long)res.requests, (unsigned long long)res.unfinished,
+                (unsigned long long)res.non2xx, (unsigned long long)res.connectErrors,
+                (unsigned long long)res.ioErrors,
+                (unsigned long long)h.Percentile(50), (unsigned long long)h.Percentile(90),
+                (unsigned long long)h.Percentile(99), (unsigned long long)h.Percentile(99.9),
+                (unsigned long long)h.Max(), h.Mean(), point.saturated ? 1 : 0);
+    }
+}
+
+static string JsonEscape(const string& str) {
+    string out;
+    for(char ch: str) {
+        if(ch == '"' || ch == '\\') { out += '\\'; }
+        if(static_cast<unsigned char>(ch) < 0x20) { continue; }
+        out += ch;
+    }
+    return out;
+}
+
+void WriteJson(FILE* fp, const string& label, const LoadOptions& opt,
+               const vector<SweepPoint>& points) {
+    fprintf(fp, "{\"label\":\"%s\",\"host\":\"%s\",\"port\":%d,\"threads\":%d,\"connections\":%d,"
+                "\"pipeline\":%d,\"keepalive\":%s,\"points\":[",
+            JsonEscape(label).c_str(), JsonEscape(opt.host).c_str(), opt.port, opt.threads,
+            opt.connections, opt.pipeline, opt.keepAlive ? "true" : "false");
+    for(size_t i = 0; i < points.size(); i++) {
+        const LoadResult& res = points[i].result;
+        const Histogram& h = res.latency;
+        double secs = res.seconds > 0 ? res.seconds : 1;
+        fprintf(fp, "%s{\"rate\":%.0f,\"achieved\":%.1f,\"requests\":%llu,\"unfinished\":%llu,"
+                    "\"non2xx\":%llu,\"connect_errors\":%llu,\"io_errors\":%llu,"
+                    "\"latency_us\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,"
+                    "\"max\":%llu,\"mean\":%.1f},\"saturated\":%s}",
+                i ? "," : "", points[i].rate, res.requests / secs,
+                (unsigned long long)res.requests, (unsigned long long)res.unfinished,
+                (unsigned long long)res.non2xx, (unsigned long long)res.connectErrors,
+                (unsigned long long)res.ioErrors,
+                (unsigned long long)h.Percentile(50), (unsigned long long)h.Percentile(90),
+                (unsigned long long)h.Percentile(99), (unsigned long long)h.Percentile(99.9),
+                (unsigned long long)h.Max(), h.Mean(), points[i].saturated ? "true" : "false");
+    }
+    int knee = FindKnee(points);
+    if(knee >= 0) {
+        fprintf(fp, "],\"knee\":%.0f}\n", points[knee].rate);
+    } else {
+        fprintf(fp, "],\"knee\":null}\n");
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef BENCH_LOADGEN_H
+#define BENCH_LOADGEN_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include "histogram.h"
+
+// 请求组合中的一种请求(预先拼好的请求报文)
+struct LoadTarget {
+    std::string name;       // 用于输出，如 GET /index.html
+    std::string request;    // 完整的请求报文
+    int weight;
+};
+
+struct LoadOptions {
+    std::string host = "127.0.0.1";
+    int port = 1316;
+    int connections = 100;  // 总连接数，平均分给各个线程
+    int threads = 4;
+    double warmupSec = 2;   // 预热阶段的结果不统计
+    double durationSec = 10;    // 统计阶段的时长
+    int pipeline = 1;       // 每个连接上同时发送的请求数
+    bool keepAlive = true;  // false时每个请求新建连接
+    double rate = 0;        // 开环模式的总发送速率(req/s)，0为闭环模式
+    std::vector<LoadTarget> targets;
+};
+
+struct LoadResult {
+    Histogram latency;      // 单位us
+    uint64_t requests = 0;  // 统计阶段完成的请求数
+    uint64_t bytes = 0;     // 统计阶段收到的字节数
+    uint64_t non2xx = 0;
+    uint64_t connectErrors = 0;
+    uint64_t ioErrors = 0;  // 读写出错或连接被意外关闭
+    uint64_t unfinished = 0;    // 统计阶段发送(开环模式按计划时间)、没有收到响应的请求：所在连接被关闭，或开环模式结束时仍未收到
+    uint64_t connects = 0;
+    double seconds = 0;     // 统计阶段的实际时长
+};
+
+// 拼接请求报文
+LoadTarget MakeGetTarget(const LoadOptions& opt, const std::string& path, int weight);
+LoadTarget MakeLoginTarget(const LoadOptions& opt, const std::string& user,
+                           const std::string& pwd, int weight);
+
+// 运行压测(阻塞到结束)，返回合并后的结果
+LoadResult RunLoad(const LoadOptions& opt);
+
+void PrintResult(const LoadOptions& opt, const LoadResult& res);
+
+// 速率扫描中的一档
+struct SweepPoint {
+    double rate;
+    LoadResult result;
+    bool saturated;     // 吞吐跟不上计划速率，或p99超过最低一档的kneeFactor倍
+};
+
+// 从from到to按step逐档做开环压测，连续两档饱和后提前停止
+std::vector<SweepPoint> RunSweep(LoadOptions opt, double from, double to, double step,
+                                 double kneeFactor);
+
+// 拐点：返回第一个饱和档之前的最后一档在points中的下标(速率为points[i].rate)，第一档就饱和时返回-1
+int FindKnee(const std::vector<SweepPoint>& points);
+
+// 机器可读的输出，label用于区分不同的服务器配置(如 trig=3 threads=6)
+void WriteCsv(FILE* fp, const std::string& label, const LoadOptions& opt,
+              const std::vector<SweepPoint>& points, bool header);
+void WriteJson(FILE* fp, const std::string& label, const LoadOptions& opt,
+               const std::vector<SweepPoint>& points);
+
+#endif //BENCH_LOADGEN_H
@@ -0,0 +1,161 @@
+/*
+ * loadgen: 基于epoll的HTTP压测工具，替代webbench(每个客户端一个进程、每个请求一个连接)
+ * 每个线程用一个epoll管理上千个长连接，支持pipeline、请求组合、预热，输出延迟分位数
+ *
+ *   ./loadgen -c 1000 -t 4 -d 10 -w 2 -g /index.html:8 -g /css/style.css:2 -l name:password:1 127.0.0.1:1316
+ *
+ * 开环模式按固定速率发送，延迟从计划发送时间算起；-R 逐档提高速率找出饱和拐点：
+ *   ./loadgen -c 500 -t 4 -R 10000:100000:10000 -o csv -L "trig=3 threads=6" 127.0.0.1:1316
+ */
+#include <unistd.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "loadgen.h"
+
+using namespace std;
+
+static void Usage(const char* prog) {
+    fprintf(stderr,
+        "Usage: %s [options] host:port\n"
+        "  -c N          total connections (default 100)\n"
+        "  -t N          threads (default 4)\n"
+        "  -d SEC        measured duration (default 10)\n"
+        "  -w SEC        warmup, not measured (default 2)\n"
+        "  -p N          pipeline depth per connection (default 1)\n"
+        "  -C            new connection per request (no keep-alive)\n"
+        "  -g PATH[:W]   GET PATH with weight W, repeatable (default /)\n"
+        "  -l USER:PWD[:W]  POST /login.html with weight W, repeatable\n"
+        "  -r RATE       open loop: send RATE req/s on a fixed schedule\n"
+        "  -R FROM:TO:STEP  open loop rate sweep, reports the saturation knee\n"
+        "  -K F          a step is saturated when p99 > F * p99 of the first step (default 10)\n"
+        "  -o FMT        output format: text, csv or json (default text)\n"
+        "  -L LABEL      label written to csv/json, e.g. \"trig=3 threads=6\"\n", prog);
+}
+
+// 拆分 "a:b[:weight]"，没有weight时为1
+static int SplitWeight(string& spec, int fields) {
+    int weight = 1;
+    size_t colons = 0;
+    for(char ch: spec) { if(ch == ':') colons++; }
+    if(static_cast<int>(colons) >= fields) {
+        size_t idx = spec.find_last_of(':');
+        weight = atoi(spec.c_str() + idx + 1);
+        spec.resize(idx);
+    }
+    return weight > 0 ? weight : 1;
+}
+
+// 解析 "from:to:step"
+static bool ParseRange(const string& spec, double& from, double& to, double& step) {
+    return sscanf(spec.c_str(), "%lf:%lf:%lf", &from, &to, &step) == 3 &&
+           from > 0 && to >= from && step > 0;
+}
+
+int main(int argc, char* argv[]) {
+    LoadOptions opt;
+    bool sweep = false;
+    double from = 0, to = 0, step = 0;
+    double kneeFactor = 10;
+    string format = "text";
+    string label;
+    vector<pair<string, int>> gets;
+    vector<pair<string, int>> logins;
+    int ch;
+    while((ch = getopt(argc, argv, "c:t:d:w:p:Cg:l:r:R:K:o:L:h")) != -1) {
+        string spec = optarg ? optarg : "";
+        switch(ch) {
+        case 'c': opt.connections = atoi(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'd': opt.durationSec = atof(optarg); break;
+        case 'w': opt.warmupSec = atof(optarg); break;
+        case 'p': opt.pipeline = atoi(optarg); break;
+        case 'C': opt.keepAlive = false; break;
+        case 'g': {
+            int w = SplitWeight(spec, 1);
+            gets.push_back({spec, w});
+            break;
+        }
+        case 'l': {
+            int w = SplitWeight(spec, 2);
+            logins.push_back({spec, w});
+            break;
+        }
+        case 'r': opt.rate = atof(optarg); break;
+        case 'R':
+            if(!ParseRange(spec, from, to, step)) {
+                Usage(argv[0]);
+                return 2;
+            }
+            sweep = true;
+            break;
+        case 'K': kneeFactor = atof(optarg); break;
+        case 'o': format = spec; break;
+        case 'L': label = spec; break;
+        default:
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+    if(optind >= argc || opt.connections <= 0 || opt.threads <= 0 ||
+       opt.durationSec <= 0 || opt.warmupSec < 0 || opt.pipeline <= 0 || opt.rate < 0 ||
+       kneeFactor <= 1 || (format != "text" && format != "csv" && format != "json")) {
+        Usage(argv[0]);
+        return 2;
+    }
+    string addr = argv[optind];
+    size_t idx = addr.find(':');
+    if(idx != string::npos) {
+        opt.port = atoi(addr.c_str() + idx + 1);
+        addr.resize(idx);
+    }
+    opt.host = addr;
+
+    if(gets.empty() && logins.empty()) { gets.push_back({"/", 1}); }
+    for(auto& g: gets) {
+        opt.targets.push_back(MakeGetTarget(opt, g.first, g.second));
+    }
+    for(auto& l: logins) {
+        size_t sep = l.first.find(':');
+        if(sep == string::npos) {
+            Usage(argv[0]);
+            return 2;
+        }
+        opt.targets.push_back(MakeLoginTarget(opt, l.first.substr(0, sep), l.first.substr(sep + 1), l.second));
+    }
+
+    vector<SweepPoint> points;
+    if(sweep) {
+        points = RunSweep(opt, from, to, step, kneeFactor);
+    } else {
+        SweepPoint point;
+        point.rate = opt.rate;
+        point.result = RunLoad(opt);
+        point.saturated = false;
+        points.push_back(point);
+    }
+
+    if(format == "csv") {
+        WriteCsv(stdout, label, opt, points, true);
+    } else if(format == "json") {
+        WriteJson(stdout, label, opt, points);
+    } else {
+        for(auto& point: points) {
+            opt.rate = point.rate;
+            PrintResult(opt, point.result);
+            printf("\n");
+        }
+        if(sweep) {
+            int knee = FindKnee(points);
+            if(knee >= 0 && !points.back().saturated) {
+                printf("Knee: not reached, no saturation up to %.0f req/s\n", points[knee].rate);
+            } else if(knee >= 0) {
+                printf("Knee: %.0f req/s\n", points[knee].rate);
+            } else {
+                printf("Knee: not found, saturated at the first step\n");
+            }
+        }
+    }
+    return points.back().result.requests > 0 ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+/*
+ * microbench: 热点路径的微基准(Google Benchmark)，不依赖MySQL
+ * 每次改动热点路径前后各跑一次，用 --benchmark_out 保存结果再对比：
+ *
+ *   ./microbench --benchmark_out=before.json --benchmark_out_format=json
+ *   ./microbench --benchmark_filter=HeapTimer
+ */
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include "../code/buffer/buffer.h"
+#include "../code/http/httprequest.h"
+#include "../code/timer/heaptimer.h"
+#include "../code/pool/threadpool.h"
+#include "../code/log/log.h"
+
+using namespace std;
+
+/* ---------------- Buffer ---------------- */
+
+static void BM_BufferAppend(benchmark::State& state) {
+    const string data(state.range(0), 'x');
+    Buffer buff;
+    for(auto _: state) {
+        buff.Append(data);
+        if(buff.ReadableBytes() >= (1 << 20)) { buff.RetrieveAll(); }
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_BufferAppend)->Arg(16)->Arg(256)->Arg(4096)->Arg(65536);
+
+// 读走大部分数据后再追加：MakeSpace_把剩余数据挪到头部，不扩容
+static void BM_BufferMakeSpaceCompact(benchmark::State& state) {
+    const size_t size = state.range(0);
+    const string data(size * 3 / 4, 'x');
+    Buffer buff(size);
+    for(auto _: state) {
+        buff.Append(data);
+        buff.Retrieve(data.size() - 16);
+        buff.Append(data);      // 可写空间不够，但加上头部已读空间够
+        buff.RetrieveAll();
+    }
+    state.SetBytesProcessed(state.iterations() * data.size() * 2);
+}
+BENCHMARK(BM_BufferMakeSpaceCompact)->Arg(1024)->Arg(16384);
+
+// 从默认的1KB开始逐步追加到N字节：MakeSpace_反复扩容
+static void BM_BufferMakeSpaceGrow(benchmark::State& state) {
+    const string chunk(512, 'x');
+    const size_t total = state.range(0);
+    for(auto _: state) {
+        Buffer buff;
+        for(size_t n = 0; n < total; n += chunk.size()) {
+            buff.Append(chunk);
+        }
+        benchmark::DoNotOptimize(buff.Peek());
+    }
+    state.SetBytesProcessed(state.iterations() * total);
+}
+BENCHMARK(BM_BufferMakeSpaceGrow)->Arg(16384)->Arg(262144)->Arg(1 << 20);
+
+// 从管道读N字节，超过Buffer可写空间(默认1KB)的部分先读到64KB的栈上临时数组再追加
+// 每轮先write再ReadFd，时间包含一次write系统调用
+static void BM_BufferReadFd(benchmark::State& state) {
+    const size_t size = state.range(0);
+    int fds[2];
+    if(pipe2(fds, O_NONBLOCK) < 0) {
+        state.SkipWithError("pipe2 failed");
+        return;
+    }
+    fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);
+    const string data(size, 'x');
+    Buffer buff;
+    int err = 0;
+    for(auto _: state) {
+        ssize_t len = write(fds[1], data.data(), data.size());
+        benchmark::DoNotOptimize(len);
+        len = buff.ReadFd(fds[0], &err);
+        benchmark::DoNotOptimize(len);
+        buff.RetrieveAll();
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+    close(fds[0]);
+    close(fds[1]);
+}
+BENCHMARK(BM_BufferReadFd)->Arg(512)->Arg(16384)->Arg(131072);
+
+/* ---------------- HttpRequest ---------------- */
+
+struct Corpus {
+    const char* name;
+    string request;
+};
+
+static const vector<Corpus>& RequestCorpus() {
+    static const string BROWSER_HEADERS =
+        "Host: 127.0.0.1:1316\r\n"
+        "Connection: keep-alive\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+        "Chrome/120.0.0.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n";
+    static const string FORM = "username=benchuser&password=benchpassword%21";
+    static const vector<Corpus> corpus = {
+        {"minimal GET", "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"},
+        {"browser GET", "GET /index.html HTTP/1.1\r\n" + BROWSER_HEADERS + "\r\n"},
+        {"static asset", "GET /images/profile-image.jpg HTTP/1.1\r\n" + BROWSER_HEADERS +
+                         "Referer: http://127.0.0.1:1316/picture.html\r\n\r\n"},
+        {"login POST", "POST /login.html HTTP/1.1\r\n" + BROWSER_HEADERS +
+                       "Content-Type: application/x-www-form-urlencoded\r\n"
+                       "Content-Length: " + to_string(FORM.size()) + "\r\n\r\n" + FORM},
+    };
+    return corpus;
+}
+
+static void BM_HttpRequestParse(benchmark::State& state) {
+    const Corpus& corpus = RequestCorpus()[state.range(0)];
+    Buffer buff;
+    HttpRequest request;
+    for(auto _: state) {
+        buff.Append(corpus.request);
+        request.Init();
+        bool ok = request.parse(buff);
+        benchmark::DoNotOptimize(ok);
+        buff.RetrieveAll();
+    }
+    state.SetLabel(corpus.name);
+    state.SetBytesProcessed(state.iterations() * corpus.request.size());
+}
+BENCHMARK(BM_HttpRequestParse)->DenseRange(0, 3);
+
+/* ---------------- HeapTimer ---------------- */
+
+// 往空堆里加入N个定时器(超时时间乱序)
+static void BM_HeapTimerAdd(benchmark::State& state) {
+    const int n = state.range(0);
+    for(auto _: state) {
+        HeapTimer timer;
+        for(int i = 0; i < n; i++) {
+            timer.add(i, 60000 + (i * 7919) % 60000, nullptr);
+        }
+        state.PauseTiming();
+        timer.clear();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_HeapTimerAdd)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
+
+// 已有N个定时器时延长其中一个(每次有读写的活跃连接都会调用)
+static void BM_HeapTimerAdjust(benchmark::State& state) {
+    const int n = state.range(0);
+    HeapTimer timer;
+    for(int i = 0; i < n; i++) {
+        timer.add(i, 60000 + (i * 7919) % 60000, nullptr);
+    }
+    uint32_t id = 1;
+    for(auto _: state) {
+        id = id * 1103515245 + 12345;
+        timer.adjust(id % n, 120000);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_HeapTimerAdjust)->RangeMultiplier(10)->Range(10000, 1000000);
+
+// N个定时器全部到期，一次tick清除
+static void BM_HeapTimerTick(benchmark::State& state) {
+    const int n = state.range(0);
+    int fired = 0;
+    TimeoutCallBack cb = [&fired] { fired++; };
+    HeapTimer timer;
+    for(auto _: state) {
+        state.PauseTiming();
+        for(int i = 0; i < n; i++) {
+            timer.add(i, 0, cb);
+        }
+        state.ResumeTiming();
+        timer.tick();
+    }
+    benchmark::DoNotOptimize(fired);
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_HeapTimerTick)->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
+
+/* ---------------- ThreadPool ---------------- */
+
+// 每轮投递BATCH个空任务并等它们执行完，参数为线程数
+static void BM_ThreadPoolAddTask(benchmark::State& state) {
+    const int BATCH = 10000;
+    ThreadPool pool(state.range(0));
+    atomic<int> done(0);
+    for(auto _: state) {
+        done.store(0, memory_order_relaxed);
+        for(int i = 0; i < BATCH; i++) {
+            pool.AddTask([&done] { done.fetch_add(1, memory_order_relaxed); });
+        }
+        while(done.load(memory_order_relaxed) < BATCH) {
+            this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * BATCH);
+}
+BENCHMARK(BM_ThreadPoolAddTask)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+/* ---------------- Log ---------------- */
+
+// 参数0为同步写，否则为异步队列容量；日志写到 ./microbench_log
+static void BM_LogWrite(benchmark::State& state) {
+    Log::Instance()->init(1, "./microbench_log", ".log", state.range(0));
+    int cnt = 0;
+    for(auto _: state) {
+        LOG_INFO("client[%d](%s:%d) in, userCount:%d", cnt, "127.0.0.1", 50000 + (cnt & 0x3fff), cnt);
+        cnt++;
+    }
+    state.SetLabel(state.range(0) ? "async" : "sync");
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LogWrite)->Arg(0)->Arg(1024)->UseRealTime();
+
+BENCHMARK_MAIN();
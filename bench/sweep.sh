@@ -0,0 +1,26 @@
+#!/bin/sh
+# 对比触发模式(trigMode 0~3)和线程数：每种配置启动一次服务器，用loadgen做开环速率扫描，结果汇总到一个CSV
+# 在仓库根目录运行(先make，再cd bench && make)：
+#   MODES="0 3" THREADS="4 8" bench/sweep.sh 10000:100000:10000 sweep.csv
+RANGE=${1:-5000:50000:5000}
+OUT=${2:-sweep.csv}
+PORT=${PORT:-1316}
+MODES=${MODES:-"0 1 2 3"}
+THREADS=${THREADS:-"2 4 6 8"}
+LOADGEN_ARGS=${LOADGEN_ARGS:-"-c 200 -t 4 -w 2 -d 10"}
+
+rm -f "$OUT"
+for m in $MODES; do
+    for t in $THREADS; do
+        ./bin/server -p "$PORT" -m "$m" -t "$t" &
+        pid=$!
+        sleep 1
+        # shellcheck disable=SC2086
+        ./bench/loadgen $LOADGEN_ARGS -R "$RANGE" -o csv -L "trig=$m threads=$t" "127.0.0.1:$PORT" > "$OUT.part"
+        if [ -s "$OUT" ]; then tail -n +2 "$OUT.part" >> "$OUT"; else cat "$OUT.part" > "$OUT"; fi
+        kill "$pid"
+        wait "$pid" 2>/dev/null
+    done
+done
+rm -f "$OUT.part"
+echo "results in $OUT"
@@ -0,0 +1,23 @@
+#ifndef AUTH_STORE_H
+#define AUTH_STORE_H
+
+#include <string>
+
+// 用户存储后端的接口：MySQL(MysqlAuthStore) 或 本地文件(FileAuthStore)
+class AuthStore {
+public:
+    virtual ~AuthStore() = default;
+
+    // 查询用户密码，返回 1:找到 0:不存在 -1:出错
+    virtual int Lookup(const std::string& name, std::string& password) = 0;
+
+    // 注册用户，出错返回false(调用者保证用户名未被使用)
+    virtual bool Insert(const std::string& name, const std::string& password) = 0;
+
+    // 后端是否可用(如数据库连接池是否完成预热)
+    virtual bool IsReady() { return true; }
+
+    virtual const char* Name() const = 0;
+};
+
+#endif //AUTH_STORE_H
@@ -0,0 +1,164 @@
+#include "credcache.h"
+#include <random>
+#include <assert.h>
+
+using namespace std;
+
+CredentialCache::CredentialCache() {
+    isOpen_ = false;
+    shardCapacity_ = 0;
+    ttlMS_ = 0;
+    negativeTtlMS_ = 0;
+    key_[0] = key_[1] = 0;
+    hits_ = 0;
+    misses_ = 0;
+    negHits_ = 0;
+}
+
+CredentialCache* CredentialCache::Instance() {
+    static CredentialCache inst;
+    return &inst;
+}
+
+void CredentialCache::Init(size_t capacity, int ttlMS, int negativeTtlMS, size_t shardNum) {
+    assert(capacity > 0 && shardNum > 0);
+    random_device rd;
+    key_[0] = (static_cast<uint64_t>(rd()) << 32) | rd();
+    key_[1] = (static_cast<uint64_t>(rd()) << 32) | rd();
+    ttlMS_ = ttlMS;
+    negativeTtlMS_ = negativeTtlMS;
+    shardCapacity_ = (capacity + shardNum - 1) / shardNum;
+    shards_.clear();
+    for(size_t i = 0; i < shardNum; i++) {
+        shards_.emplace_back(new Shard);
+    }
+    isOpen_ = true;
+}
+
+static inline uint64_t Rotl(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+static inline void SipRound(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3) {
+    v0 += v1; v1 = Rotl(v1, 13); v1 ^= v0; v0 = Rotl(v0, 32);
+    v2 += v3; v3 = Rotl(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = Rotl(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = Rotl(v1, 17); v1 ^= v2; v2 = Rotl(v2, 32);
+}
+
+// SipHash-2-4，以进程随机密钥为键的伪随机函数：不知道密钥时无法由校验值离线猜测密码，内存中不保留明文密码
+uint64_t CredentialCache::Verifier_(const string& pwd) const {
+    uint64_t v0 = key_[0] ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = key_[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = key_[0] ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = key_[1] ^ 0x7465646279746573ULL;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(pwd.data());
+    size_t len = pwd.size();
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        uint64_t m = 0;
+        for(int j = 7; j >= 0; j--) { m = (m << 8) | p[i + j]; }    // 小端
+        v3 ^= m;
+        SipRound(v0, v1, v2, v3);
+        SipRound(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    uint64_t b = static_cast<uint64_t>(len) << 56;
+    for(size_t j = 0; i + j < len; j++) { b |= static_cast<uint64_t>(p[i + j]) << (8 * j); }
+    v3 ^= b;
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    v0 ^= b;
+    v2 ^= 0xff;
+    for(int r = 0; r < 4; r++) { SipRound(v0, v1, v2, v3); }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+CredentialCache::Shard& CredentialCache::GetShard_(const string& name) {
+    return *shards_[hash<string>()(name) % shards_.size()];
+}
+
+CredentialCache::LOOKUP CredentialCache::Lookup(const string& name, const string& pwd, bool& pwdMatch) {
+    pwdMatch = false;
+    if(!isOpen_) { return MISS; }
+    Shard& shard = GetShard_(name);
+    bool exists = false;
+    uint64_t verifier = 0;
+    {
+        lock_guard<mutex> locker(shard.mtx);
+        auto it = shard.index.find(name);
+        if(it == shard.index.end()) {
+            misses_.fetch_add(1, memory_order_relaxed);
+            return MISS;
+        }
+        auto node = it->second;
+        if(node->expires <= Clock::now()) {
+            // 过期，删除
+            shard.lru.erase(node);
+            shard.index.erase(it);
+            misses_.fetch_add(1, memory_order_relaxed);
+            return MISS;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, node);   // 移到表头
+        exists = node->exists;
+        verifier = node->verifier;
+    }
+    if(!exists) {
+        negHits_.fetch_add(1, memory_order_relaxed);
+        return USER_ABSENT;
+    }
+    hits_.fetch_add(1, memory_order_relaxed);
+    pwdMatch = (Verifier_(pwd) == verifier);
+    return USER_EXISTS;
+}
+
+void CredentialCache::Insert_(const string& name, uint64_t verifier, bool exists, int ttlMS) {
+    if(!isOpen_ || ttlMS <= 0) { return; }
+    Shard& shard = GetShard_(name);
+    Clock::time_point expires = Clock::now() + chrono::milliseconds(ttlMS);
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.index.find(name);
+    if(it != shard.index.end()) {
+        auto node = it->second;
+        node->verifier = verifier;
+        node->exists = exists;
+        node->expires = expires;
+        shard.lru.splice(shard.lru.begin(), shard.lru, node);
+        return;
+    }
+    while(shard.lru.size() >= shardCapacity_) {
+        // 淘汰最久没有使用的
+        shard.index.erase(shard.lru.back().name);
+        shard.lru.pop_back();
+    }
+    shard.lru.push_front({name, verifier, exists, expires});
+    shard.index[name] = shard.lru.begin();
+}
+
+void CredentialCache::Put(const string& name, const string& pwd) {
+    Insert_(name, Verifier_(pwd), true, ttlMS_);
+}
+
+void CredentialCache::PutAbsent(const string& name) {
+    Insert_(name, 0, false, negativeTtlMS_);
+}
+
+void CredentialCache::Erase(const string& name) {
+    if(!isOpen_) { return; }
+    Shard& shard = GetShard_(name);
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.index.find(name);
+    if(it != shard.index.end()) {
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+}
+
+size_t CredentialCache::Size() {
+    size_t n = 0;
+    for(auto& shard: shards_) {
+        lock_guard<mutex> locker(shard->mtx);
+        n += shard->lru.size();
+    }
+    return n;
+}
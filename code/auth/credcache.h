@@ -0,0 +1,76 @@
+#ifndef CRED_CACHE_H
+#define CRED_CACHE_H
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <chrono>
+#include <stdint.h>
+
+// 用户凭证缓存：用户名 -> 密码校验值，分片加锁，每个分片LRU淘汰，带过期时间
+// 不保存明文密码，只保存加了进程随机密钥的哈希值
+class CredentialCache {
+public:
+    enum LOOKUP {
+        MISS = 0,       // 缓存中没有，需要查询数据库
+        USER_EXISTS,    // 用户存在(pwdMatch表示密码是否正确)
+        USER_ABSENT,    // 用户不存在(负缓存)
+    };
+
+    static CredentialCache* Instance();
+
+    void Init(size_t capacity = 10000, int ttlMS = 300000,
+              int negativeTtlMS = 5000, size_t shardNum = 16);
+    bool IsOpen() const { return isOpen_; }
+
+    LOOKUP Lookup(const std::string& name, const std::string& pwd, bool& pwdMatch);
+    void Put(const std::string& name, const std::string& pwd);  // 查询到用户或注册成功(写穿)
+    void PutAbsent(const std::string& name);                    // 用户不存在
+    void Erase(const std::string& name);
+
+    uint64_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+    uint64_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+    uint64_t NegativeHits() const { return negHits_.load(std::memory_order_relaxed); }
+    size_t Size();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        std::string name;
+        uint64_t verifier;      // 密码校验值
+        bool exists;            // false表示负缓存
+        Clock::time_point expires;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::list<Entry> lru;   // 表头是最近使用的
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    };
+
+    CredentialCache();
+    ~CredentialCache() = default;
+
+    Shard& GetShard_(const std::string& name);
+    void Insert_(const std::string& name, uint64_t verifier, bool exists, int ttlMS);
+    uint64_t Verifier_(const std::string& pwd) const;
+
+    bool isOpen_;
+    size_t shardCapacity_;  // 每个分片的最大条目数
+    int ttlMS_;
+    int negativeTtlMS_;
+    uint64_t key_[2];       // 进程随机的128位密钥
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> negHits_;
+};
+
+#endif //CRED_CACHE_H
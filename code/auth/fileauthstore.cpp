@@ -0,0 +1,195 @@
+#include "fileauthstore.h"
+#include <fcntl.h>       // open
+#include <unistd.h>      // write, fdatasync
+#include <sys/stat.h>    // mkdir
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include "../log/log.h"
+
+using namespace std;
+
+FileAuthStore::Table::Table(size_t capacity) : mask(capacity - 1), slots(new atomic<Entry*>[capacity]) {
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    for(size_t i = 0; i < capacity; i++) {
+        slots[i].store(nullptr, memory_order_relaxed);
+    }
+}
+
+FileAuthStore::FileAuthStore(const char* path, size_t initCapacity) : path_(path), fd_(-1), count_(0) {
+    size_t capacity = 16;
+    while(capacity < initCapacity * 2) { capacity <<= 1; }
+    tables_.emplace_back(new Table(capacity));
+    table_.store(tables_.back().get(), memory_order_release);
+
+    // 目录不存在时创建(一层，与日志目录相同的做法)
+    string::size_type idx = path_.find_last_of('/');
+    if(idx != string::npos && idx > 0) {
+        mkdir(path_.substr(0, idx).c_str(), 0777);
+    }
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0600);
+    if(fd_ < 0) {
+        LOG_ERROR("FileAuthStore open %s error: %s", path_.c_str(), strerror(errno));
+        return;
+    }
+    if(!Load_()) {
+        close(fd_);
+        fd_ = -1;
+        return;
+    }
+    LOG_INFO("FileAuthStore %s loaded %d users", path_.c_str(), (int)Size());
+}
+
+FileAuthStore::~FileAuthStore() {
+    if(fd_ >= 0) { close(fd_); }
+}
+
+uint64_t FileAuthStore::Hash_(const string& str) {
+    uint64_t h = 14695981039346656037ULL;
+    for(unsigned char ch: str) {
+        h ^= ch;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+uint32_t FileAuthStore::Checksum_(const string& name, const string& password) {
+    uint64_t h = Hash_(name) * 31 + Hash_(password);
+    return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+// 重放日志文件
+bool FileAuthStore::Load_() {
+    off_t offset = 0;
+    off_t end = lseek(fd_, 0, SEEK_END);
+    if(end < 0) { return false; }
+    lock_guard<mutex> locker(writeMtx_);
+    while(offset < end) {
+        RecordHeader header;
+        if(pread(fd_, &header, sizeof(header), offset) != sizeof(header) ||
+           header.nameLen == 0 || header.nameLen > MAX_FIELD_LEN || header.pwdLen > MAX_FIELD_LEN ||
+           offset + static_cast<off_t>(sizeof(header) + header.nameLen + header.pwdLen) > end) {
+            break;
+        }
+        string name(header.nameLen, '\0'), password(header.pwdLen, '\0');
+        off_t pos = offset + sizeof(header);
+        if(pread(fd_, &name[0], header.nameLen, pos) != static_cast<ssize_t>(header.nameLen) ||
+           (header.pwdLen && pread(fd_, &password[0], header.pwdLen, pos + header.nameLen) != static_cast<ssize_t>(header.pwdLen)) ||
+           Checksum_(name, password) != header.checksum) {
+            break;
+        }
+        uint64_t hash = Hash_(name);
+        Entry* entry = Find_(table_.load(memory_order_relaxed), name, hash);
+        if(entry) {
+            entry->password = password;     // 同名记录以最后一条为准
+        } else {
+            entries_.emplace_back(new Entry{hash, move(name), move(password)});
+            Publish_(table_.load(memory_order_relaxed), entries_.back().get());
+        }
+        offset = pos + header.nameLen + header.pwdLen;
+    }
+    if(offset < end) {
+        // 上次写入中途崩溃留下的半条记录
+        LOG_WARN("FileAuthStore %s truncate broken tail at %lld", path_.c_str(), (long long)offset);
+        if(ftruncate(fd_, offset) < 0) {
+            LOG_ERROR("FileAuthStore truncate error: %s", strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+FileAuthStore::Entry* FileAuthStore::Find_(Table* table, const string& name, uint64_t hash) const {
+    for(size_t i = hash & table->mask; ; i = (i + 1) & table->mask) {
+        Entry* entry = table->slots[i].load(memory_order_acquire);
+        if(!entry) { return nullptr; }
+        if(entry->hash == hash && entry->name == name) { return entry; }
+    }
+}
+
+void FileAuthStore::Publish_(Table* table, Entry* entry) {
+    if((count_.load(memory_order_relaxed) + 1) * 2 > table->mask + 1) {
+        Grow_();    // 负载因子超过0.5，扩容
+        table = table_.load(memory_order_relaxed);
+    }
+    for(size_t i = entry->hash & table->mask; ; i = (i + 1) & table->mask) {
+        if(!table->slots[i].load(memory_order_relaxed)) {
+            table->slots[i].store(entry, memory_order_release);
+            break;
+        }
+    }
+    count_.fetch_add(1, memory_order_relaxed);
+}
+
+void FileAuthStore::Grow_() {
+    Table* old = table_.load(memory_order_relaxed);
+    unique_ptr<Table> table(new Table((old->mask + 1) * 2));
+    for(auto& entry: entries_) {
+        if(Find_(old, entry->name, entry->hash) != entry.get()) { continue; }  // 还未发布的
+        for(size_t i = entry->hash & table->mask; ; i = (i + 1) & table->mask) {
+            if(!table->slots[i].load(memory_order_relaxed)) {
+                table->slots[i].store(entry.get(), memory_order_relaxed);
+                break;
+            }
+        }
+    }
+    table_.store(table.get(), memory_order_release);
+    tables_.push_back(move(table));
+}
+
+bool FileAuthStore::Append_(const string& name, const string& password) {
+    RecordHeader header;
+    header.nameLen = name.size();
+    header.pwdLen = password.size();
+    header.checksum = Checksum_(name, password);
+    string record(reinterpret_cast<const char*>(&header), sizeof(header));
+    record += name;
+    record += password;
+
+    off_t offset = lseek(fd_, 0, SEEK_END);
+    const char* data = record.data();
+    size_t left = record.size();
+    while(left > 0) {
+        ssize_t len = write(fd_, data, left);
+        if(len < 0) {
+            if(errno == EINTR) { continue; }
+            break;
+        }
+        data += len;
+        left -= len;
+    }
+    if(left > 0 || fdatasync(fd_) < 0) {
+        LOG_ERROR("FileAuthStore write error: %s", strerror(errno));
+        // 去掉写了一半的记录，否则后面的记录在重放时会被丢弃
+        if(offset >= 0 && ftruncate(fd_, offset) < 0) {
+            LOG_ERROR("FileAuthStore truncate error: %s", strerror(errno));
+        }
+        return false;
+    }
+    return true;
+}
+
+int FileAuthStore::Lookup(const string& name, string& password) {
+    if(fd_ < 0) { return -1; }
+    Entry* entry = Find_(table_.load(memory_order_acquire), name, Hash_(name));
+    if(!entry) { return 0; }
+    password = entry->password;
+    return 1;
+}
+
+bool FileAuthStore::Insert(const string& name, const string& password) {
+    if(fd_ < 0 || name.empty() || name.size() > MAX_FIELD_LEN || password.size() > MAX_FIELD_LEN) {
+        return false;
+    }
+    lock_guard<mutex> locker(writeMtx_);
+    uint64_t hash = Hash_(name);
+    if(Find_(table_.load(memory_order_relaxed), name, hash)) {
+        return false;   // 并发注册了同名用户
+    }
+    if(!Append_(name, password)) {
+        return false;
+    }
+    entries_.emplace_back(new Entry{hash, name, password});
+    Publish_(table_.load(memory_order_relaxed), entries_.back().get());
+    return true;
+}
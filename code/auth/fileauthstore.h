@@ -0,0 +1,70 @@
+#ifndef FILE_AUTH_STORE_H
+#define FILE_AUTH_STORE_H
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+#include "authstore.h"
+
+// 不依赖数据库的本地用户存储：
+// 注册先追加写入日志文件(write-ahead)并落盘，再发布到内存中的开放寻址哈希表
+// 查询不加锁：哈希表的槽是原子指针，条目发布后不再修改和删除
+// 启动时重放日志文件重建哈希表，尾部不完整的记录会被截断
+class FileAuthStore : public AuthStore {
+public:
+    explicit FileAuthStore(const char* path = "./data/user.db", size_t initCapacity = 1024);
+    ~FileAuthStore();
+
+    int Lookup(const std::string& name, std::string& password) override;
+    bool Insert(const std::string& name, const std::string& password) override;
+    bool IsReady() override { return fd_ >= 0; }
+    const char* Name() const override { return "file"; }
+
+    size_t Size() const { return count_.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry {
+        uint64_t hash;
+        std::string name;
+        std::string password;
+    };
+
+    struct Table {
+        explicit Table(size_t capacity);
+        size_t mask;    // 容量-1，容量是2的幂
+        std::unique_ptr<std::atomic<Entry*>[]> slots;
+    };
+
+    // 日志记录头，后面紧跟name和password
+    struct RecordHeader {
+        uint32_t nameLen;
+        uint32_t pwdLen;
+        uint32_t checksum;
+    };
+
+    bool Load_();
+    bool Append_(const std::string& name, const std::string& password);
+    void Publish_(Table* table, Entry* entry);  // 写者持锁调用
+    void Grow_();                               // 写者持锁调用
+    Entry* Find_(Table* table, const std::string& name, uint64_t hash) const;
+
+    static uint64_t Hash_(const std::string& str);
+    static uint32_t Checksum_(const std::string& name, const std::string& password);
+
+    static const uint32_t MAX_FIELD_LEN = 4096;
+
+    std::string path_;
+    int fd_;
+
+    std::atomic<Table*> table_;
+    std::vector<std::unique_ptr<Table>> tables_;    // 扩容后旧表保留到析构，读者可能还在使用
+    std::vector<std::unique_ptr<Entry>> entries_;
+    std::atomic<size_t> count_;
+    std::mutex writeMtx_;   // 注册串行化
+};
+
+#endif //FILE_AUTH_STORE_H
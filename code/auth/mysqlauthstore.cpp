@@ -0,0 +1,117 @@
+#include "mysqlauthstore.h"
+#include <string.h>
+#include "../log/log.h"
+
+using namespace std;
+
+MysqlAuthStore::MysqlAuthStore(const char* host, int port,
+                               const char* user, const char* pwd, const char* dbName,
+                               int connSize, int maxConnSize, bool lazy) {
+    SqlConnPool::Instance()->Init(host, port, user, pwd, dbName,
+                                  connSize, maxConnSize, 1000, 60000, 10000, lazy);
+}
+
+MysqlAuthStore::~MysqlAuthStore() {
+    SqlConnPool::Instance()->ClosePool();
+}
+
+bool MysqlAuthStore::IsReady() {
+    return SqlConnPool::Instance()->IsReady();
+}
+
+// 执行失败后关闭连接上的语句：连接仍然可用、只是服务端丢失了语句时返回true，重新预处理后重试一次
+// 连接断开时不在这里重试(句柄已经失效)，语句缓存被清空，下次GetConn检查时重连
+bool MysqlAuthStore::ResetStmts_(MYSQL* sql, unsigned int err) {
+    if(err == ER_UNKNOWN_STMT_HANDLER || err == ER_NEED_REPREPARE) {
+        SqlConnPool::Instance()->ResetStmts(sql);
+        return true;
+    }
+    if(err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) {
+        SqlConnPool::Instance()->ResetStmts(sql);
+    }
+    return false;
+}
+
+int MysqlAuthStore::Lookup(const string& name, string& password) {
+    MYSQL* sql;
+    SqlConnRAII raii(&sql, SqlConnPool::Instance());
+    if(!sql) { return -1; }
+
+    for(int retry = 0; retry < 2; retry++) {
+        MYSQL_STMT* stmt = SqlConnPool::Instance()->GetStmt(sql, STMT_SELECT_USER);
+        if(!stmt) { return -1; }
+
+        MYSQL_BIND param[1];
+        memset(param, 0, sizeof(param));
+        unsigned long nameLen = name.size();
+        param[0].buffer_type = MYSQL_TYPE_STRING;
+        param[0].buffer = const_cast<char*>(name.data());
+        param[0].buffer_length = nameLen;
+        param[0].length = &nameLen;
+
+        char buff[256] = { 0 };
+        unsigned long len = 0;
+        MYSQL_BIND result[1];
+        memset(result, 0, sizeof(result));
+        result[0].buffer_type = MYSQL_TYPE_STRING;
+        result[0].buffer = buff;
+        result[0].buffer_length = sizeof(buff);
+        result[0].length = &len;
+
+        if(mysql_stmt_bind_param(stmt, param) || mysql_stmt_execute(stmt)) {
+            unsigned int err = mysql_stmt_errno(stmt);
+            LOG_WARN("Select user error: %s", mysql_stmt_error(stmt));
+            if(ResetStmts_(sql, err)) { continue; }
+            return -1;
+        }
+        if(mysql_stmt_bind_result(stmt, result) || mysql_stmt_store_result(stmt)) {
+            LOG_WARN("Select user error: %s", mysql_stmt_error(stmt));
+            mysql_stmt_free_result(stmt);
+            return -1;
+        }
+        int ret = mysql_stmt_fetch(stmt);
+        int found = 0;
+        if(ret == 0 || ret == MYSQL_DATA_TRUNCATED) {
+            password.assign(buff, min(len, static_cast<unsigned long>(sizeof(buff))));
+            found = 1;
+        }
+        else if(ret != MYSQL_NO_DATA) {
+            found = -1;
+        }
+        mysql_stmt_free_result(stmt);
+        return found;
+    }
+    return -1;
+}
+
+bool MysqlAuthStore::Insert(const string& name, const string& pwd) {
+    MYSQL* sql;
+    SqlConnRAII raii(&sql, SqlConnPool::Instance());
+    if(!sql) { return false; }
+
+    for(int retry = 0; retry < 2; retry++) {
+        MYSQL_STMT* stmt = SqlConnPool::Instance()->GetStmt(sql, STMT_INSERT_USER);
+        if(!stmt) { return false; }
+
+        MYSQL_BIND param[2];
+        memset(param, 0, sizeof(param));
+        unsigned long nameLen = name.size(), pwdLen = pwd.size();
+        param[0].buffer_type = MYSQL_TYPE_STRING;
+        param[0].buffer = const_cast<char*>(name.data());
+        param[0].buffer_length = nameLen;
+        param[0].length = &nameLen;
+        param[1].buffer_type = MYSQL_TYPE_STRING;
+        param[1].buffer = const_cast<char*>(pwd.data());
+        param[1].buffer_length = pwdLen;
+        param[1].length = &pwdLen;
+
+        if(mysql_stmt_bind_param(stmt, param) || mysql_stmt_execute(stmt)) {
+            unsigned int err = mysql_stmt_errno(stmt);
+            LOG_WARN("Insert user error: %s", mysql_stmt_error(stmt));
+            if(ResetStmts_(sql, err)) { continue; }
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,29 @@
+#ifndef MYSQL_AUTH_STORE_H
+#define MYSQL_AUTH_STORE_H
+
+#include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
+
+#include "authstore.h"
+#include "../pool/sqlconnpool.h"
+#include "../pool/sqlconnRAII.h"
+
+// 基于SqlConnPool的用户存储，使用连接上预处理好的语句
+class MysqlAuthStore : public AuthStore {
+public:
+    MysqlAuthStore(const char* host, int port,
+                   const char* user, const char* pwd, const char* dbName,
+                   int connSize, int maxConnSize, bool lazy);
+    ~MysqlAuthStore();
+
+    int Lookup(const std::string& name, std::string& password) override;
+    bool Insert(const std::string& name, const std::string& password) override;
+    bool IsReady() override;
+    const char* Name() const override { return "mysql"; }
+
+private:
+    static bool ResetStmts_(MYSQL* sql, unsigned int err);
+};
+
+#endif //MYSQL_AUTH_STORE_H
@@ -0,0 +1,101 @@
+#include "bodyfile.h"
+#include <fcntl.h>       // splice, open
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>      // mkstemp
+#include <vector>
+#include "../log/log.h"
+
+using namespace std;
+
+// 工作线程的splice管道：每次移入的数据都会全部移出，管道在同一线程的连接间复用
+struct SplicePipe {
+    int fd[2];
+    SplicePipe() { fd[0] = fd[1] = -1; }
+    ~SplicePipe() { Reset(); }
+    bool Open() {
+        if(fd[0] >= 0) { return true; }
+        if(pipe2(fd, O_NONBLOCK | O_CLOEXEC) < 0) {
+            fd[0] = fd[1] = -1;
+            return false;
+        }
+        fcntl(fd[1], F_SETPIPE_SZ, BodyFile::PIPE_SIZE);   // 失败时保持默认64KB
+        return true;
+    }
+    void Reset() {
+        if(fd[0] >= 0) { close(fd[0]); close(fd[1]); }
+        fd[0] = fd[1] = -1;
+    }
+};
+
+BodyFile::BodyFile(): fd_(-1), size_(0) {}
+
+BodyFile::~BodyFile() {
+    Close();
+}
+
+bool BodyFile::Open(const string& dir) {
+    Close();
+    string name = dir + "/webserver-body-XXXXXX";
+    vector<char> path(name.begin(), name.end());
+    path.push_back('\0');
+    fd_ = mkostemp(path.data(), O_CLOEXEC);
+    if(fd_ < 0) {
+        LOG_ERROR("Create body file in %s error: %d", dir.c_str(), errno);
+        return false;
+    }
+    unlink(path.data());
+    size_ = 0;
+    return true;
+}
+
+bool BodyFile::Write(const char* data, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd_, data, len);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            LOG_ERROR("Write body file error: %d", errno);
+            return false;
+        }
+        data += n;
+        len -= n;
+        size_ += n;
+    }
+    return true;
+}
+
+ssize_t BodyFile::SpliceFrom(int sockFd, size_t maxLen, int* saveErrno) {
+    static thread_local SplicePipe splicePipe;
+    if(!splicePipe.Open()) {
+        *saveErrno = errno;
+        return -1;
+    }
+    ssize_t len = splice(sockFd, nullptr, splicePipe.fd[1], nullptr, min<size_t>(maxLen, PIPE_SIZE),
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(len <= 0) {
+        *saveErrno = len < 0 ? errno : 0;
+        return len;
+    }
+    // 管道 -> 文件，必须全部移出；写文件失败时丢弃这个管道(里面还有残留数据)
+    for(ssize_t left = len; left > 0; ) {
+        ssize_t n = splice(splicePipe.fd[0], nullptr, fd_, nullptr, left, SPLICE_F_MOVE);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) { continue; }
+            LOG_ERROR("Splice body file error: %d", errno);
+            splicePipe.Reset();
+            *saveErrno = EIO;
+            return -1;
+        }
+        left -= n;
+    }
+    size_ += len;
+    return len;
+}
+
+void BodyFile::Close() {
+    if(fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    size_ = 0;
+}
@@ -0,0 +1,30 @@
+#ifndef BODY_FILE_H
+#define BODY_FILE_H
+
+#include <string>
+#include <sys/types.h>
+
+// 大请求体的临时文件：创建后立即删除目录项，只通过fd访问，关闭时空间自动释放
+// 请求体剩余部分可以用splice从socket经管道直接移入文件，不经过用户态缓冲区
+class BodyFile {
+public:
+    BodyFile();
+    ~BodyFile();
+
+    bool Open(const std::string& dir);
+    bool Write(const char* data, size_t len);
+    // 从socket移入最多maxLen字节：返回移入的字节数，对端关闭返回0，出错或没有数据返回-1(saveErrno)
+    ssize_t SpliceFrom(int sockFd, size_t maxLen, int* saveErrno);
+    void Close();
+
+    int Fd() const { return fd_; }
+    size_t Size() const { return size_; }
+
+    static const int PIPE_SIZE = 1024 * 1024;  // 每个工作线程一个管道，尽量一次移入1MB
+
+private:
+    int fd_;
+    size_t size_;
+};
+
+#endif //BODY_FILE_H
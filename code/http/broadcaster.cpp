@@ -0,0 +1,73 @@
+#include "broadcaster.h"
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+Broadcaster* Broadcaster::Instance() {
+    static Broadcaster instance;
+    return &instance;
+}
+
+// 锁顺序：连接 -> Broadcaster；Publish()不同时持有两把锁
+bool Broadcaster::Subscribe(const string& topic, const WsConnPtr& conn) {
+    assert(conn);
+    lock_guard<mutex> connLocker(conn->mtx_);
+    if(conn->closed_) { return false; }
+    lock_guard<mutex> locker(mtx_);
+    if(topics_[topic].emplace(conn.get(), conn).second) {
+        conn->topics_.push_back(topic);
+    }
+    return true;
+}
+
+void Broadcaster::Unsubscribe(const string& topic, const WsConnPtr& conn) {
+    assert(conn);
+    lock_guard<mutex> connLocker(conn->mtx_);
+    vector<string>& topics = conn->topics_;
+    topics.erase(remove(topics.begin(), topics.end(), topic), topics.end());
+    lock_guard<mutex> locker(mtx_);
+    Remove_(topic, conn.get());
+}
+
+void Broadcaster::Remove_(const string& topic, WebSocketConn* conn) {
+    auto it = topics_.find(topic);
+    if(it == topics_.end()) { return; }
+    it->second.erase(conn);
+    if(it->second.empty()) {
+        topics_.erase(it);
+    }
+}
+
+size_t Broadcaster::Publish(const string& topic, const string& msg, int opcode) {
+    return Publish(topic, WebSocketConn::MakeFrame(opcode, msg.data(), msg.size()));
+}
+
+size_t Broadcaster::Publish(const string& topic, const WsFrame& frame) {
+    // 锁内只复制订阅者列表；入队和注册EPOLLOUT(系统调用)在锁外，不阻塞其他主题的订阅和发布
+    static thread_local vector<WsConnPtr> subscribers;
+    {
+        lock_guard<mutex> locker(mtx_);
+        auto it = topics_.find(topic);
+        if(it == topics_.end()) { return 0; }
+        subscribers.reserve(it->second.size());
+        for(const auto& kv: it->second) {
+            subscribers.push_back(kv.second);
+        }
+    }
+    size_t queued = 0;
+    for(const WsConnPtr& conn: subscribers) {
+        if(conn->SendFrame(frame)) { queued++; }
+    }
+    published_.fetch_add(1, memory_order_relaxed);
+    delivered_.fetch_add(queued, memory_order_relaxed);
+    dropped_.fetch_add(subscribers.size() - queued, memory_order_relaxed);
+    subscribers.clear();
+    return queued;
+}
+
+size_t Broadcaster::Subscribers(const string& topic) {
+    lock_guard<mutex> locker(mtx_);
+    auto it = topics_.find(topic);
+    return it == topics_.end() ? 0 : it->second.size();
+}
@@ -0,0 +1,49 @@
+#ifndef BROADCASTER_H
+#define BROADCASTER_H
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+#include "websocket.h"
+
+// WebSocket的发布/订阅：按主题保存订阅的连接，发布时消息只编码成一个帧，
+// 各订阅者的发送队列引用同一块内存(引用计数)，由各自的工作线程批量writev写出
+// 发送队列超过HIGH_WATER的慢订阅者跳过这条消息(计入dropped)，不会拖慢发布者和其他订阅者
+class Broadcaster {
+public:
+    static Broadcaster* Instance();
+
+    // 连接已关闭时返回false；连接关闭时自动退订
+    bool Subscribe(const std::string& topic, const WsConnPtr& conn);
+    void Unsubscribe(const std::string& topic, const WsConnPtr& conn);
+
+    // 返回成功排入发送队列的订阅者数，可在任何线程调用
+    size_t Publish(const std::string& topic, const std::string& msg, int opcode = WebSocketConn::TEXT);
+    size_t Publish(const std::string& topic, const WsFrame& frame);
+
+    size_t Subscribers(const std::string& topic);
+
+    uint64_t Published() const { return published_.load(std::memory_order_relaxed); }
+    uint64_t Delivered() const { return delivered_.load(std::memory_order_relaxed); }
+    uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    Broadcaster(): published_(0), delivered_(0), dropped_(0) {}
+    ~Broadcaster() = default;
+
+    void Remove_(const std::string& topic, WebSocketConn* conn);    // 调用者持有mtx_
+    friend class WebSocketConn;     // Shutdown()时退订所有主题
+
+    typedef std::unordered_map<WebSocketConn*, WsConnPtr> SubscriberMap;
+
+    std::mutex mtx_;
+    std::unordered_map<std::string, SubscriberMap> topics_;
+
+    std::atomic<uint64_t> published_;
+    std::atomic<uint64_t> delivered_;
+    std::atomic<uint64_t> dropped_;
+};
+
+#endif //BROADCASTER_H
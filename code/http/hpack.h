@@ -0,0 +1,51 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include <stddef.h>
+
+// HTTP/2头部压缩(RFC 7541)
+typedef std::vector<std::pair<std::string, std::string>> HeaderList;
+
+// 解码器：每个连接一个，动态表在同一连接的所有头部块之间共享，必须按收到的顺序解码
+class HpackDecoder {
+public:
+    // maxListSize：一个头部块解码后的总大小上限(每个字段name+value+32，同SETTINGS_MAX_HEADER_LIST_SIZE)，
+    // 少量字节引用动态表中的大条目可以解出很多头部，只限制头部块的字节数不够
+    explicit HpackDecoder(size_t maxTableSize = 4096, size_t maxListSize = 64 * 1024);
+
+    // 解码一个完整的头部块，追加到headers；格式错误或超过maxListSize返回false(连接错误COMPRESSION_ERROR)
+    bool Decode(const uint8_t* data, size_t len, HeaderList& headers);
+
+    size_t TableSize() const { return size_; }
+
+    // 整数和字符串的基本编码，编码器和测试也会用到
+    static bool DecodeInt(const uint8_t*& p, const uint8_t* end, int prefixBits, uint64_t& value);
+    static bool DecodeString(const uint8_t*& p, const uint8_t* end, std::string& out);
+    static bool HuffmanDecode(const uint8_t* data, size_t len, std::string& out);
+
+private:
+    bool Lookup_(uint64_t index, std::string& name, std::string& value) const;
+    void Insert_(const std::string& name, const std::string& value);
+    void Evict_();
+
+    std::deque<std::pair<std::string, std::string>> dynamic_;  // 头部为最新插入的条目
+    size_t size_;       // 动态表当前大小(每个条目name+value+32)
+    size_t maxSize_;    // 对端通过动态表大小更新设置的上限
+    size_t limit_;      // 本端SETTINGS_HEADER_TABLE_SIZE，maxSize_不能超过它
+    size_t maxListSize_;
+};
+
+// 编码器：不使用动态表(无状态)，静态表命中时用索引，其余按不索引的字面量编码
+class HpackEncoder {
+public:
+    static void Encode(const HeaderList& headers, std::string& out);
+    static void EncodeInt(std::string& out, uint64_t value, int prefixBits, uint8_t flags);
+    static void EncodeString(std::string& out, const std::string& str);
+};
+
+#endif //HPACK_H
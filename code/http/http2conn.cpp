@@ -0,0 +1,646 @@
+#include "http2conn.h"
+#include <string.h>
+#include <assert.h>
+#include "../log/accesslog.h"
+#include "../metrics/metrics.h"
+
+using namespace std;
+
+const char Http2Conn::PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static const uint8_t FLAG_END_STREAM = 0x1;
+static const uint8_t FLAG_ACK = 0x1;
+static const uint8_t FLAG_END_HEADERS = 0x4;
+static const uint8_t FLAG_PADDED = 0x8;
+static const uint8_t FLAG_PRIORITY = 0x20;
+
+static const int64_t MAX_WINDOW = 0x7fffffff;
+
+static uint32_t ReadU32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void AppendU32(string& out, uint32_t v) {
+    out += static_cast<char>(v >> 24);
+    out += static_cast<char>(v >> 16);
+    out += static_cast<char>(v >> 8);
+    out += static_cast<char>(v);
+}
+
+// HTTP/2的头部名为小写，HttpRequest按HTTP/1.x的写法查找(如Content-Type)
+static string CanonicalName(const string& name) {
+    if(name == ":authority") { return "Host"; }
+    string out = name;
+    bool upper = true;
+    for(char& ch: out) {
+        if(upper && ch >= 'a' && ch <= 'z') { ch = ch - 'a' + 'A'; }
+        upper = (ch == '-');
+    }
+    return out;
+}
+
+// HTTP2-Settings头：base64url编码(无填充)的SETTINGS帧负载
+static bool Base64UrlDecode(const string& in, string& out) {
+    int val = 0, bits = 0;
+    for(char ch: in) {
+        int d;
+        if(ch >= 'A' && ch <= 'Z') { d = ch - 'A'; }
+        else if(ch >= 'a' && ch <= 'z') { d = ch - 'a' + 26; }
+        else if(ch >= '0' && ch <= '9') { d = ch - '0' + 52; }
+        else if(ch == '-' || ch == '+') { d = 62; }
+        else if(ch == '_' || ch == '/') { d = 63; }
+        else if(ch == '=') { break; }
+        else { return false; }
+        val = (val << 6) | d;
+        bits += 6;
+        if(bits >= 8) {
+            bits -= 8;
+            out += static_cast<char>((val >> bits) & 0xff);
+        }
+    }
+    return true;
+}
+
+Http2Conn::Http2Conn(const char* srcDir, const sockaddr_in& addr,
+                     const function<string()>* metricsHandler,
+                     const unordered_map<string, StreamHandler>* streamHandlers, int ipSlot)
+    : srcDir_(srcDir), addr_(addr), metricsHandler_(metricsHandler), streamHandlers_(streamHandlers),
+      ipSlot_(ipSlot),
+      prefaceSeen_(false), settingsSent_(false), goAway_(false), peerGoAway_(false), lastStreamId_(0),
+      headerStream_(0), headerFlags_(0), decoder_(4096, MAX_HEADER_LIST),
+      peerMaxFrame_(MAX_FRAME_SIZE), peerInitialWindow_(65535), connSendWindow_(65535),
+      frontOffset_(0), queuedBytes_(0) {}
+
+/* ---------------- 发送队列 ---------------- */
+
+void Http2Conn::QueueRaw_(const string& data) {
+    Segment seg;
+    seg.data = data;
+    seg.ext = nullptr;
+    seg.len = 0;
+    queuedBytes_ += data.size();
+    out_.push_back(std::move(seg));
+}
+
+void Http2Conn::QueueFrame_(uint8_t type, uint8_t flags, uint32_t streamId, const char* payload, size_t len) {
+    string frame;
+    frame.reserve(9 + len);
+    frame += static_cast<char>(len >> 16);
+    frame += static_cast<char>(len >> 8);
+    frame += static_cast<char>(len);
+    frame += static_cast<char>(type);
+    frame += static_cast<char>(flags);
+    AppendU32(frame, streamId & 0x7fffffff);
+    if(payload) { frame.append(payload, len); }    // DATA帧的负载由调用者作为单独的一段追加
+    QueueRaw_(frame);
+}
+
+void Http2Conn::SendSettings_() {
+    if(settingsSent_) { return; }
+    settingsSent_ = true;
+    // SETTINGS_MAX_CONCURRENT_STREAMS、SETTINGS_INITIAL_WINDOW_SIZE、SETTINGS_MAX_HEADER_LIST_SIZE；其余使用默认值
+    string payload;
+    payload += '\0';
+    payload += '\x3';
+    AppendU32(payload, MAX_STREAMS);
+    payload += '\0';
+    payload += '\x4';
+    AppendU32(payload, STREAM_WINDOW);
+    payload += '\0';
+    payload += '\x6';
+    AppendU32(payload, MAX_HEADER_LIST);
+    QueueFrame_(SETTINGS, 0, 0, payload.data(), payload.size());
+}
+
+void Http2Conn::ResetStream_(uint32_t streamId, ERROR_CODE code) {
+    string payload;
+    AppendU32(payload, code);
+    QueueFrame_(RST_STREAM, 0, streamId, payload.data(), payload.size());
+    auto it = streams_.find(streamId);
+    if(it != streams_.end()) {
+        it->second->reset = true;
+        streams_.erase(it);
+    }
+}
+
+bool Http2Conn::ConnError_(ERROR_CODE code) {
+    if(!goAway_) {
+        LOG_WARN("HTTP/2 connection error: %d", code);
+        string payload;
+        AppendU32(payload, lastStreamId_);
+        AppendU32(payload, code);
+        QueueFrame_(GOAWAY, 0, 0, payload.data(), payload.size());
+        goAway_ = true;
+    }
+    return false;
+}
+
+int Http2Conn::FillIov(struct iovec* iov, int maxCnt) {
+    if(queuedBytes_ == 0) { Schedule_(); }
+    int cnt = 0;
+    for(size_t i = 0; i < out_.size() && cnt < maxCnt; i++) {
+        const Segment& seg = out_[i];
+        const char* base = seg.ext ? seg.ext : seg.data.data();
+        size_t len = seg.ext ? seg.len : seg.data.size();
+        size_t skip = (i == 0) ? frontOffset_ : 0;
+        iov[cnt].iov_base = const_cast<char*>(base + skip);
+        iov[cnt].iov_len = len - skip;
+        cnt++;
+    }
+    return cnt;
+}
+
+void Http2Conn::Consume(size_t len) {
+    assert(len <= queuedBytes_);
+    queuedBytes_ -= len;
+    while(len > 0 && !out_.empty()) {
+        const Segment& seg = out_.front();
+        size_t segLen = seg.ext ? seg.len : seg.data.size();
+        size_t left = segLen - frontOffset_;
+        if(len < left) {
+            frontOffset_ += len;
+            return;
+        }
+        len -= left;
+        frontOffset_ = 0;
+        out_.pop_front();   // 文件段写完，释放对流(文件映射)的引用
+    }
+}
+
+/* ---------------- 接收 ---------------- */
+
+bool Http2Conn::Upgrade(const HttpRequest& request, const string& settings) {
+    string payload;
+    if(!Base64UrlDecode(settings, payload) || payload.size() % 6 != 0) {
+        return false;
+    }
+    QueueRaw_("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    SendSettings_();
+    // 101即为对HTTP2-Settings的确认，不再回SETTINGS ACK
+    OnSettings_(0, reinterpret_cast<const uint8_t*>(payload.data()), payload.size(), false);
+
+    StreamPtr stream = make_shared<Stream>();
+    stream->id = 1;
+    stream->recvWindow = STREAM_WINDOW;
+    stream->bodyRejected = false;
+    stream->requestDone = true;
+    stream->active = stream->reset = false;
+    stream->data = nullptr;
+    stream->remain = 0;
+    stream->sendWindow = peerInitialWindow_;
+    stream->bytes = 0;
+    stream->start = chrono::steady_clock::now();
+    // 不复制请求体(带请求体的请求不升级)，请求体的额度和临时文件仍归原请求
+    stream->request.Init(request.method(), request.path(), request.version(), request.Headers(), "");
+    lastStreamId_ = 1;
+    streams_[1] = stream;
+    BuildResponse_(stream);
+    return true;
+}
+
+bool Http2Conn::Process(Buffer& readBuff) {
+    if(!prefaceSeen_ && !goAway_) {
+        if(readBuff.ReadableBytes() < PREFACE_LEN) {
+            return queuedBytes_ > 0;
+        }
+        if(memcmp(readBuff.Peek(), PREFACE, PREFACE_LEN) != 0) {
+            ConnError_(PROTOCOL_ERROR);
+            readBuff.RetrieveAll();
+            return true;
+        }
+        readBuff.Retrieve(PREFACE_LEN);
+        prefaceSeen_ = true;
+        SendSettings_();
+    }
+    while(!goAway_ && readBuff.ReadableBytes() >= 9) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(readBuff.Peek());
+        size_t len = (p[0] << 16) | (p[1] << 8) | p[2];
+        if(len > MAX_FRAME_SIZE) {
+            ConnError_(FRAME_SIZE_ERROR);
+            break;
+        }
+        if(readBuff.ReadableBytes() < 9 + len) { break; }
+        uint8_t type = p[3];
+        uint8_t flags = p[4];
+        uint32_t streamId = ReadU32(p + 5) & 0x7fffffff;
+        bool ok = HandleFrame_(type, flags, streamId, p + 9, len);
+        readBuff.Retrieve(9 + len);
+        if(!ok) { break; }
+    }
+    if(goAway_) { readBuff.RetrieveAll(); }
+    Schedule_();
+    return queuedBytes_ > 0 || IsVerifyPending();
+}
+
+bool Http2Conn::HandleFrame_(uint8_t type, uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t len) {
+    // 头部块没有结束时只能收到同一个流的CONTINUATION
+    if(headerStream_ && (type != CONTINUATION || streamId != headerStream_)) {
+        return ConnError_(PROTOCOL_ERROR);
+    }
+    switch(type) {
+    case DATA:
+        return OnData_(flags, streamId, payload, len);
+    case HEADERS:
+        return OnHeaders_(flags, streamId, payload, len);
+    case CONTINUATION:
+        if(!headerStream_) { return ConnError_(PROTOCOL_ERROR); }
+        headerBlock_.append(reinterpret_cast<const char*>(payload), len);
+        if(headerBlock_.size() > MAX_HEADER_BLOCK) { return ConnError_(ENHANCE_YOUR_CALM); }
+        if(flags & FLAG_END_HEADERS) { return OnHeaderBlock_(); }
+        return true;
+    case PRIORITY:
+        if(streamId == 0) { return ConnError_(PROTOCOL_ERROR); }
+        if(len != 5) { ResetStream_(streamId, FRAME_SIZE_ERROR); }
+        return true;    // 不按优先级调度，各流轮流发送
+    case RST_STREAM:
+        if(streamId == 0 || streamId > lastStreamId_) { return ConnError_(PROTOCOL_ERROR); }
+        if(len != 4) { return ConnError_(FRAME_SIZE_ERROR); }
+        {
+            auto it = streams_.find(streamId);
+            if(it != streams_.end()) {
+                it->second->reset = true;
+                streams_.erase(it);
+            }
+        }
+        return true;
+    case SETTINGS:
+        if(streamId != 0) { return ConnError_(PROTOCOL_ERROR); }
+        return OnSettings_(flags, payload, len, true);
+    case PUSH_PROMISE:
+        return ConnError_(PROTOCOL_ERROR);  // 客户端不能推送
+    case PING:
+        if(streamId != 0) { return ConnError_(PROTOCOL_ERROR); }
+        if(len != 8) { return ConnError_(FRAME_SIZE_ERROR); }
+        if(!(flags & FLAG_ACK)) {
+            QueueFrame_(PING, FLAG_ACK, 0, reinterpret_cast<const char*>(payload), len);
+        }
+        return true;
+    case GOAWAY:
+        if(streamId != 0) { return ConnError_(PROTOCOL_ERROR); }
+        peerGoAway_ = true;
+        return true;
+    case WINDOW_UPDATE:
+        return OnWindowUpdate_(streamId, payload, len);
+    default:
+        return true;    // 未知类型的帧忽略
+    }
+}
+
+// 去掉PADDED标志的填充，失败时返回false
+static bool StripPadding(uint8_t flags, const uint8_t*& payload, size_t& len) {
+    if(!(flags & FLAG_PADDED)) { return true; }
+    if(len < 1) { return false; }
+    size_t pad = payload[0];
+    if(pad >= len) { return false; }
+    payload += 1;
+    len -= 1 + pad;
+    return true;
+}
+
+bool Http2Conn::OnData_(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t len) {
+    if(streamId == 0) { return ConnError_(PROTOCOL_ERROR); }
+    size_t frameLen = len;
+    if(!StripPadding(flags, payload, len)) { return ConnError_(PROTOCOL_ERROR); }
+    // 连接级窗口按整帧(含填充)计算，收到即归还；流的接收窗口限制每个流未计入上限的数据
+    if(frameLen > 0) {
+        string inc;
+        AppendU32(inc, frameLen);
+        QueueFrame_(WINDOW_UPDATE, 0, 0, inc.data(), inc.size());
+    }
+    auto it = streams_.find(streamId);
+    if(it == streams_.end() || it->second->requestDone) {
+        if(streamId > lastStreamId_) { return ConnError_(PROTOCOL_ERROR); }
+        ResetStream_(streamId, STREAM_CLOSED);
+        return true;
+    }
+    StreamPtr stream = it->second;
+    stream->recvWindow -= frameLen;
+    if(stream->recvWindow < 0) {
+        ResetStream_(streamId, FLOW_CONTROL_ERROR);
+        return true;
+    }
+    if(stream->bodyRejected) {
+        // 已经回了错误页面，请求体丢弃，不再归还流的窗口
+        stream->requestDone = flags & FLAG_END_STREAM;
+        return true;
+    }
+    // 和HTTP/1.x的请求体共用单个请求和全局的上限(413/503)，超过bodyMemLimit时转存到临时文件
+    if(len > 0 && !stream->request.AppendBody(reinterpret_cast<const char*>(payload), len)) {
+        stream->bodyRejected = true;
+        stream->requestDone = flags & FLAG_END_STREAM;
+        OnRequest_(stream, stream->request.ErrorCode());
+        return true;
+    }
+    if(flags & FLAG_END_STREAM) {
+        stream->requestDone = true;
+        OnRequest_(stream);
+    } else if(frameLen > 0) {
+        stream->recvWindow += frameLen;
+        string inc;
+        AppendU32(inc, frameLen);
+        QueueFrame_(WINDOW_UPDATE, 0, streamId, inc.data(), inc.size());
+    }
+    return true;
+}
+
+bool Http2Conn::OnHeaders_(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t len) {
+    if(streamId == 0 || streamId % 2 == 0) { return ConnError_(PROTOCOL_ERROR); }
+    if(!StripPadding(flags, payload, len)) { return ConnError_(PROTOCOL_ERROR); }
+    if(flags & FLAG_PRIORITY) {
+        if(len < 5) { return ConnError_(FRAME_SIZE_ERROR); }
+        payload += 5;
+        len -= 5;
+    }
+    if(streamId <= lastStreamId_ && streams_.count(streamId) == 0) {
+        return ConnError_(STREAM_CLOSED);
+    }
+    headerStream_ = streamId;
+    headerFlags_ = flags;
+    headerBlock_.assign(reinterpret_cast<const char*>(payload), len);
+    if(flags & FLAG_END_HEADERS) { return OnHeaderBlock_(); }
+    return true;
+}
+
+bool Http2Conn::OnHeaderBlock_() {
+    uint32_t streamId = headerStream_;
+    headerStream_ = 0;
+    // 被拒绝的流也要解码，保持动态表与对端一致
+    HeaderList headers;
+    if(!decoder_.Decode(reinterpret_cast<const uint8_t*>(headerBlock_.data()), headerBlock_.size(), headers)) {
+        return ConnError_(COMPRESSION_ERROR);
+    }
+    headerBlock_.clear();
+    bool endStream = headerFlags_ & FLAG_END_STREAM;
+
+    auto it = streams_.find(streamId);
+    if(it != streams_.end()) {
+        // 已有的流：只能是请求体之后的trailer，必须结束流；内容忽略
+        StreamPtr stream = it->second;
+        if(stream->requestDone || !endStream) { return ConnError_(PROTOCOL_ERROR); }
+        stream->requestDone = true;
+        if(!stream->bodyRejected) { OnRequest_(stream); }
+        return true;
+    }
+
+    lastStreamId_ = streamId;
+    if(peerGoAway_ || streams_.size() >= MAX_STREAMS) {
+        ResetStream_(streamId, REFUSED_STREAM);
+        return true;
+    }
+    StreamPtr stream = make_shared<Stream>();
+    stream->id = streamId;
+    stream->headers = std::move(headers);
+    stream->recvWindow = STREAM_WINDOW;
+    stream->bodyRejected = false;
+    stream->requestDone = endStream;
+    stream->active = stream->reset = false;
+    stream->data = nullptr;
+    stream->remain = 0;
+    stream->sendWindow = peerInitialWindow_;
+    stream->bytes = 0;
+    stream->start = chrono::steady_clock::now();
+    streams_[streamId] = stream;
+    if(endStream) { OnRequest_(stream); }
+    return true;
+}
+
+bool Http2Conn::OnSettings_(uint8_t flags, const uint8_t* payload, size_t len, bool ack) {
+    if(flags & FLAG_ACK) {
+        if(len != 0) { return ConnError_(FRAME_SIZE_ERROR); }
+        return true;
+    }
+    if(len % 6 != 0) { return ConnError_(FRAME_SIZE_ERROR); }
+    for(size_t i = 0; i < len; i += 6) {
+        uint16_t id = (payload[i] << 8) | payload[i + 1];
+        uint32_t value = ReadU32(payload + i + 2);
+        switch(id) {
+        case 0x2:   // SETTINGS_ENABLE_PUSH
+            if(value > 1) { return ConnError_(PROTOCOL_ERROR); }
+            break;
+        case 0x4:   // SETTINGS_INITIAL_WINDOW_SIZE：按差值调整所有流的发送窗口
+            if(value > MAX_WINDOW) { return ConnError_(FLOW_CONTROL_ERROR); }
+            for(auto& item: streams_) {
+                item.second->sendWindow += static_cast<int64_t>(value) - peerInitialWindow_;
+                if(item.second->sendWindow > MAX_WINDOW) { return ConnError_(FLOW_CONTROL_ERROR); }
+            }
+            peerInitialWindow_ = value;
+            for(auto& item: streams_) {
+                StreamPtr& stream = item.second;
+                if((stream->remain > 0 || stream->producer) && !stream->active && stream->sendWindow > 0) {
+                    stream->active = true;
+                    active_.push_back(stream);
+                }
+            }
+            break;
+        case 0x5:   // SETTINGS_MAX_FRAME_SIZE
+            if(value < 16384 || value > 16777215) { return ConnError_(PROTOCOL_ERROR); }
+            peerMaxFrame_ = value;
+            break;
+        default:    // 编码器不使用动态表，HEADER_TABLE_SIZE等不影响本端
+            break;
+        }
+    }
+    if(ack) { QueueFrame_(SETTINGS, FLAG_ACK, 0, nullptr, 0); }
+    return true;
+}
+
+bool Http2Conn::OnWindowUpdate_(uint32_t streamId, const uint8_t* payload, size_t len) {
+    if(len != 4) { return ConnError_(FRAME_SIZE_ERROR); }
+    uint32_t inc = ReadU32(payload) & 0x7fffffff;
+    if(streamId == 0) {
+        if(inc == 0) { return ConnError_(PROTOCOL_ERROR); }
+        connSendWindow_ += inc;
+        if(connSendWindow_ > MAX_WINDOW) { return ConnError_(FLOW_CONTROL_ERROR); }
+        return true;
+    }
+    auto it = streams_.find(streamId);
+    if(it == streams_.end()) { return true; }   // 已结束的流
+    StreamPtr stream = it->second;
+    if(inc == 0) {
+        ResetStream_(streamId, PROTOCOL_ERROR);
+        return true;
+    }
+    stream->sendWindow += inc;
+    if(stream->sendWindow > MAX_WINDOW) {
+        ResetStream_(streamId, FLOW_CONTROL_ERROR);
+        return true;
+    }
+    if((stream->remain > 0 || stream->producer) && !stream->active) {
+        stream->active = true;
+        active_.push_back(stream);
+    }
+    return true;
+}
+
+/* ---------------- 请求与响应 ---------------- */
+
+void Http2Conn::OnRequest_(const StreamPtr& stream, int code) {
+    string method, path;
+    unordered_map<string, string> header;
+    for(auto& field: stream->headers) {
+        if(field.first == ":method") { method = field.second; }
+        else if(field.first == ":path") { path = field.second; }
+        else if(field.first == ":scheme") { continue; }
+        else { header[CanonicalName(field.first)] = field.second; }
+    }
+    stream->headers.clear();
+    if(method.empty() || path.empty() || path[0] != '/') {
+        ResetStream_(stream->id, PROTOCOL_ERROR);
+        return;
+    }
+    stream->request.Finish(method, path, "2.0", header);
+    if(code != 200) {
+        BuildResponse_(stream, code);
+        return;
+    }
+    if(!IpLimiter::Instance()->Request(ipSlot_)) {
+        BuildResponse_(stream, 429);    // 登录/注册请求也不再验证
+        return;
+    }
+    if(stream->request.IsVerifyPending()) {
+        verifyPending_.push_back(stream);
+        return;
+    }
+    BuildResponse_(stream);
+}
+
+void Http2Conn::Verify() {
+    while(!verifyPending_.empty()) {
+        StreamPtr stream = verifyPending_.front();
+        verifyPending_.pop_front();
+        stream->request.Verify();
+        if(!stream->reset) { BuildResponse_(stream); }
+    }
+}
+
+void Http2Conn::BuildResponse_(const StreamPtr& stream, int code) {
+    string contentType;
+    if(code == 200 && metricsHandler_ && *metricsHandler_ && stream->request.path() == "/metrics") {
+        stream->respBody = (*metricsHandler_)();
+        contentType = "text/plain; version=0.0.4";
+    } else if(code == 200 && streamHandlers_ && streamHandlers_->count(stream->request.path())) {
+        // 响应体大小事先未知：不带content-length，发送时按窗口逐段生成
+        const StreamHandler& handler = streamHandlers_->find(stream->request.path())->second;
+        if(stream->request.method() != "HEAD") {
+            stream->producer = handler.open(stream->request);
+        }
+        contentType = handler.contentType.empty() ? "text/plain" : handler.contentType;
+    } else {
+        stream->response.Init(srcDir_, stream->request.path(), false, code);
+        stream->response.MakeContent(stream->respBody);
+        contentType = stream->respBody.empty() ? stream->response.ContentType() : "text/html";
+        code = stream->response.Code();
+    }
+    if(!stream->respBody.empty()) {
+        stream->data = stream->respBody.data();
+        stream->remain = stream->respBody.size();
+    } else {
+        stream->data = stream->response.File();
+        stream->remain = stream->data ? stream->response.FileLen() : 0;
+    }
+
+    HeaderList headers;
+    headers.emplace_back(":status", to_string(code));
+    headers.emplace_back("content-type", contentType);
+    if(!stream->producer) {
+        headers.emplace_back("content-length", to_string(stream->remain));
+    }
+    if(code == 429) {
+        headers.emplace_back("retry-after", to_string(IpLimiter::RETRY_AFTER));
+    }
+    string block;
+    HpackEncoder::Encode(headers, block);
+    if(stream->request.method() == "HEAD") { stream->remain = 0; }
+
+    bool end = stream->remain == 0 && !stream->producer;
+    QueueFrame_(HEADERS, FLAG_END_HEADERS | (end ? FLAG_END_STREAM : 0), stream->id, block.data(), block.size());
+    stream->bytes = 9 + block.size();
+    if(end) {
+        FinishStream_(stream);
+    } else {
+        stream->active = true;
+        active_.push_back(stream);
+    }
+}
+
+void Http2Conn::Produce_(const StreamPtr& stream) {
+    stream->respBody.clear();
+    while(stream->producer && stream->respBody.empty()) {
+        if(!stream->producer(stream->respBody)) {
+            stream->producer = nullptr;
+        }
+    }
+    stream->data = stream->respBody.data();
+    stream->remain = stream->respBody.size();
+}
+
+// 按窗口把各流的响应体轮流切成DATA帧，帧负载直接指向文件映射；
+// 分段生成的响应体在上一段切完、流窗口还有余量时才取下一段，和HTTP/1.1的FillStream_一样不整个缓存
+void Http2Conn::Schedule_() {
+    while(queuedBytes_ < HIGH_WATER && connSendWindow_ > 0 && !active_.empty()) {
+        StreamPtr stream = active_.front();
+        active_.pop_front();
+        if(stream->reset) { continue; }
+        if(stream->remain == 0 && stream->producer && stream->sendWindow > 0) {
+            Produce_(stream);
+        }
+        size_t chunk = min<size_t>(stream->remain, peerMaxFrame_);
+        chunk = min<int64_t>(chunk, min(connSendWindow_, stream->sendWindow));
+        bool end = chunk == stream->remain && !stream->producer;
+        if(chunk == 0 && !end) {
+            stream->active = false;     // 流窗口耗尽，等WINDOW_UPDATE
+            continue;
+        }
+        QueueFrame_(DATA, end ? FLAG_END_STREAM : 0, stream->id, nullptr, chunk);
+        // 上面的帧头声明了chunk字节的负载，负载本身作为单独的一段；
+        // 生产者还会生成下一段时respBody会被覆盖，这时复制负载
+        Segment seg;
+        seg.ext = nullptr;
+        seg.len = 0;
+        if(stream->producer) {
+            seg.data.assign(stream->data, chunk);
+        } else {
+            seg.ext = stream->data;
+            seg.len = chunk;
+        }
+        seg.owner = stream;
+        if(chunk > 0) { out_.push_back(std::move(seg)); }
+        queuedBytes_ += chunk;
+
+        stream->data += chunk;
+        stream->remain -= chunk;
+        stream->sendWindow -= chunk;
+        connSendWindow_ -= chunk;
+        stream->bytes += 9 + chunk;
+        if(end) {
+            stream->active = false;
+            FinishStream_(stream);
+        } else {
+            active_.push_back(stream);
+        }
+    }
+}
+
+// 响应的最后一帧已进入发送队列：记录访问日志和指标，流结束
+void Http2Conn::FinishStream_(const StreamPtr& stream) {
+    Metrics::Instance()->Add(Metrics::REQUESTS);
+    AccessLog* log = AccessLog::Instance();
+    if(log->IsOpen() && log->Sample()) {
+        AccessLog::Record rec;
+        rec.addr = addr_.sin_addr;
+        rec.method = stream->request.method().c_str();
+        rec.path = stream->request.path().c_str();
+        rec.version = stream->request.version().c_str();
+        rec.referer = stream->request.GetHeader("Referer").c_str();
+        rec.userAgent = stream->request.GetHeader("User-Agent").c_str();
+        rec.status = stream->response.Code() > 0 ? stream->response.Code() : 200;
+        rec.bytes = stream->bytes;
+        rec.durationUs = chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - stream->start).count();
+        log->write(rec);
+    }
+    streams_.erase(stream->id);
+    if(!stream->requestDone) {
+        ResetStream_(stream->id, NO_ERROR);     // 提前响应了被拒绝的请求，让对端停止发送请求体
+    }
+}
@@ -0,0 +1,151 @@
+#ifndef HTTP2_CONN_H
+#define HTTP2_CONN_H
+
+#include <map>
+#include <unordered_map>
+#include <deque>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <sys/uio.h>     // iovec
+#include <arpa/inet.h>   // sockaddr_in
+
+#include "../buffer/buffer.h"
+#include "httprequest.h"
+#include "httpresponse.h"
+#include "hpack.h"
+#include "keepalive.h"
+
+// HTTP/2(h2c)协议层：由HttpConn在收到连接前言或Upgrade: h2c后创建，读写缓冲和socket仍归HttpConn
+// 一个连接上多个流并发，响应按流量控制窗口轮流切成DATA帧；文件内容直接引用mmap的内存，不拷贝
+class Http2Conn {
+public:
+    static const char PREFACE[];            // 客户端连接前言
+    static const size_t PREFACE_LEN = 24;
+
+    // streamHandlers：分段生成的响应，HTTP/2有自己的分帧，按发送窗口逐段生成、切成DATA帧发送
+    // ipSlot：IpLimiter中客户端IP的槽位，每个流取一个令牌，超过频率的流回429
+    Http2Conn(const char* srcDir, const sockaddr_in& addr,
+              const std::function<std::string()>* metricsHandler = nullptr,
+              const std::unordered_map<std::string, StreamHandler>* streamHandlers = nullptr,
+              int ipSlot = -1);
+    ~Http2Conn() = default;
+
+    // HTTP/1.1请求带Upgrade: h2c时调用：回101，请求作为流1处理；settings为HTTP2-Settings头的值
+    bool Upgrade(const HttpRequest& request, const std::string& settings);
+
+    // 处理readBuff中完整的帧，需要写出数据或等待验证时返回true
+    bool Process(Buffer& readBuff);
+
+    // 登录/注册请求需要验证，处理完一批帧后连接挂起，由验证线程调用Verify()
+    bool IsVerifyPending() const { return !verifyPending_.empty(); }
+    void Verify();
+
+    // 把待发送的数据填进iov(发送队列空时先调度DATA帧)，返回iov个数；写出len字节后调用Consume
+    int FillIov(struct iovec* iov, int maxCnt);
+    void Consume(size_t len);
+    size_t ToWriteBytes() const { return queuedBytes_; }
+
+    // 发出GOAWAY，或对端发来GOAWAY(或服务器正在平滑退出)且所有流都结束后，写完数据即关闭连接
+    bool IsKeepAlive() const {
+        return !goAway_ && !((peerGoAway_ || KeepAlivePolicy::Instance()->IsDraining()) && streams_.empty());
+    }
+
+    enum FRAME_TYPE {
+        DATA = 0x0, HEADERS = 0x1, PRIORITY = 0x2, RST_STREAM = 0x3, SETTINGS = 0x4,
+        PUSH_PROMISE = 0x5, PING = 0x6, GOAWAY = 0x7, WINDOW_UPDATE = 0x8, CONTINUATION = 0x9,
+    };
+
+    enum ERROR_CODE {
+        NO_ERROR = 0x0, PROTOCOL_ERROR = 0x1, INTERNAL_ERROR = 0x2, FLOW_CONTROL_ERROR = 0x3,
+        STREAM_CLOSED = 0x5, FRAME_SIZE_ERROR = 0x6, REFUSED_STREAM = 0x7, CANCEL = 0x8,
+        COMPRESSION_ERROR = 0x9, ENHANCE_YOUR_CALM = 0xb,
+    };
+
+    static const uint32_t MAX_FRAME_SIZE = 16384;       // 本端接收的最大帧(默认值)
+    static const uint32_t MAX_STREAMS = 100;            // 本端允许的并发流
+    static const size_t MAX_HEADER_BLOCK = 64 * 1024;   // 单个头部块的上限
+    static const uint32_t MAX_HEADER_LIST = 64 * 1024;  // 解码后头部列表的上限(SETTINGS_MAX_HEADER_LIST_SIZE)
+    static const uint32_t STREAM_WINDOW = 64 * 1024;    // 每个流的接收窗口(SETTINGS_INITIAL_WINDOW_SIZE)
+    static const size_t HIGH_WATER = 256 * 1024;        // 发送队列超过它时暂停切分DATA帧
+
+private:
+    struct Stream {
+        uint32_t id;
+        HeaderList headers;     // 解出的请求头
+        int64_t recvWindow;     // 流的接收窗口，请求体计入request之后才归还
+        bool bodyRejected;      // 请求体超过上限，已经提前回413/503，之后的DATA帧丢弃
+        bool requestDone;       // 请求已经收完(END_STREAM)
+        bool active;            // 在待发送队列active_中
+        bool reset;             // 已被RST_STREAM取消
+        HttpRequest request;
+        HttpResponse response;  // 持有文件映射，DATA帧写完之前不能释放
+        std::string respBody;   // 程序生成的响应体(错误页、/metrics)，或生产者最近生成的一段
+        BodyProducer producer;  // 非空时响应体还没有生成完，由Schedule_按窗口逐段取
+        const char* data;       // 剩余待发送的响应体
+        size_t remain;
+        int64_t sendWindow;     // 流的发送窗口
+        size_t bytes;           // 响应的总字节数(头+体)
+        std::chrono::steady_clock::time_point start;
+    };
+    typedef std::shared_ptr<Stream> StreamPtr;
+
+    // 发送队列的一段：帧头等小块数据放在data中，文件内容只保存指针，owner保证写完前映射不被释放
+    struct Segment {
+        std::string data;
+        const char* ext;
+        size_t len;
+        StreamPtr owner;
+    };
+
+    bool HandleFrame_(uint8_t type, uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t len);
+    bool OnData_(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t len);
+    bool OnHeaders_(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t len);
+    bool OnHeaderBlock_();
+    bool OnSettings_(uint8_t flags, const uint8_t* payload, size_t len, bool ack);
+    bool OnWindowUpdate_(uint32_t streamId, const uint8_t* payload, size_t len);
+    void OnRequest_(const StreamPtr& stream, int code = 200);  // code不是200时请求体被拒绝，只回错误页面
+    void BuildResponse_(const StreamPtr& stream, int code = 200);  // code不是200时只回错误页面
+    void FinishStream_(const StreamPtr& stream);
+    void Produce_(const StreamPtr& stream);     // 从生产者取下一段放进respBody
+    void Schedule_();
+
+    void SendSettings_();
+    void QueueFrame_(uint8_t type, uint8_t flags, uint32_t streamId, const char* payload, size_t len);
+    void QueueRaw_(const std::string& data);
+    void ResetStream_(uint32_t streamId, ERROR_CODE code);
+    bool ConnError_(ERROR_CODE code);   // 发GOAWAY，返回false
+
+    const char* srcDir_;
+    sockaddr_in addr_;
+    const std::function<std::string()>* metricsHandler_;
+    const std::unordered_map<std::string, StreamHandler>* streamHandlers_;
+    int ipSlot_;
+
+    bool prefaceSeen_;      // 已收到客户端连接前言
+    bool settingsSent_;
+    bool goAway_;           // 本端已发GOAWAY
+    bool peerGoAway_;       // 对端已发GOAWAY
+    uint32_t lastStreamId_; // 对端打开过的最大流ID
+
+    // 跨CONTINUATION帧累积的头部块
+    uint32_t headerStream_; // 0表示不在头部块中
+    uint8_t headerFlags_;
+    std::string headerBlock_;
+
+    HpackDecoder decoder_;
+    uint32_t peerMaxFrame_;         // 对端SETTINGS_MAX_FRAME_SIZE
+    int64_t peerInitialWindow_;     // 对端SETTINGS_INITIAL_WINDOW_SIZE
+    int64_t connSendWindow_;        // 连接的发送窗口
+
+    std::map<uint32_t, StreamPtr> streams_;    // 未结束的流
+    std::deque<StreamPtr> active_;  // 有数据待发送且窗口未耗尽的流，轮流发送
+    std::deque<StreamPtr> verifyPending_;
+
+    std::deque<Segment> out_;       // 发送队列
+    size_t frontOffset_;            // 队首一段已写出的字节数
+    size_t queuedBytes_;
+};
+
+#endif //HTTP2_CONN_H
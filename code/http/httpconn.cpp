@@ -3,6 +3,12 @@ using namespace std;
 
 const char* HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
+std::function<std::string()> HttpConn::metricsHandler;
+TlsContext* HttpConn::tlsCtx = nullptr;
+std::unordered_map<std::string, StreamHandler> HttpConn::streamHandlers;
+std::unordered_map<std::string, WsHandler> HttpConn::wsHandlers;
+std::unordered_map<std::string, std::shared_ptr<EventStream>> HttpConn::sseStreams;
+PushConn::ArmFunc HttpConn::pushArm;
 
 bool HttpConn::isET = true;
 
@@ -10,31 +16,68 @@ HttpConn::HttpConn() {
     fd_ = -1;
     addr_ = { 0 };
     isClose_ = true;
+    respBytes_ = 0;
+    writing_ = false;
+    chunked_ = false;
+    requests_ = 0;
+    ipSlot_ = -1;
+    phase_ = 0;
+    verifying_ = 0;
 };
 
 HttpConn::~HttpConn() { 
     Close(); 
 };
 
-void HttpConn::init(int fd, const sockaddr_in& addr) {
+void HttpConn::init(int fd, const sockaddr_in& addr, int ipSlot) {
     assert(fd > 0);
     userCount++;
     addr_ = addr;
     fd_ = fd;
+    ipSlot_ = ipSlot;
     // 初始化写缓冲和读缓冲
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
     isClose_ = false;
-    LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+    respBytes_ = 0;
+    writing_ = false;
+    request_.Init();
+    producer_ = nullptr;
+    requests_ = 0;
+    verifying_.fetch_and(~1u);
+    h2_.reset();
+    push_.reset();
+    tls_.reset(tlsCtx ? new TlsConn(tlsCtx, fd) : nullptr);
+    SetPhase_(WAIT_HEADER);     // 第一个请求(和TLS握手)也要在请求头期限内到达
+    phases_ = RequestPhases();
+    if(SlowLog::Instance()->IsOpen()) {
+        phases_.accept = std::chrono::steady_clock::now();
+    }
+    LOG_DEBUG("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
 void HttpConn::Close() {
     response_.UnmapFile();  // 解除内存映射
     if(isClose_ == false){
         isClose_ = true; 
+        producer_ = nullptr;
+        request_.Init();    // 释放请求体占用的额度和临时文件
+        h2_.reset();
+        if(push_) {
+            // 在close(fd_)之前，之后发布者不会再注册这个fd的事件；对象留到下一次init释放，主线程可能正在读
+            push_->Shutdown();
+        }
+        if(tls_) {
+            tls_->Shutdown();
+            tls_.reset();
+        }
+        IpLimiter::Instance()->Release(ipSlot_);
+        ipSlot_ = -1;
+        // 不再是IDLE/PUSH，平滑退出时主线程不会对复用了这个fd号的其他socket操作
+        phase_.store(0, std::memory_order_release);
         userCount--;
         close(fd_);
-        LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+        LOG_DEBUG("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
     }
 }
 
@@ -57,24 +100,57 @@ int HttpConn::GetPort() const {
 ssize_t HttpConn::read(int* saveErrno) {
     // 一次性读出所有数据(ET+非阻塞)
     ssize_t len = -1;
-    do {
-        len = readBuff_.ReadFd(fd_, saveErrno);
-        if (len <= 0) {
-            break;
+    bool newRequest = readBuff_.ReadableBytes() == 0 && !request_.InProgress();
+    if(newRequest) {
+        reqStart_ = std::chrono::steady_clock::now();  // 新请求的开始
+    }
+    if(!tls_ && readBuff_.ReadableBytes() == 0 && request_.CanSpliceBody()) {
+        // 大请求体的剩余部分从socket经管道直接移入临时文件，不经过readBuff_
+        len = request_.SpliceBody(fd_, saveErrno);
+        if(request_.CanSpliceBody()) {
+            return len;
         }
-    } while (isET);
+        // 请求体已经收完，socket中可能还有流水线中的下一个请求，接着按普通方式读
+    }
+    if(tls_) {
+        len = tls_->Read(readBuff_, saveErrno, READ_BUDGET);
+    } else {
+        do {
+            len = readBuff_.ReadFd(fd_, saveErrno);
+            if (len <= 0) {
+                break;
+            }
+        } while (isET && readBuff_.ReadableBytes() < READ_BUDGET);
+    }
+    if(newRequest && readBuff_.ReadableBytes() > 0 && SlowLog::Instance()->IsOpen()) {
+        phases_.queued = readQueued_;
+        phases_.dequeued = reqStart_;
+        phases_.firstRead = std::chrono::steady_clock::now();
+    }
     return len;
 }
 
 ssize_t HttpConn::write(int* saveErrno) {
+    if(push_) { return WriteFrames_(push_.get(), saveErrno); }
+    SetPhase_(BUSY);
+    if(h2_) { return WriteFrames_(h2_.get(), saveErrno); }
     ssize_t len = -1;
+    Metrics* metrics = Metrics::Instance();
+    SlowLog* slowLog = SlowLog::Instance();
     do {
         // 分散写数据
-        len = writev(fd_, iov_, iovCnt_);
+        len = Writev_(iov_, iovCnt_);
         if(len <= 0) {
             *saveErrno = errno;
             break;
         }
+        metrics->Add(Metrics::BYTES_SENT, len);
+        if(!writing_ && (metrics->IsOpen() || slowLog->IsOpen())) {
+            writing_ = true;
+            writeStart_ = std::chrono::steady_clock::now();
+            metrics->Observe(Metrics::TTFB, std::chrono::duration_cast<std::chrono::microseconds>(
+                    writeStart_ - reqStart_).count());
+        }
         // 这种情况是所有数据都传输结束了
         if(iov_[0].iov_len + iov_[1].iov_len  == 0) { break; } /* 传输结束 */
         // 写到了第二块内存，做相应的处理
@@ -92,32 +168,140 @@ ssize_t HttpConn::write(int* saveErrno) {
             iov_[0].iov_len -= len; 
             writeBuff_.Retrieve(len);
         }
+        if(producer_ && writeBuff_.ReadableBytes() < STREAM_BUFFER) {
+            FillStream_();
+        }
     } while(isET || ToWriteBytes() > 10240);
+    if(writing_ && ToWriteBytes() == 0) {
+        writing_ = false;
+        metrics->Observe(Metrics::WRITE, Metrics::SinceUs(writeStart_));
+        metrics->Add(Metrics::REQUESTS);
+        if(slowLog->IsOpen()) { LogSlow_(); }
+    }
     return len;
 }
 
 // 业务逻辑处理
 bool HttpConn::process() {
-    // 初始化请求对象
-    request_.Init();
+    if(h2_) {
+        SetPhase_(BUSY);    // HTTP/2连接按最后一次读写计算超时
+        return h2_->Process(readBuff_);
+    }
+    if(push_) {
+        push_->Process(readBuff_);
+        return true;
+    }
+    if(readBuff_.ReadableBytes() > 0) {
+        // 收到了新请求的数据，不再可以直接拒绝；请求头的期限仍从阶段开始算起
+        phase_.fetch_and(~SHEDDABLE, std::memory_order_release);
+    }
+    // 以HTTP/2连接前言开头(h2c prior knowledge，或TLS上ALPN协商了h2)，收齐前言前不按HTTP/1.x解析
+    size_t prefix = std::min(readBuff_.ReadableBytes(), Http2Conn::PREFACE_LEN);
+    if(!request_.InProgress() && prefix > 0 && memcmp(readBuff_.Peek(), Http2Conn::PREFACE, prefix) == 0) {
+        if(prefix < Http2Conn::PREFACE_LEN) { return false; }
+        SetPhase_(BUSY);
+        h2_.reset(new Http2Conn(srcDir, addr_, &metricsHandler, &streamHandlers, ipSlot_));
+        return h2_->Process(readBuff_);
+    }
+
+    // 上一个请求已经响应，初始化请求对象；否则接着解析没有收完的请求
+    if(request_.IsFinished()) {
+        request_.Init();
+    }
     
-    if(readBuff_.ReadableBytes() <= 0) {// 没有请求数据
+    int64_t since;
+    if(readBuff_.ReadableBytes() <= 0 && !request_.InProgress()) {// 没有请求数据
+        if(Phase(&since) == BUSY) {
+            SetPhase_(IDLE);    // 上一个响应写完，开始计算空闲时间
+        }
         return false;
     }
-    else if(request_.parse(readBuff_)) {    // 解析请求数据
+    // 新请求的第一部分数据到达时取令牌，超过频率时不解析，直接回429并关闭连接
+    if(!request_.InProgress() && !IpLimiter::Instance()->Request(ipSlot_)) {
+        SetPhase_(BUSY);
+        MakeResponse_(false, 429);
+        return true;
+    }
+
+    Metrics* metrics = Metrics::Instance();
+    bool tracing = SlowLog::Instance()->IsOpen();
+    std::chrono::steady_clock::time_point parseStart;
+    if(metrics->IsOpen() || tracing) { parseStart = std::chrono::steady_clock::now(); }
+    if(tracing && phases_.firstRead == RequestPhases::TimePoint()) {
+        // 流水线中的后续请求已经在缓冲区里，没有经过读任务
+        phases_.queued = phases_.dequeued = phases_.firstRead = parseStart;
+    }
+    bool parsed = request_.parse(readBuff_);    // 解析请求数据
+    if(metrics->IsOpen()) { metrics->Observe(Metrics::PARSE, Metrics::SinceUs(parseStart)); }
+    if(tracing) { phases_.parsed = std::chrono::steady_clock::now(); }
+    if(!parsed || !request_.InHeader()) {
+        SetPhase_(BUSY);
+    } else if(Phase(&since) != WAIT_HEADER) {
+        SetPhase_(WAIT_HEADER);     // 请求头的期限从收到第一部分算起，之后再收到数据也不延长
+    }
+    if(parsed && !request_.IsFinished()) {
+        if(request_.TakeExpectContinue()) { SendContinue_(); }
+        return false;   // 请求还没有收完，继续读
+    }
+    TRACE_PROBE3(parse_done, fd_, parsed ? 1 : 0, request_.path().c_str());
+
+    if(parsed) {
         LOG_DEBUG("%s", request_.path().c_str());
+        if(request_.IsVerifyPending()) {
+            return true;    // 等待数据库验证后再生成响应
+        }
+        if(TryWebSocket_() || TrySse_() || TryHttp2_()) {
+            return true;
+        }
+        if(metricsHandler && request_.path() == "/metrics") {
+            std::string body = metricsHandler();
+            MakeResponse_(request_.IsKeepAlive(), 200, &body);
+            return true;
+        }
+        auto stream = streamHandlers.find(request_.path());
+        if(stream != streamHandlers.end()) {
+            StartStream_(stream->second);
+            return true;
+        }
         // 解析完请求数据以后，初始化响应对象
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+        MakeResponse_(request_.IsKeepAlive(), 200);
     } else {
         // 解析失败
-        response_.Init(srcDir, request_.path(), false, 400);  // 请求报文中有语法错误
+        MakeResponse_(false, request_.ErrorCode());  // 请求报文中有语法错误(400)或请求体超过上限(413/503)
     }
+    return true;
+}
+
+// 在数据库线程中执行：验证用户，然后生成响应；验证可能很慢，写响应的期限从验证完成算起
+void HttpConn::Verify() {
+    if(h2_) {
+        h2_->Verify();
+        SetPhase_(BUSY);
+        return;
+    }
+    if(SlowLog::Instance()->IsOpen()) {
+        phases_.verifyStart = std::chrono::steady_clock::now();
+    }
+    request_.Verify();
+    TRACE_PROBE1(verify_done, fd_);
+    MakeResponse_(request_.IsKeepAlive(), 200);
+    SetPhase_(BUSY);
+}
+
+void HttpConn::MakeResponse_(bool isKeepAlive, int code, const std::string* body) {
+    int left = KeepAliveLeft_();
+    response_.Init(srcDir, request_.path(), isKeepAlive && left != 0, code, left);
 
     // 生成响应信息（writeBuff_中保存着响应的一些信息）
-    response_.MakeResponse(writeBuff_);
+    if(body) {
+        response_.MakeResponse(writeBuff_, *body);
+    } else {
+        response_.MakeResponse(writeBuff_);
+    }
     /* 响应头 */
     iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
     iov_[0].iov_len = writeBuff_.ReadableBytes();
+    iov_[1].iov_len = 0;
     iovCnt_ = 1;
 
     /* 文件 */
@@ -126,6 +310,205 @@ bool HttpConn::process() {
         iov_[1].iov_len = response_.FileLen();
         iovCnt_ = 2;
     }
+    respBytes_ = ToWriteBytes();
+    if(SlowLog::Instance()->IsOpen()) {
+        phases_.built = std::chrono::steady_clock::now();
+    }
+    TRACE_PROBE3(response_built, fd_, response_.Code(), respBytes_);
     LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
+}
+
+int HttpConn::KeepAliveLeft_() {
+    KeepAlivePolicy* policy = KeepAlivePolicy::Instance();
+    int left = policy->RequestsLeft(++requests_);
+    if(left == 0 && request_.IsKeepAlive() && !policy->IsDraining()) {
+        Metrics::Instance()->Add(Metrics::KEEPALIVE_LIMIT);
+    }
+    return left;
+}
+
+// 响应体由生产者分段生成：先写出头部和第一批数据，之后每次写缓冲区不足时再生成
+void HttpConn::StartStream_(const StreamHandler& handler) {
+    chunked_ = request_.version() == "1.1";     // HTTP/1.0不支持chunked，写完后关闭连接
+    int left = KeepAliveLeft_();
+    response_.Init(srcDir, request_.path(), request_.IsKeepAlive() && chunked_ && left != 0, 200, left);
+    response_.MakeStreamResponse(writeBuff_, chunked_, handler.contentType);
+    producer_ = handler.open(request_);
+    if(!producer_ && chunked_) {
+        HttpResponse::AppendLastChunk(writeBuff_);  // 没有响应体
+    }
+    iov_[0].iov_len = 0;
+    iov_[1].iov_len = 0;
+    iovCnt_ = 1;
+    respBytes_ = 0;
+    FillStream_();
+    if(SlowLog::Instance()->IsOpen()) {
+        phases_.built = std::chrono::steady_clock::now();
+    }
+    TRACE_PROBE3(response_built, fd_, response_.Code(), respBytes_);
+}
+
+void HttpConn::FillStream_() {
+    std::string chunk;
+    while(producer_ && writeBuff_.ReadableBytes() < STREAM_BUFFER) {
+        chunk.clear();
+        bool more = producer_(chunk);
+        if(!chunk.empty()) {
+            if(chunked_) {
+                HttpResponse::AppendChunk(writeBuff_, chunk.data(), chunk.size());
+            } else {
+                writeBuff_.Append(chunk);
+            }
+        }
+        if(!more) {
+            if(chunked_) { HttpResponse::AppendLastChunk(writeBuff_); }
+            producer_ = nullptr;
+        }
+    }
+    // 追加可能使缓冲区重新分配，iov重新指向未写出的数据
+    respBytes_ += writeBuff_.ReadableBytes() - iov_[0].iov_len;
+    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
+    iov_[0].iov_len = writeBuff_.ReadableBytes();
+}
+
+void HttpConn::LogAccess() {
+    if(h2_ || push_) { return; }   // HTTP/2每个流结束时各自记录，WebSocket/SSE是长连接
+    AccessLog* log = AccessLog::Instance();
+    if(!log->IsOpen() || !log->Sample()) {
+        return;
+    }
+    AccessLog::Record rec;
+    rec.addr = addr_.sin_addr;
+    rec.method = request_.method().c_str();
+    rec.path = request_.path().c_str();
+    rec.version = request_.version().c_str();
+    rec.referer = request_.GetHeader("Referer").c_str();
+    rec.userAgent = request_.GetHeader("User-Agent").c_str();
+    rec.status = response_.Code();
+    rec.bytes = respBytes_;
+    rec.durationUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - reqStart_).count();
+    log->write(rec);
+}
+
+void HttpConn::MarkReadQueued() {
+    if(SlowLog::Instance()->IsOpen()) {
+        readQueued_ = std::chrono::steady_clock::now();
+    }
+}
+
+void HttpConn::LogSlow_() {
+    SlowLog* slowLog = SlowLog::Instance();
+    phases_.firstWrite = writeStart_;
+    phases_.lastWrite = std::chrono::steady_clock::now();
+    if(phases_.queued != RequestPhases::TimePoint() &&
+       std::chrono::duration_cast<std::chrono::microseconds>(
+            phases_.lastWrite - phases_.queued).count() >= slowLog->ThresholdUs()) {
+        SlowLog::Record rec;
+        rec.addr = addr_.sin_addr;
+        rec.port = ntohs(addr_.sin_port);
+        rec.fd = fd_;
+        rec.method = request_.method().c_str();
+        rec.path = request_.path().c_str();
+        rec.status = response_.Code();
+        rec.bytes = respBytes_;
+        rec.phases = &phases_;
+        slowLog->write(rec);
+    }
+    // 下一个请求重新记录，连接建立的时间保留
+    RequestPhases::TimePoint accept = phases_.accept;
+    phases_ = RequestPhases();
+    phases_.accept = accept;
+}
+
+// 明文连接上HTTP/1.1请求带Upgrade: h2c和HTTP2-Settings(不带请求体)时切换到HTTP/2，该请求作为流1响应
+bool HttpConn::TryHttp2_() {
+    const std::string& upgrade = request_.GetHeader("Upgrade");
+    const std::string& settings = request_.GetHeader("HTTP2-Settings");
+    if(tls_ || upgrade.find("h2c") == std::string::npos || settings.empty() ||
+       request_.method() == "POST" || request_.BodyLength() > 0) {
+        return false;
+    }
+    std::unique_ptr<Http2Conn> h2(new Http2Conn(srcDir, addr_, &metricsHandler, &streamHandlers, ipSlot_));
+    if(!h2->Upgrade(request_, settings)) {
+        return false;
+    }
+    h2_ = std::move(h2);
+    // 客户端收到101后才发送连接前言，缓冲区里剩下的数据交给HTTP/2处理
+    h2_->Process(readBuff_);
     return true;
 }
+
+bool HttpConn::TryWebSocket_() {
+    if(!WebSocketConn::IsUpgrade(request_)) {
+        return false;
+    }
+    auto handler = wsHandlers.find(request_.path());
+    if(handler == wsHandlers.end()) {
+        return false;   // 没有注册的路径按普通请求处理
+    }
+    if(!WebSocketConn::IsValidHandshake(request_)) {
+        MakeResponse_(false, 400);
+        return true;
+    }
+    WsConnPtr ws = std::make_shared<WebSocketConn>(fd_, addr_, &handler->second, &pushArm);
+    push_ = ws;
+    SetPhase_(PUSH);
+    ws->Open(request_);
+    ws->Process(readBuff_);     // 101之后紧跟着到达的帧
+    return true;
+}
+
+// SSE：响应头之后每个事件是一个chunked块(HTTP/1.0连接直接发送事件，以关闭连接结束)
+bool HttpConn::TrySse_() {
+    auto stream = sseStreams.find(request_.path());
+    if(stream == sseStreams.end() || request_.method() != "GET") {
+        return false;
+    }
+    bool chunked = request_.version() == "1.1";
+    response_.Init(srcDir, request_.path(), chunked, 200);
+    response_.MakeEventStreamResponse(writeBuff_, chunked);
+    std::shared_ptr<SseConn> sse = std::make_shared<SseConn>(fd_, chunked, stream->second, &pushArm);
+    push_ = sse;
+    SetPhase_(PUSH);
+    sse->Open(writeBuff_.RetrieveAllToStr(), request_.GetHeader("Last-Event-ID"));
+    return true;
+}
+
+// HTTP/2和WebSocket：发送队列可能有上百段(帧头和文件片段交替、排队的广播消息)，
+// 每次writev最多64段，一直写到写完或EAGAIN
+template<typename FrameConn>
+ssize_t HttpConn::WriteFrames_(FrameConn* conn, int* saveErrno) {
+    static const int IOV_MAX_CNT = 64;
+    struct iovec iov[IOV_MAX_CNT];
+    ssize_t len = 0;
+    while(true) {
+        int cnt = conn->FillIov(iov, IOV_MAX_CNT);
+        if(cnt == 0) { break; }
+        len = Writev_(iov, cnt);
+        if(len <= 0) {
+            *saveErrno = errno;
+            break;
+        }
+        Metrics::Instance()->Add(Metrics::BYTES_SENT, len);
+        conn->Consume(len);
+    }
+    return len;
+}
+
+ssize_t HttpConn::Writev_(const struct iovec* iov, int iovCnt) {
+    if(tls_ && !tls_->KtlsSend()) {
+        return tls_->Writev(iov, iovCnt);
+    }
+    // 内核TLS：写入的明文由内核加密成应用数据记录，mmap的文件内容不经过用户态加密拷贝
+    return writev(fd_, iov, iovCnt);
+}
+
+// 客户端等待100 Continue再发送请求体；只有25字节，发送缓冲区里一定放得下
+// OpenSSL加密发送时写不完必须用同样的数据重试，不值得为它处理，客户端等待超时后也会直接发送
+void HttpConn::SendContinue_() {
+    static const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    if(tls_ && !tls_->KtlsSend()) { return; }
+    struct iovec iov = { const_cast<char*>(CONTINUE), sizeof(CONTINUE) - 1 };
+    Writev_(&iov, 1);
+}
@@ -6,12 +6,25 @@
 #include <arpa/inet.h>   // sockaddr_in
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
+#include <string.h>      // memcmp
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
 
 #include "../log/log.h"
-#include "../pool/sqlconnRAII.h"
+#include "../log/accesslog.h"
+#include "../log/slowlog.h"
 #include "../buffer/buffer.h"
+#include "../metrics/metrics.h"
+#include "../trace/usdt.h"
+#include "../tls/tlsconn.h"
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "http2conn.h"
+#include "websocket.h"
+#include "sse.h"
+#include "keepalive.h"
 
 // Http连接类，其中封装了请求和响应对象
 class HttpConn {
@@ -20,7 +33,8 @@ public:
 
     ~HttpConn();
 
-    void init(int sockFd, const sockaddr_in& addr);
+    // ipSlot：IpLimiter中客户端IP的槽位(-1为不限制)，连接关闭时释放
+    void init(int sockFd, const sockaddr_in& addr, int ipSlot = -1);
 
     ssize_t read(int* saveErrno);
 
@@ -38,20 +52,109 @@ public:
     
     bool process();
 
+    // 登录/注册请求需要数据库验证，process()之后连接挂起，直到数据库线程调用Verify()
+    bool IsVerifyPending() const {
+        return h2_ ? h2_->IsVerifyPending() : request_.IsVerifyPending();
+    }
+    void Verify();
+    // 验证任务排队和执行期间IsVerifying()为true：连接不在epoll中，主线程的定时器到期时不能关闭它
+    // 每个验证任务有自己的编号：任务交还连接后，连接可能已经开始下一个验证，EndVerify只清除自己的标记
+    uint32_t BeginVerify() {
+        uint32_t token = ((verifying_.load(std::memory_order_relaxed) >> 1) + 1) << 1 | 1;
+        verifying_.store(token, std::memory_order_release);
+        return token;
+    }
+    void EndVerify(uint32_t token) {
+        verifying_.compare_exchange_strong(token, token & ~1u, std::memory_order_acq_rel);
+    }
+    bool IsVerifying() const { return verifying_.load(std::memory_order_acquire) & 1; }
+
+    // TLS连接在握手完成前只做握手，由I/O线程在读写事件中推进
+    bool IsHandshakeDone() const { return !tls_ || tls_->IsEstablished(); }
+    TlsConn::HANDSHAKE Handshake() { return tls_->Handshake(); }
+
+    void LogAccess();   // 响应写完后记录一条访问日志
+
+    void MarkReadQueued();  // 读任务投递到线程池(主线程)，开启慢请求日志时记录时间
+
     int ToWriteBytes() { 
+        if(h2_) { return h2_->ToWriteBytes(); }
+        if(push_) { return push_->ToWriteBytes(); }
         return iov_[0].iov_len + iov_[1].iov_len; 
     }
 
+    // 当前响应写完后是否保持连接：请求要求保持且没有达到每个连接的请求数上限
     bool IsKeepAlive() const {
-        return request_.IsKeepAlive();
+        return h2_ ? h2_->IsKeepAlive() : response_.IsKeepAlive();
+    }
+
+    // 连接所处的阶段，由工作线程更新；定时器到期时主线程按阶段和开始的时间计算期限
+    enum PHASE {
+        WAIT_HEADER = 0,    // 等待收齐请求头(新连接、请求头收到一部分)，期限从阶段开始算起
+        BUSY,               // 收请求体、生成和写出响应，每次读写都刷新开始时间
+        IDLE,               // 响应已写完，等待下一个请求
+        PUSH,               // 已升级为WebSocket/SSE，之后不再变化(主线程据此判断，见UpgradedPush)
+    };
+    // 过载时可以直接拒绝：明文HTTP/1.x连接，空闲或还没有收到请求的任何数据(没有处理到一半的请求和响应)
+    // 主线程调用，只看phase_中由工作线程写入的标记
+    bool CanShed() const {
+        return phase_.load(std::memory_order_acquire) & SHEDDABLE;
+    }
+    PHASE Phase(int64_t* sinceMs) const {
+        int64_t v = phase_.load(std::memory_order_acquire);
+        *sinceMs = v >> PHASE_BITS;
+        return static_cast<PHASE>(v & 3);
+    }
+
+    int StatusCode() const { return response_.Code(); }
+    size_t ResponseBytes() const { return respBytes_; }
+
+    // 非空时连接已升级为WebSocket或SSE，归属在工作线程和epoll之间显式交接(Claim/Park)；只由持有连接的线程调用
+    PushConn* Push() const { return push_.get(); }
+    // 主线程调用：阶段为PUSH时返回推送连接，否则nullptr
+    // push_在发布PUSH阶段之前赋值，之后直到下一次init(主线程)都不再改变(Close只关闭它)，所以不和工作线程争用
+    PushConn* UpgradedPush() const {
+        int64_t since;
+        return Phase(&since) == PUSH ? push_.get() : nullptr;
     }
 
     static bool isET;
     static const char* srcDir;  // 资源的目录
     static std::atomic<int> userCount; // 总共的客户单的连接数
+    static std::function<std::string()> metricsHandler;    // 非空时/metrics由它生成响应体，不读文件
+    static TlsContext* tlsCtx;  // 非空时所有连接都是TLS连接
+    // 路径 -> 分段生成的响应(大小事先未知)，HTTP/1.1以chunked编码边生成边发送，启动前注册
+    static std::unordered_map<std::string, StreamHandler> streamHandlers;
+    // 路径 -> WebSocket应用 / SSE事件流，启动前注册
+    static std::unordered_map<std::string, WsHandler> wsHandlers;
+    static std::unordered_map<std::string, std::shared_ptr<EventStream>> sseStreams;
+    static PushConn::ArmFunc pushArm;   // 由WebServer设置，其他线程发布消息时重新注册连接的事件
     
 private:
-   
+    void MakeResponse_(bool isKeepAlive, int code, const std::string* body = nullptr);
+    int KeepAliveLeft_();   // 计入当前请求，返回连接还能处理的请求数
+    void SetPhase_(PHASE phase) {
+        bool shed = !tls_ && !h2_ && !push_ && (phase == IDLE ||
+                (phase == WAIT_HEADER && !request_.InProgress() && readBuff_.ReadableBytes() == 0));
+        phase_.store(KeepAlivePolicy::NowMs() << PHASE_BITS | (shed ? SHEDDABLE : 0) | phase,
+                     std::memory_order_release);
+    }
+    void LogSlow_();    // 响应写完时检查总耗时，超过阈值写慢请求日志
+    bool TryHttp2_();   // 连接前言或Upgrade: h2c时切换到HTTP/2，之后由h2_处理
+    bool TryWebSocket_();   // Upgrade: websocket且路径注册了应用时升级，之后由push_处理
+    bool TrySse_();         // GET请求的路径注册了事件流时开始SSE响应，之后由push_处理
+    template<typename FrameConn>
+    ssize_t WriteFrames_(FrameConn* conn, int* saveErrno);  // HTTP/2、WebSocket和SSE的发送队列
+    ssize_t Writev_(const struct iovec* iov, int iovCnt);
+    void SendContinue_();
+    void StartStream_(const StreamHandler& handler);
+    void FillStream_();     // 从生产者取数据补充写缓冲区
+
+    static const size_t STREAM_BUFFER = 64 * 1024;  // 写缓冲区低于它时继续生成响应体
+    // 读缓冲区超过它时先交给解析，剩下的数据重新注册EPOLLIN后再读(EPOLL_CTL_MOD会重新检查可读)
+    // 请求体边收边移出读缓冲区，大的chunked请求体不会整个堆在readBuff_中
+    static const size_t READ_BUDGET = 1024 * 1024;   // 明文连接和内核TLS发送直接writev，否则由OpenSSL加密
+
     int fd_;
     struct  sockaddr_in addr_;
 
@@ -65,6 +168,26 @@ private:
 
     HttpRequest request_;   // 请求对象
     HttpResponse response_; // 响应对象
+
+    std::chrono::steady_clock::time_point reqStart_;    // 开始读取当前请求的时间
+    size_t respBytes_;      // 当前响应的总字节数
+    std::chrono::steady_clock::time_point writeStart_;  // 写出第一个字节的时间
+    bool writing_;          // 当前响应已开始写出、还没写完
+    std::chrono::steady_clock::time_point readQueued_;  // 最近一次读任务投递的时间
+    RequestPhases phases_;  // 当前请求各阶段的时间，只在开启慢请求日志时记录
+
+    std::unique_ptr<Http2Conn> h2_;     // 非空时连接已切换到HTTP/2
+    std::shared_ptr<PushConn> push_;    // 非空时是WebSocket或SSE连接(发布者可能还持有引用)
+    std::unique_ptr<TlsConn> tls_;      // 非空时是TLS连接
+
+    BodyProducer producer_; // 非空时响应体还没有生成完
+    bool chunked_;          // 分段生成的响应使用chunked编码
+
+    int requests_;          // 连接上已经响应的请求数
+    int ipSlot_;            // IpLimiter的槽位
+    enum { PHASE_BITS = 3, SHEDDABLE = 4 };     // 阶段占低2位，SHEDDABLE：过载时可以直接拒绝(CanShed)
+    std::atomic<int64_t> phase_;    // 阶段开始的毫秒时间戳 << PHASE_BITS | SHEDDABLE | 阶段
+    std::atomic<uint32_t> verifying_;   // 验证任务编号 << 1 | 正在验证
 };
 
 
@@ -1,6 +1,15 @@
 #include "httprequest.h"
+#include <strings.h>    // strcasecmp
+#include <stdint.h>
 using namespace std;
 
+AuthStore* HttpRequest::authStore = nullptr;
+size_t HttpRequest::bodyMemLimit = 64 * 1024;
+size_t HttpRequest::maxBodySize = 100 * 1024 * 1024;
+size_t HttpRequest::maxBodyTotal = 1024 * 1024 * 1024;
+std::string HttpRequest::bodyTmpDir = "/tmp";
+std::atomic<size_t> HttpRequest::bodyTotal_(0);
+
 const unordered_set<string> HttpRequest::DEFAULT_HTML{
             "/index", "/register", "/login",
              "/welcome", "/video", "/picture", };
@@ -12,10 +21,34 @@ const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
 void HttpRequest::Init() {
     method_ = path_ = version_ = body_ = "";
     state_ = REQUEST_LINE;  // 初始状态是请求首行
+    verifyPending_ = false;
+    isLogin_ = false;
+    bodyRemain_ = 0;
+    errorCode_ = 400;
+    expectContinue_ = false;
+    ReleaseBody_();
     header_.clear();
     post_.clear();
 }
 
+void HttpRequest::Init(const string& method, const string& path, const string& version,
+                       const unordered_map<string, string>& header, const string& body) {
+    Init();
+    body_ = body;
+    Finish(method, path, version, header);
+}
+
+void HttpRequest::Finish(const string& method, const string& path, const string& version,
+                         const unordered_map<string, string>& header) {
+    method_ = method;
+    path_ = path;
+    version_ = version;
+    header_ = header;
+    ParsePath_();
+    ParsePost_();   // 请求体在临时文件中时body_为空，不解析表单
+    state_ = FINISH;
+}
+
 bool HttpRequest::IsKeepAlive() const {
     if(header_.count("Connection") == 1) {
         return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
@@ -26,14 +59,36 @@ bool HttpRequest::IsKeepAlive() const {
 // 解析请求数据
 bool HttpRequest::parse(Buffer& buff) {
     const char CRLF[] = "\r\n"; // 行结束符(回车换行)
-    if(buff.ReadableBytes() <= 0) {
+    if(buff.ReadableBytes() <= 0 && !InProgress()) {
         return false;
     }
-    // buff中有数据可读，并且状态没有到FINISH，就一直解析
-    while(buff.ReadableBytes() && state_ != FINISH) {
-        // 获取一行数据，根据\r\n为结束标志
+    // 状态没有到FINISH，就一直解析，直到buff中的数据不够
+    while(state_ != FINISH) {
+        if(state_ == BODY || state_ == CHUNK_DATA) {
+            // 请求体不必等全部到达，收到的部分直接移出读缓冲区(超过bodyMemLimit时写入临时文件)
+            size_t len = min(buff.ReadableBytes(), bodyRemain_);
+            if(len > 0 && !AppendBody_(buff.Peek(), len)) {
+                return false;
+            }
+            buff.Retrieve(len);
+            bodyRemain_ -= len;
+            if(bodyRemain_ > 0) { break; }
+            if(state_ == BODY) { ParseBody_(); }
+            else { state_ = CHUNK_DATA_END; }
+            continue;
+        }
+        if(buff.ReadableBytes() == 0) { break; }
+        // 获取一行数据，根据\r\n为结束标志；行还没有收完时等待更多数据
         const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
+        if(lineEnd == buff.BeginWriteConst()) {
+            if(buff.ReadableBytes() > MAX_LINE) {
+                LOG_ERROR("Line too long");
+                return false;
+            }
+            break;
+        }
         std::string line(buff.Peek(), lineEnd);
+        buff.RetrieveUntil(lineEnd + 2);
         switch(state_)
         {
         case REQUEST_LINE:
@@ -45,21 +100,30 @@ bool HttpRequest::parse(Buffer& buff) {
             ParsePath_();
             break;    
         case HEADERS:
-            // 解析请求头
-            ParseHeader_(line);
-            if(buff.ReadableBytes() <= 2) {  // 此时已读到buff末尾
-                state_ = FINISH;
+            // 解析请求头，空行之后确定请求体的格式
+            if(!ParseHeader_(line)) {
+                return false;
+            }
+            break;
+        case CHUNK_SIZE:
+            if(!ParseChunkSize_(line)) {
+                return false;
+            }
+            break;
+        case CHUNK_DATA_END:
+            if(!line.empty()) {
+                LOG_ERROR("Chunk data too long");
+                return false;
             }
+            state_ = CHUNK_SIZE;
             break;
-        case BODY:
-            // 解析请求体
-            ParseBody_(line);
+        case CHUNK_TRAILER:
+            // trailer字段不使用，空行表示请求结束
+            if(line.empty()) { ParseBody_(); }
             break;
         default:
             break;
         }
-        if(lineEnd == buff.BeginWrite()) { break; }
-        buff.RetrieveUntil(lineEnd + 2);
     }
     LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
     return true;
@@ -100,22 +164,174 @@ bool HttpRequest::ParseRequestLine_(const string& line) {
 
 // Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.9
 // Connection: keep-alive
-void HttpRequest::ParseHeader_(const string& line) {
+bool HttpRequest::ParseHeader_(const string& line) {
+    if(line.empty()) {  // 此时到解析请求空行，头部结束
+        return ParseBodyLength_();
+    }
     regex patten("^([^:]*): ?(.*)$");
     smatch subMatch;
     if(regex_match(line, subMatch, patten)) {
         header_[subMatch[1]] = subMatch[2];
+        return true;
+    }
+    LOG_ERROR("Header Error");
+    return false;
+}
+
+// 有Transfer-Encoding时按chunked解码(优先于Content-Length)，有Content-Length时读取指定长度，都没有时没有请求体
+bool HttpRequest::ParseBodyLength_() {
+    const string& encoding = FindHeader_("Transfer-Encoding");
+    if(!encoding.empty()) {
+        // 只支持chunked(必须是最后一个编码)，其他编码无法确定请求体的长度
+        size_t pos = encoding.find_last_not_of(" \t");
+        if(pos == string::npos || pos < 6 ||
+           strncasecmp(encoding.c_str() + pos - 6, "chunked", 7) != 0 ||
+           (pos > 6 && !strchr(", \t", encoding[pos - 7]))) {
+            LOG_ERROR("Unsupported Transfer-Encoding: %s", encoding.c_str());
+            return false;
+        }
+        state_ = CHUNK_SIZE;
+        expectContinue_ = strcasecmp(FindHeader_("Expect").c_str(), "100-continue") == 0;
+        return true;
     }
-    else {  // 此时到解析请求空行，状态变为解析请求体
-        state_ = BODY;
+    const string& length = FindHeader_("Content-Length");
+    if(length.empty()) {
+        ParseBody_();
+        return true;
     }
+    size_t len = 0;
+    for(char ch: length) {
+        if(ch < '0' || ch > '9' || len > (SIZE_MAX - 9) / 10) {
+            LOG_ERROR("Bad Content-Length: %s", length.c_str());
+            return false;
+        }
+        len = len * 10 + (ch - '0');
+    }
+    if(len == 0) {
+        ParseBody_();
+        return true;
+    }
+    // 长度已知，先检查上限，不接收注定要拒绝的请求体
+    if(!ReserveBody_(len) || (len > bodyMemLimit && !OpenBodyFile_())) {
+        return false;
+    }
+    bodyRemain_ = len;
+    state_ = BODY;
+    expectContinue_ = strcasecmp(FindHeader_("Expect").c_str(), "100-continue") == 0;
+    return true;
 }
 
-void HttpRequest::ParseBody_(const string& line) {
-    body_ = line;
-    ParsePost_();
+// 块大小是十六进制，后面可以有";扩展"(忽略)；大小为0的块是最后一块
+bool HttpRequest::ParseChunkSize_(const string& line) {
+    size_t len = 0;
+    size_t i = 0;
+    for(; i < line.size(); i++) {
+        char ch = line[i];
+        int digit;
+        if(ch >= '0' && ch <= '9') { digit = ch - '0'; }
+        else if(ch >= 'a' && ch <= 'f') { digit = ch - 'a' + 10; }
+        else if(ch >= 'A' && ch <= 'F') { digit = ch - 'A' + 10; }
+        else { break; }
+        if(len > (SIZE_MAX >> 4)) { break; }
+        len = (len << 4) | digit;
+    }
+    if(i == 0 || (i < line.size() && line[i] != ';' && line[i] != ' ' && line[i] != '\t')) {
+        LOG_ERROR("Bad chunk size: %s", line.c_str());
+        return false;
+    }
+    if(len == 0) {
+        state_ = CHUNK_TRAILER;
+    } else {
+        bodyRemain_ = len;
+        state_ = CHUNK_DATA;
+    }
+    return true;
+}
+
+void HttpRequest::ParseBody_() {
+    ParsePost_();   // 请求体在临时文件中时body_为空，不解析表单
     state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    LOG_DEBUG("Body len:%zu, in file: %d", bodyLength_, bodyFile_ ? 1 : 0);
+}
+
+bool HttpRequest::AppendBody_(const char* data, size_t len) {
+    // Content-Length的请求体在头部结束时已经整体计入，chunked的边收边计入
+    if(state_ == CHUNK_DATA && !ReserveBody_(len)) {
+        return false;
+    }
+    if(!bodyFile_ && body_.size() + len > bodyMemLimit) {
+        if(!OpenBodyFile_()) { return false; }
+    }
+    bodyLength_ += len;
+    if(bodyFile_) {
+        if(!bodyFile_->Write(data, len)) {
+            errorCode_ = 503;
+            return false;
+        }
+        return true;
+    }
+    body_.append(data, len);
+    return true;
+}
+
+bool HttpRequest::ReserveBody_(size_t len) {
+    if(bodyLength_ + len > maxBodySize || len > maxBodySize) {
+        LOG_WARN("Request body too large: %zu + %zu", bodyLength_, len);
+        errorCode_ = 413;
+        return false;
+    }
+    bodyReserved_ += len;
+    if(bodyTotal_.fetch_add(len, memory_order_relaxed) + len > maxBodyTotal) {
+        LOG_WARN("Request bodies in flight over limit: %zu", (size_t)bodyTotal_);
+        errorCode_ = 503;
+        return false;
+    }
+    return true;
+}
+
+// 转存到临时文件，已经在内存中的部分先写进去
+bool HttpRequest::OpenBodyFile_() {
+    bodyFile_.reset(new BodyFile());
+    if(!bodyFile_->Open(bodyTmpDir) || !bodyFile_->Write(body_.data(), body_.size())) {
+        bodyFile_.reset();
+        errorCode_ = 503;
+        return false;
+    }
+    string().swap(body_);
+    return true;
+}
+
+void HttpRequest::ReleaseBody_() {
+    if(bodyReserved_ > 0) {
+        bodyTotal_.fetch_sub(bodyReserved_, memory_order_relaxed);
+        bodyReserved_ = 0;
+    }
+    bodyFile_.reset();
+    bodyLength_ = 0;
+}
+
+ssize_t HttpRequest::SpliceBody(int sockFd, int* saveErrno) {
+    ssize_t total = 0;
+    while(CanSpliceBody()) {
+        ssize_t len = bodyFile_->SpliceFrom(sockFd, bodyRemain_, saveErrno);
+        if(len <= 0) {
+            return total > 0 ? total : len;
+        }
+        total += len;
+        bodyRemain_ -= len;
+        bodyLength_ += len;
+    }
+    return total;
+}
+
+const string& HttpRequest::FindHeader_(const char* key) const {
+    static const string empty;
+    for(const auto& item: header_) {
+        if(strcasecmp(item.first.c_str(), key) == 0) {
+            return item.second;
+        }
+    }
+    return empty;
 }
 
 // 将十六进制的字符，转换成十进制的整数
@@ -133,18 +349,25 @@ void HttpRequest::ParsePost_() {
             int tag = DEFAULT_HTML_TAG.find(path_)->second;
             LOG_DEBUG("Tag:%d", tag);
             if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                } 
-                else {
-                    path_ = "/error.html";
-                }
+                // 不在I/O线程中查询数据库，交给数据库线程调用Verify()
+                isLogin_ = (tag == 1);
+                verifyPending_ = true;
             }
         }
     }   
 }
 
+void HttpRequest::Verify() {
+    assert(verifyPending_);
+    if(UserVerify(post_["username"], post_["password"], isLogin_)) {
+        path_ = "/welcome.html";
+    } 
+    else {
+        path_ = "/error.html";
+    }
+    verifyPending_ = false;
+}
+
 void HttpRequest::ParseFromUrlencoded_() {
     if(body_.size() == 0) { return; }
     // username=zhangsan&password=123
@@ -190,62 +413,46 @@ void HttpRequest::ParseFromUrlencoded_() {
 // 用户验证（整合了登录和注册的验证）
 bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin) {
     if(name == "" || pwd == "") { return false; }
-    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
-    MYSQL* sql;
-    SqlConnRAII(&sql,  SqlConnPool::Instance());
-    assert(sql);
-    
-    bool flag = false;
-    unsigned int j = 0;
-    char order[256] = { 0 };
-    MYSQL_FIELD *fields = nullptr;
-    MYSQL_RES *res = nullptr;
-    
-    if(!isLogin) { flag = true; }
-    /* 查询用户及密码 */
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
-    LOG_DEBUG("%s", order);
+    LOG_INFO("Verify name:%s", name.c_str());
 
-    if(mysql_query(sql, order)) { 
-        mysql_free_result(res);
-        return false; 
+    /* 先查凭证缓存，命中则不访问数据库 */
+    CredentialCache* cache = CredentialCache::Instance();
+    bool pwdMatch = false;
+    CredentialCache::LOOKUP cached = cache->Lookup(name, pwd, pwdMatch);
+    if(cached == CredentialCache::USER_EXISTS) {
+        return isLogin && pwdMatch;
+    }
+    if(cached == CredentialCache::USER_ABSENT && isLogin) {
+        return false;
     }
-    res = mysql_store_result(sql);
-    j = mysql_num_fields(res);
-    fields = mysql_fetch_fields(res);
 
-    while(MYSQL_ROW row = mysql_fetch_row(res)) {
-        LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        string password(row[1]);
-        /* 注册行为 且 用户名未被使用*/
-        if(isLogin) {
-            if(pwd == password) { flag = true; }
-            else {
-                flag = false;
-                LOG_DEBUG("pwd error!");
-            }
-        } 
-        else { 
-            flag = false; 
-            LOG_DEBUG("user used!");
-        }
+    if(!authStore || !authStore->IsReady()) {
+        LOG_WARN("AuthStore not ready!");
+        return false;
     }
-    mysql_free_result(res);
 
-    /* 注册行为 且 用户名未被使用*/
-    if(!isLogin && flag == true) {
+    /* 查询用户及密码 */
+    string password;
+    int found = authStore->Lookup(name, password);
+    if(found < 0) { return false; }
+    if(found == 1) { cache->Put(name, password); }
+    else { cache->PutAbsent(name); }
+
+    bool flag = false;
+    if(isLogin) {
+        flag = (found == 1 && pwd == password);
+        if(!flag) { LOG_DEBUG("pwd error!"); }
+    }
+    else if(found == 1) {
+        LOG_DEBUG("user used!");
+    }
+    else {
+        /* 注册行为 且 用户名未被使用*/
         LOG_DEBUG("regirster!");
-        bzero(order, 256);
-        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
-        LOG_DEBUG( "%s", order);
-        if(mysql_query(sql, order)) { 
-            LOG_DEBUG( "Insert error!");
-            flag = false; 
-        }
-        flag = true;
+        flag = authStore->Insert(name, pwd);
+        if(flag) { cache->Put(name, pwd); }    // 写穿，覆盖负缓存
     }
-    SqlConnPool::Instance()->FreeConn(sql);
-    LOG_DEBUG( "UserVerify success!!");
+    LOG_DEBUG( "UserVerify %s!!", flag ? "success" : "failed");
     return flag;
 }
 
@@ -256,14 +463,23 @@ std::string HttpRequest::path() const{
 std::string& HttpRequest::path(){
     return path_;
 }
-std::string HttpRequest::method() const {
+const std::string& HttpRequest::method() const {
     return method_;
 }
 
-std::string HttpRequest::version() const {
+const std::string& HttpRequest::version() const {
     return version_;
 }
 
+const std::string& HttpRequest::GetHeader(const std::string& key) const {
+    static const std::string empty;
+    auto it = header_.find(key);
+    if(it == header_.end()) {
+        return empty;
+    }
+    return it->second;
+}
+
 std::string HttpRequest::GetPost(const std::string& key) const {
     assert(key != "");
     if(post_.count(key) == 1) {
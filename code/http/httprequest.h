@@ -5,20 +5,26 @@
 #include <unordered_set>
 #include <string>
 #include <regex>
+#include <memory>
+#include <atomic>
 #include <errno.h>     
-#include <mysql/mysql.h>  //mysql
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
-#include "../pool/sqlconnpool.h"
-#include "../pool/sqlconnRAII.h"
+#include "../auth/authstore.h"
+#include "../auth/credcache.h"
+#include "bodyfile.h"
 
 class HttpRequest {
 public:
     enum PARSE_STATE {
         REQUEST_LINE,   // 正在解析请求首行
         HEADERS,        // 头
-        BODY,           // 体
+        BODY,           // 体(按Content-Length)
+        CHUNK_SIZE,     // chunked编码：块大小行
+        CHUNK_DATA,     // 块数据
+        CHUNK_DATA_END, // 块数据后的CRLF
+        CHUNK_TRAILER,  // 最后一块之后的trailer字段，空行结束
         FINISH,         // 完成
     };
 
@@ -33,25 +39,77 @@ public:
         CLOSED_CONNECTION,
     };
     
-    HttpRequest() { Init(); }
-    ~HttpRequest() = default;
+    HttpRequest(): bodyReserved_(0) { Init(); }
+    ~HttpRequest() { ReleaseBody_(); }
 
     void Init();
+    // 解析buff中已到达的数据：只消费完整的行，请求体收到多少消费多少；语法错误返回false
+    // 请求没有收完时保留解析状态，收到更多数据后再次调用，IsFinished()为true时请求完整
     bool parse(Buffer& buff);
+    bool IsFinished() const { return state_ == FINISH; }
+    // 已经开始解析一个请求、还没有结束(缓冲区开头不再是请求首行)
+    bool InProgress() const { return state_ != REQUEST_LINE && state_ != FINISH; }
+    bool InHeader() const { return state_ == REQUEST_LINE || state_ == HEADERS; }   // 请求头还没有收齐
+    int ErrorCode() const { return errorCode_; }    // parse()失败时响应的状态码(400/413/503)
+
+    // 请求带Expect: 100-continue且请求体可以接收时返回一次true，调用者先回复100 Continue
+    bool TakeExpectContinue() {
+        bool expect = expectContinue_;
+        expectContinue_ = false;
+        return expect;
+    }
+
+    // 按Content-Length接收、已经转存到临时文件的请求体，剩余部分可以从socket直接splice到文件
+    bool CanSpliceBody() const { return state_ == BODY && bodyRemain_ > 0 && bodyFile_; }
+    ssize_t SpliceBody(int sockFd, int* saveErrno);     // 返回值同read，请求体收完后再调用parse()
+
+    // 请求体：不超过bodyMemLimit时在内存中，否则在临时文件中(BodyFd()，已删除目录项)
+    int BodyFd() const { return bodyFile_ ? bodyFile_->Fd() : -1; }
+    size_t BodyLength() const { return bodyLength_; }
+    static size_t BodyBytesInFlight() { return bodyTotal_.load(std::memory_order_relaxed); }
+    // HTTP/2的请求已由HPACK解出各字段，不经过文本解析，直接处理路径和表单
+    void Init(const std::string& method, const std::string& path, const std::string& version,
+              const std::unordered_map<std::string, std::string>& header, const std::string& body);
+    // HTTP/2的请求体按DATA帧到达：和HTTP/1.x一样计入上限，超过bodyMemLimit时转存到临时文件
+    // 超过上限或写临时文件失败时返回false，ErrorCode()为413/503
+    bool AppendBody(const char* data, size_t len) { return ReserveBody_(len) && AppendBody_(data, len); }
+    // 同Init，请求体已经由AppendBody收到
+    void Finish(const std::string& method, const std::string& path, const std::string& version,
+                const std::unordered_map<std::string, std::string>& header);
 
     std::string path() const;
     std::string& path();
-    std::string method() const;
-    std::string version() const;
+    const std::string& method() const;
+    const std::string& version() const;
     std::string GetPost(const std::string& key) const;
     std::string GetPost(const char* key) const;
+    const std::string& GetHeader(const std::string& key) const;
+    const std::unordered_map<std::string, std::string>& Headers() const { return header_; }
 
     bool IsKeepAlive() const;
 
+    // 登录/注册请求解析完成后需要访问数据库验证，由专门的数据库线程调用Verify()
+    bool IsVerifyPending() const { return verifyPending_; }
+    void Verify();
+
+    static AuthStore* authStore;    // 用户验证的存储后端(MySQL或本地文件)
+    static const size_t MAX_LINE = 8192;    // 请求首行、头部行、块大小行的最大长度
+    static size_t bodyMemLimit;     // 请求体超过它时转存到临时文件
+    static size_t maxBodySize;      // 单个请求体的上限，超过返回413
+    static size_t maxBodyTotal;     // 所有连接正在接收和持有的请求体总和的上限，超过返回503
+    static std::string bodyTmpDir;  // 临时文件的目录
+
 private:
     bool ParseRequestLine_(const std::string& line);
-    void ParseHeader_(const std::string& line);
-    void ParseBody_(const std::string& line);
+    bool ParseHeader_(const std::string& line);
+    bool ParseBodyLength_();    // 头部结束：由Transfer-Encoding/Content-Length确定请求体的格式
+    bool ParseChunkSize_(const std::string& line);
+    void ParseBody_();          // 请求体收完
+    bool AppendBody_(const char* data, size_t len);
+    bool ReserveBody_(size_t len);  // 计入单个请求和全局的请求体大小，超过上限时设置errorCode_
+    bool OpenBodyFile_();
+    void ReleaseBody_();
+    const std::string& FindHeader_(const char* key) const;  // 不区分大小写
 
     void ParsePath_();
     void ParsePost_();
@@ -60,9 +118,19 @@ private:
     static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
 
     PARSE_STATE state_;     // 解析的状态
+    bool verifyPending_;    // 是否等待用户验证
+    bool isLogin_;          // 登录还是注册
     std::string method_, path_, version_, body_;    // 请求方法，请求路径，协议版本，请求体
     std::unordered_map<std::string, std::string> header_;   // 请求头(键值对形式)
     std::unordered_map<std::string, std::string> post_;     // post请求表单数据
+    size_t bodyRemain_;     // 当前请求体(或当前块)还没有收到的字节数
+    size_t bodyLength_;     // 已经收到的请求体字节数
+    size_t bodyReserved_;   // 计入bodyTotal_的字节数
+    std::unique_ptr<BodyFile> bodyFile_;
+    int errorCode_;
+    bool expectContinue_;
+
+    static std::atomic<size_t> bodyTotal_;
 
     static const std::unordered_set<std::string> DEFAULT_HTML;  // 默认的网页
     static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG; 
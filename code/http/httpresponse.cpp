@@ -21,8 +21,8 @@ const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
     { ".avi",   "video/x-msvideo" },
     { ".gz",    "application/x-gzip" },
     { ".tar",   "application/x-tar" },
-    { ".css",   "text/css "},
-    { ".js",    "text/javascript "},
+    { ".css",   "text/css" },
+    { ".js",    "text/javascript" },
 };
 
 // 响应状态码对应的描述语
@@ -31,6 +31,9 @@ const unordered_map<int, string> HttpResponse::CODE_STATUS = {
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 413, "Payload Too Large" },
+    { 429, "Too Many Requests" },
+    { 503, "Service Unavailable" },
 };
 
 // 响应码对应的资源路径
@@ -38,12 +41,16 @@ const unordered_map<int, string> HttpResponse::CODE_PATH = {
     { 400, "/400.html" },
     { 403, "/403.html" },
     { 404, "/404.html" },
+    { 413, "/413.html" },
+    { 429, "/429.html" },
+    { 503, "/503.html" },
 };
 
 HttpResponse::HttpResponse() {
     code_ = -1;
     path_ = srcDir_ = "";
     isKeepAlive_ = false;
+    keepAliveLeft_ = -1;
     mmFile_ = nullptr; 
     mmFileStat_ = { 0 };
 };
@@ -52,13 +59,14 @@ HttpResponse::~HttpResponse() {
     UnmapFile();
 }
 
-void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code){
+void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code, int keepAliveLeft){
     assert(srcDir != "");
     
     if(mmFile_) { UnmapFile(); }
 
     code_ = code;
     isKeepAlive_ = isKeepAlive;
+    keepAliveLeft_ = keepAliveLeft;
     path_ = path;
     srcDir_ = srcDir;
     mmFile_ = nullptr; 
@@ -66,10 +74,28 @@ void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, in
 }
 
 void HttpResponse::MakeResponse(Buffer& buff) {
-    /* 判断请求的资源文件 */
+    CheckFile_();
+    AddStateLine_(buff);
+    AddHeader_(buff, GetFileType_());
+    AddContent_(buff);
+}
+
+void HttpResponse::MakeContent(string& errorBody) {
+    CheckFile_();
+    if(CODE_STATUS.count(code_) == 0) { code_ = 400; }
+    if(!MapFile_()) {
+        errorBody = ErrorBody_("File NotFound!");
+    }
+}
+
+// 判断请求的资源文件，确定状态码；出错时换成对应的错误页面
+void HttpResponse::CheckFile_() {
     // index.html
     // /home/nowcoder/WebServer-master/resources/index.html
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
+    if(code_ >= 400) {
+        // 请求本身已经出错(解析失败、请求体超过上限)，不访问请求的文件
+    }
+    else if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
         code_ = 404;  // 服务器上无法找到请求的资源
     }
     else if(!(mmFileStat_.st_mode & S_IROTH)) {
@@ -79,9 +105,52 @@ void HttpResponse::MakeResponse(Buffer& buff) {
         code_ = 200; 
     }
     ErrorHtml_();
+}
+
+void HttpResponse::MakeResponse(Buffer& buff, const string& body) {
+    if(code_ == -1) { code_ = 200; }
     AddStateLine_(buff);
-    AddHeader_(buff);
-    AddContent_(buff);
+    AddHeader_(buff, GetFileType_());
+    buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
+    buff.Append(body);
+}
+
+void HttpResponse::MakeStreamResponse(Buffer& buff, bool chunked, const string& contentType) {
+    if(code_ == -1) { code_ = 200; }
+    if(!chunked) { isKeepAlive_ = false; }  // 没有长度时以关闭连接表示响应结束
+    AddStateLine_(buff);
+    AddHeader_(buff, contentType.empty() ? GetFileType_() : contentType);
+    if(chunked) {
+        buff.Append("Transfer-Encoding: chunked\r\n");
+    }
+    buff.Append("\r\n");
+}
+
+void HttpResponse::MakeEventStreamResponse(Buffer& buff, bool chunked) {
+    code_ = 200;
+    if(!chunked) { isKeepAlive_ = false; }
+    AddStateLine_(buff);
+    AddHeader_(buff, "text/event-stream");
+    buff.Append("Cache-Control: no-cache\r\nX-Accel-Buffering: no\r\n");
+    if(chunked) {
+        buff.Append("Transfer-Encoding: chunked\r\n");
+    }
+    buff.Append("\r\n");
+}
+
+// 块：十六进制长度 CRLF 数据 CRLF
+void HttpResponse::AppendChunk(Buffer& buff, const char* data, size_t len) {
+    assert(len > 0);
+    char size[24];
+    int n = snprintf(size, sizeof(size), "%zx\r\n", len);
+    buff.Append(size, n);
+    buff.Append(data, len);
+    buff.Append("\r\n", 2);
+}
+
+// 长度为0的最后一块，没有trailer字段
+void HttpResponse::AppendLastChunk(Buffer& buff) {
+    buff.Append("0\r\n\r\n", 5);
 }
 
 char* HttpResponse::File() {
@@ -113,36 +182,56 @@ void HttpResponse::AddStateLine_(Buffer& buff) {
 }
 
 // 添加响应头
-void HttpResponse::AddHeader_(Buffer& buff) {
+void HttpResponse::AddHeader_(Buffer& buff, const string& contentType) {
     buff.Append("Connection: ");
     if(isKeepAlive_) {
         buff.Append("keep-alive\r\n");
-        buff.Append("keep-alive: max=6, timeout=120\r\n");
+        // 告诉客户端服务器实际执行的空闲超时(随负载缩短)和剩余的请求数，客户端不会复用快要被关闭的连接
+        int timeout = KeepAlivePolicy::Instance()->IdleTimeout() / 1000;
+        buff.Append("Keep-Alive: timeout=" + to_string(timeout > 0 ? timeout : 1));
+        if(keepAliveLeft_ >= 0) {
+            buff.Append(", max=" + to_string(keepAliveLeft_));
+        }
+        buff.Append("\r\n");
     } else{
         buff.Append("close\r\n");
     }
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
+    if(code_ == 429) {
+        buff.Append("Retry-After: " + to_string(IpLimiter::RETRY_AFTER) + "\r\n");
+    }
+    buff.Append("Content-type: " + contentType + "\r\n");
 }
 
 // 添加响应体
 void HttpResponse::AddContent_(Buffer& buff) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);  // 得到资源文件的文件描述符
-    if(srcFd < 0) { 
+    if(!MapFile_()) {
         ErrorContent(buff, "File NotFound!");
         return; 
     }
+    buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+}
+
+// 映射资源文件，空文件不映射
+bool HttpResponse::MapFile_() {
+    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);  // 得到资源文件的文件描述符
+    if(srcFd < 0) { 
+        return false;
+    }
+    if(mmFileStat_.st_size == 0) {
+        close(srcFd);
+        return true;
+    }
 
     /*  将文件映射到内存提高文件的访问速度 
         MAP_PRIVATE 建立一个写入时拷贝的私有映射  */
     LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    if(*mmRet == -1) {
-        ErrorContent(buff, "File NotFound!");
-        return; 
+    void* mmRet = mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
+    close(srcFd);
+    if(mmRet == MAP_FAILED) {
+        return false;
     }
     mmFile_ = (char*)mmRet;
-    close(srcFd);
-    buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+    return true;
 }
 
 // 解除内存映射
@@ -168,6 +257,12 @@ string HttpResponse::GetFileType_() {
 
 void HttpResponse::ErrorContent(Buffer& buff, string message) 
 {
+    string body = ErrorBody_(message);
+    buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
+    buff.Append(body);
+}
+
+string HttpResponse::ErrorBody_(const string& message) {
     string body;
     string status;
     body += "<html><title>Error</title>";
@@ -180,7 +275,5 @@ void HttpResponse::ErrorContent(Buffer& buff, string message)
     body += to_string(code_) + " : " + status  + "\n";
     body += "<p>" + message + "</p>";
     body += "<hr><em>TinyWebServer</em></body></html>";
-
-    buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
-    buff.Append(body);
+    return body;
 }
@@ -2,6 +2,7 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
+#include <functional>
 #include <fcntl.h>       // open
 #include <unistd.h>      // close
 #include <sys/stat.h>    // stat
@@ -9,30 +10,62 @@
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "keepalive.h"
+#include "iplimiter.h"
+
+class HttpRequest;
+
+// 大小事先未知、边生成边发送的响应体：每次调用把下一段追加到chunk，返回false表示生成结束
+// 在I/O线程中调用，不能阻塞；没有结束时每次都要生成数据
+typedef std::function<bool(std::string& chunk)> BodyProducer;
+
+// 分段生成的响应：为每个请求创建一个生产者
+struct StreamHandler {
+    std::string contentType;
+    std::function<BodyProducer(const HttpRequest&)> open;
+};
 
 class HttpResponse {
 public:
     HttpResponse();
     ~HttpResponse();
 
-    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    // keepAliveLeft：保持连接时这个连接还能处理的请求数(Keep-Alive头的max)，-1为不限
+    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1,
+              int keepAliveLeft = -1);
     void MakeResponse(Buffer& buff);
+    void MakeResponse(Buffer& buff, const std::string& body);  // 响应体由程序生成(如/metrics)，不读文件
+    // 只生成状态行和头部，响应体随后由BodyProducer分段生成：chunked为true时使用chunked编码，
+    // 否则(HTTP/1.0)不带长度，写完后关闭连接
+    void MakeStreamResponse(Buffer& buff, bool chunked, const std::string& contentType);
+    // SSE(text/event-stream)：响应不结束，事件由SseConn直接写出；禁止缓存和反向代理缓冲
+    void MakeEventStreamResponse(Buffer& buff, bool chunked);
+    static void AppendChunk(Buffer& buff, const char* data, size_t len);   // len不能为0
+    static void AppendLastChunk(Buffer& buff);
+    // 只确定状态码并映射文件，不生成HTTP/1.x的状态行和头部(HTTP/2由HPACK编码)；文件打不开时errorBody为错误页面
+    void MakeContent(std::string& errorBody);
+    std::string ContentType() { return GetFileType_(); }
     void UnmapFile();
     char* File();
     size_t FileLen() const;
     void ErrorContent(Buffer& buff, std::string message);
     int Code() const { return code_; }
+    bool IsKeepAlive() const { return isKeepAlive_; }
 
 private:
     void AddStateLine_(Buffer &buff);
-    void AddHeader_(Buffer &buff);
+    void AddHeader_(Buffer &buff, const std::string& contentType);
     void AddContent_(Buffer &buff);
 
+    void CheckFile_();
+    bool MapFile_();
+    std::string ErrorBody_(const std::string& message);
     void ErrorHtml_();
     std::string GetFileType_();
 
     int code_;  // 响应状态码
     bool isKeepAlive_;  // 是否保持连接
+    int keepAliveLeft_; // 连接还能处理的请求数
 
     std::string path_;  // 资源的路径
     std::string srcDir_;    // 资源的目录
@@ -0,0 +1,120 @@
+#include "iplimiter.h"
+#include <chrono>
+
+using namespace std;
+
+IpLimiter* IpLimiter::Instance() {
+    static IpLimiter instance;
+    return &instance;
+}
+
+IpLimiter::IpLimiter(): maxConns_(0), rps_(0), capacity_(0), connRejected_(0), requestRejected_(0),
+        tableFull_(0) {}
+
+void IpLimiter::Init(int maxConns, int rps, int burst) {
+    maxConns_ = maxConns > 0 ? maxConns : 0;
+    rps_ = rps > 0 ? rps : 0;
+    if(burst <= 0) { burst = rps_; }
+    capacity_ = static_cast<uint32_t>(min(burst, 4000000)) * TOKEN;
+    if(maxConns_ > 0 || rps_ > 0) {
+        slots_.reset(new Slot[1 << TABLE_BITS]());
+    } else {
+        slots_.reset();
+    }
+}
+
+uint32_t IpLimiter::NowMs_() {
+    return static_cast<uint32_t>(chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint32_t IpLimiter::Tokens_(uint64_t bucket, uint32_t now) const {
+    if(bucket == 0) { return capacity_; }
+    int32_t elapsed = static_cast<int32_t>(now - static_cast<uint32_t>(bucket >> 32));
+    // 其他线程可能已经用稍晚的时间更新过(差几毫秒)；差得多只能是32位毫秒时间回绕，
+    // 即上次更新在约24.8天以前，桶早已补满
+    if(elapsed < -MAX_SKEW_MS) { return capacity_; }
+    uint64_t tokens = static_cast<uint32_t>(bucket);
+    if(elapsed > 0) {
+        tokens += static_cast<uint64_t>(elapsed) * rps_;
+    }
+    return tokens < capacity_ ? static_cast<uint32_t>(tokens) : capacity_;
+}
+
+bool IpLimiter::IsStale_(const Slot& slot, uint32_t now) const {
+    return slot.conns.load(memory_order_relaxed) == 0 &&
+           (rps_ == 0 || Tokens_(slot.bucket.load(memory_order_relaxed), now) == capacity_);
+}
+
+bool IpLimiter::Connect(in_addr addr, int* slot) {
+    *slot = -1;
+    uint32_t key = addr.s_addr;
+    if(!slots_ || key == 0) { return true; }
+    const uint32_t mask = (1u << TABLE_BITS) - 1;
+    uint32_t hash = (key * 2654435769u) >> (32 - TABLE_BITS);   // Fibonacci哈希
+    int found = -1;
+    for(int i = 0; i < PROBE && found < 0; i++) {
+        uint32_t idx = (hash + i) & mask;
+        if(slots_[idx].addr.load(memory_order_acquire) == key) { found = idx; }
+    }
+    // 先占空槽位，再替换过期的槽位；CAS失败时看是不是其他线程刚为同一个IP占用了它
+    for(int i = 0; i < PROBE && found < 0; i++) {
+        uint32_t idx = (hash + i) & mask;
+        uint32_t expected = 0;
+        if(slots_[idx].addr.compare_exchange_strong(expected, key) || expected == key) { found = idx; }
+    }
+    uint32_t now = NowMs_();
+    for(int i = 0; i < PROBE && found < 0; i++) {
+        uint32_t idx = (hash + i) & mask;
+        uint32_t old = slots_[idx].addr.load(memory_order_acquire);
+        if(old == key || (IsStale_(slots_[idx], now) && slots_[idx].addr.compare_exchange_strong(old, key))) {
+            found = idx;
+        }
+    }
+    if(found < 0) {
+        tableFull_.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+    Slot& s = slots_[found];
+    if(s.conns.fetch_add(1, memory_order_relaxed) + 1 > maxConns_ && maxConns_ > 0) {
+        s.conns.fetch_sub(1, memory_order_relaxed);
+        connRejected_.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    *slot = found;
+    return true;
+}
+
+void IpLimiter::Release(int slot) {
+    if(slot >= 0 && slots_) {
+        slots_[slot].conns.fetch_sub(1, memory_order_relaxed);
+    }
+}
+
+bool IpLimiter::Request(int slot) {
+    if(slot < 0 || rps_ == 0 || !slots_) { return true; }
+    std::atomic<uint64_t>& bucket = slots_[slot].bucket;
+    uint32_t now = NowMs_();
+    uint64_t old = bucket.load(memory_order_relaxed);
+    uint64_t next;
+    do {
+        uint32_t tokens = Tokens_(old, now);
+        if(tokens < TOKEN) {
+            requestRejected_.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        next = static_cast<uint64_t>(now) << 32 | (tokens - TOKEN);
+        if(next == 0) { next = 1ull << 32; }    // 0表示满
+    } while(!bucket.compare_exchange_weak(old, next, memory_order_relaxed));
+    return true;
+}
+
+size_t IpLimiter::Tracked() {
+    if(!slots_) { return 0; }
+    size_t cnt = 0;
+    uint32_t now = NowMs_();
+    for(size_t i = 0; i < (1u << TABLE_BITS); i++) {
+        if(slots_[i].addr.load(memory_order_relaxed) != 0 && !IsStale_(slots_[i], now)) { cnt++; }
+    }
+    return cnt;
+}
@@ -0,0 +1,66 @@
+#ifndef IP_LIMITER_H
+#define IP_LIMITER_H
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <netinet/in.h>  // in_addr
+
+// 按客户端IP限制并发连接数和每秒请求数(令牌桶)
+// 固定大小的开放寻址表，槽位只有原子变量，不加锁：主线程接受连接，工作线程处理请求时取令牌
+// 每个IP只在哈希位置开始的PROBE个槽位内查找，找不到时占用空槽位，没有空槽位时替换一个过期的槽位
+// (没有连接且令牌桶已经补满，和新建的状态相同，替换不丢失信息)，仍然找不到时不限制(计入tableFull)
+// 槽位的令牌桶在一个64位字里(上次补充的毫秒时间 << 32 | 令牌数，以1/1000个令牌为单位)，取令牌是一次CAS
+// 同一个IP的并发连接偶尔可能占用两个槽位，计数分散，限制只会稍微放宽
+class IpLimiter {
+public:
+    static IpLimiter* Instance();
+
+    // maxConns：每个IP的并发连接数上限；rps：每秒请求数；burst：令牌桶容量(允许的突发请求数)；0为不限
+    // 在开始服务之前调用
+    void Init(int maxConns, int rps, int burst);
+    bool IsOpen() const { return slots_ != nullptr; }
+
+    // 新连接(主线程)：超过并发上限返回false；*slot为占用的槽位(-1为没有记录)，连接关闭时Release
+    bool Connect(in_addr addr, int* slot);
+    void Release(int slot);
+    // 每个请求取一个令牌，令牌用完时返回false；可在任何线程调用
+    bool Request(int slot);
+
+    size_t Tracked();   // 有连接或令牌桶没有补满的IP数(抓取指标时遍历)
+
+    uint64_t ConnRejected() const { return connRejected_.load(std::memory_order_relaxed); }
+    uint64_t RequestRejected() const { return requestRejected_.load(std::memory_order_relaxed); }
+    uint64_t TableFull() const { return tableFull_.load(std::memory_order_relaxed); }
+
+    static const int TABLE_BITS = 16;       // 65536个槽位，共1MB
+    static const int PROBE = 8;
+    static const uint32_t TOKEN = 1000;     // 一个令牌的单位数，每毫秒正好补充rps个单位
+    static const int32_t MAX_SKEW_MS = 1000;    // 并发更新造成的时间倒退不会超过它
+    static const int RETRY_AFTER = 1;       // 429响应的Retry-After(秒)
+
+private:
+    IpLimiter();
+    ~IpLimiter() = default;
+
+    struct Slot {
+        std::atomic<uint32_t> addr;     // 网络字节序，0为空
+        std::atomic<int32_t> conns;
+        std::atomic<uint64_t> bucket;   // 0为从来没有取过令牌(满)
+    };
+
+    uint32_t Tokens_(uint64_t bucket, uint32_t now) const;  // 补充到now之后的令牌数
+    bool IsStale_(const Slot& slot, uint32_t now) const;
+    static uint32_t NowMs_();
+
+    std::unique_ptr<Slot[]> slots_;
+    int maxConns_;
+    uint32_t rps_;
+    uint32_t capacity_;     // 令牌桶容量(单位数)
+
+    std::atomic<uint64_t> connRejected_;
+    std::atomic<uint64_t> requestRejected_;
+    std::atomic<uint64_t> tableFull_;
+};
+
+#endif //IP_LIMITER_H
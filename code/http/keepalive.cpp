@@ -0,0 +1,67 @@
+#include "keepalive.h"
+#include <fcntl.h>       // open
+#include <unistd.h>      // read, close, sysconf
+#include <stdlib.h>      // strtoull
+#include <algorithm>
+
+using namespace std;
+
+KeepAlivePolicy* KeepAlivePolicy::Instance() {
+    static KeepAlivePolicy instance;
+    return &instance;
+}
+
+KeepAlivePolicy::KeepAlivePolicy(): baseIdleMs_(60000), headerMs_(0), maxRequests_(0), maxConns_(65536),
+        memLimit_(0), idleMs_(60000), loadPermille_(0), draining_(false), lastSample_(0), rss_(0) {}
+
+void KeepAlivePolicy::Init(int idleMs, int headerMs, int maxRequests, int maxConns, size_t memLimit) {
+    baseIdleMs_ = idleMs;
+    headerMs_ = headerMs > 0 ? headerMs : 0;
+    maxRequests_ = maxRequests > 0 ? maxRequests : 0;
+    maxConns_ = maxConns > 0 ? maxConns : 1;
+    memLimit_ = memLimit;
+    idleMs_ = idleMs;
+    loadPermille_ = 0;
+    draining_ = false;
+    lastSample_ = 0;
+    rss_ = 0;
+}
+
+void KeepAlivePolicy::Update(int conns) {
+    int load = static_cast<int>(static_cast<int64_t>(conns) * 1000 / maxConns_);
+    if(memLimit_ > 0) {
+        int64_t now = NowMs();
+        if(now - lastSample_ >= UPDATE_MS) {
+            lastSample_ = now;
+            rss_ = ResidentBytes_();
+        }
+        load = max(load, static_cast<int>(rss_ * 1000 / memLimit_));
+    }
+    load = min(load, 1000);
+    loadPermille_.store(load, memory_order_relaxed);
+
+    int idle = baseIdleMs_;
+    int floor = min(baseIdleMs_, static_cast<int>(MIN_IDLE_MS));
+    if(load >= HIGH_LOAD) {
+        idle = floor;
+    } else if(load > LOW_LOAD) {
+        idle = baseIdleMs_ - static_cast<int>(static_cast<int64_t>(baseIdleMs_ - floor) *
+                                              (load - LOW_LOAD) / (HIGH_LOAD - LOW_LOAD));
+    }
+    idleMs_.store(idle, memory_order_relaxed);
+}
+
+// /proc/self/statm的第二个字段是常驻内存的页数
+size_t KeepAlivePolicy::ResidentBytes_() {
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return 0; }
+    char buf[128];
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if(len <= 0) { return 0; }
+    buf[len] = '\0';
+    char* end = nullptr;
+    strtoull(buf, &end, 10);
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    return strtoull(end, nullptr, 10) * pageSize;
+}
@@ -0,0 +1,68 @@
+#ifndef KEEP_ALIVE_H
+#define KEEP_ALIVE_H
+
+#include <atomic>
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+
+// 长连接策略：每个连接最多处理的请求数、两个请求之间的空闲超时、收齐请求头的期限
+// 空闲超时随负载自适应：负载(连接数占fd上限、进程内存占内存上限的比例，取大者)低于LOW_LOAD时为配置值，
+// LOW_LOAD~HIGH_LOAD之间线性缩短到MIN_IDLE_MS，负载高时空闲的长连接尽快让出fd和缓冲区
+// 请求头期限从请求的第一个字节(新连接从建立时)算起，不因收到数据而延长，慢速发送请求头的连接不能一直占着
+class KeepAlivePolicy {
+public:
+    static KeepAlivePolicy* Instance();
+
+    // idleMs：负载低时的空闲超时；headerMs：请求头期限(0为不单独限制)；maxRequests：每个连接的请求数上限(0为不限)
+    // maxConns：连接数上限(fd上限)；memLimit：进程内存上限(字节，0为不看内存)
+    void Init(int idleMs, int headerMs, int maxRequests, int maxConns, size_t memLimit);
+
+    // 主线程中调用：按当前连接数和进程内存(最多每UPDATE_MS读一次/proc/self/statm)重新计算空闲超时
+    void Update(int conns);
+
+    int IdleTimeout() const { return idleMs_.load(std::memory_order_relaxed); }
+    int HeaderTimeout() const { return headerMs_; }
+    // 平滑重启/退出：之后的响应都带Connection: close
+    void SetDraining(bool draining) { draining_.store(draining, std::memory_order_relaxed); }
+    bool IsDraining() const { return draining_.load(std::memory_order_relaxed); }
+    double Load() const { return loadPermille_.load(std::memory_order_relaxed) / 1000.0; }
+
+    // 连接上已经响应served个请求(含当前的)后还能处理的请求数，0时当前响应后关闭连接，-1为不限
+    int RequestsLeft(int served) const {
+        if(IsDraining()) { return 0; }
+        if(maxRequests_ <= 0) { return -1; }
+        return served < maxRequests_ ? maxRequests_ - served : 0;
+    }
+
+    // 毫秒时间戳(steady_clock)，连接记录阶段开始的时间
+    static int64_t NowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static const int MIN_IDLE_MS = 2000;
+    static const int UPDATE_MS = 100;
+    static const int LOW_LOAD = 500;    // 千分比
+    static const int HIGH_LOAD = 900;
+
+private:
+    KeepAlivePolicy();
+    ~KeepAlivePolicy() = default;
+
+    size_t ResidentBytes_();
+
+    int baseIdleMs_;
+    int headerMs_;
+    int maxRequests_;
+    int maxConns_;
+    size_t memLimit_;
+
+    std::atomic<int> idleMs_;           // 工作线程生成Keep-Alive头时读取
+    std::atomic<int> loadPermille_;
+    std::atomic<bool> draining_;
+    int64_t lastSample_;                // 以下只在主线程中访问
+    size_t rss_;
+};
+
+#endif //KEEP_ALIVE_H
@@ -0,0 +1,40 @@
+#ifndef PUSH_CONN_H
+#define PUSH_CONN_H
+
+#include <string>
+#include <functional>
+#include <stdint.h>
+#include <sys/uio.h>     // iovec
+
+#include "../buffer/buffer.h"
+
+// 服务端推送的长连接(WebSocket、SSE)：由HttpConn在请求升级后创建，读写缓冲和socket仍归HttpConn
+// 其他线程(发布消息、定时器)也会给连接追加数据，所以连接的归属要显式交接：
+//   工作线程处理完读写后Park()把连接交还给epoll，主线程收到事件后Claim()取回，
+//   空闲的连接由追加数据的线程通过ArmFunc重新注册EPOLLOUT
+class PushConn {
+public:
+    // arm(fd, events)：重新注册连接的epoll事件(EPOLLIN/EPOLLOUT)
+    typedef std::function<void(int fd, uint32_t events)> ArmFunc;
+
+    virtual ~PushConn() = default;
+
+    virtual void Process(Buffer& readBuff) = 0;     // 处理客户端发来的数据
+
+    // 只由持有连接的工作线程调用：把待发送的数据填进iov，写出len字节后调用Consume
+    virtual int FillIov(struct iovec* iov, int maxCnt) = 0;
+    virtual void Consume(size_t len) = 0;
+    virtual size_t ToWriteBytes() = 0;
+    virtual bool IsDone() = 0;      // 可以关闭连接(关闭握手完成)
+
+    virtual void Park() = 0;        // 交还给epoll，按待发送的数据注册EPOLLIN/EPOLLOUT
+    virtual bool Claim() = 0;       // 主线程收到事件时取回连接，已经在工作线程中返回false(重复的事件)
+    virtual void Shutdown() = 0;    // 连接关闭，之后追加的数据直接丢弃
+
+    // 空闲定时器到期(主线程)：发送心跳返回true，对端已失联返回false(关闭连接)
+    virtual bool Ping() = 0;
+    // 空闲多久发一次心跳，idleMs为服务器的空闲超时
+    virtual int PingInterval(int idleMs) const { return idleMs; }
+};
+
+#endif //PUSH_CONN_H
@@ -0,0 +1,226 @@
+#include "sse.h"
+#include <stdio.h>       // snprintf
+#include <stdlib.h>      // strtoull
+#include <sys/epoll.h>   // EPOLLIN, EPOLLOUT
+#include "../log/log.h"
+
+using namespace std;
+
+std::atomic<int> SseConn::count_(0);
+
+EventStream::EventStream(size_t capacity): capacity_(capacity > 0 ? capacity : 1), ring_(capacity_),
+        nextId_(1), skipped_(0) {}
+
+uint64_t EventStream::Publish(const string& data, const string& event) {
+    // 事件部分除id行外在锁外编码；块大小行固定宽度(8位十六进制，前导0)
+    string body;
+    if(!event.empty()) {
+        body += "event: " + event + "\n";
+    }
+    for(size_t start = 0; ; ) {
+        size_t end = data.find('\n', start);
+        size_t len = (end == string::npos ? data.size() : end) - start;
+        if(len > 0 && data[start + len - 1] == '\r') { len--; }
+        body += "data: ";
+        body.append(data, start, len);
+        body += '\n';
+        if(end == string::npos) { break; }
+        start = end + 1;
+    }
+    body += '\n';
+
+    static thread_local vector<shared_ptr<SseConn>> subscribers;
+    uint64_t id;
+    {
+        lock_guard<mutex> locker(mtx_);
+        id = nextId_;
+        string idLine = "id: " + to_string(id) + "\n";
+        size_t bodyLen = idLine.size() + body.size();
+        char size[16];
+        int n = snprintf(size, sizeof(size), "%08zx\r\n", bodyLen);
+        string wire;
+        wire.reserve(n + bodyLen + 2);
+        wire.append(size, n).append(idLine).append(body).append("\r\n", 2);
+
+        Event& slot = ring_[id % capacity_];
+        slot.id = id;
+        slot.wire = make_shared<const string>(move(wire));  // 换下的旧事件在最后一个连接写完后释放
+        slot.bodyOff = n;
+        slot.bodyLen = bodyLen;
+        nextId_++;
+        subscribers.reserve(subscribers_.size());
+        for(const auto& kv: subscribers_) {
+            subscribers.push_back(kv.second);
+        }
+    }
+    // 注册EPOLLOUT(系统调用)在锁外；已经有数据待发送的连接不用再注册
+    for(const auto& conn: subscribers) {
+        conn->Wake();
+    }
+    subscribers.clear();
+    return id;
+}
+
+uint64_t EventStream::LastId() {
+    lock_guard<mutex> locker(mtx_);
+    return nextId_ - 1;
+}
+
+uint64_t EventStream::Read(uint64_t& next, vector<Event>& out, size_t maxCnt) {
+    lock_guard<mutex> locker(mtx_);
+    uint64_t oldest = nextId_ > capacity_ ? nextId_ - capacity_ : 1;
+    uint64_t skipped = 0;
+    if(next < oldest) {
+        skipped = oldest - next;
+        next = oldest;
+        skipped_.fetch_add(skipped, memory_order_relaxed);
+    }
+    for(; next < nextId_ && maxCnt > 0; next++, maxCnt--) {
+        out.push_back(ring_[next % capacity_]);
+    }
+    return skipped;
+}
+
+void EventStream::Subscribe(const shared_ptr<SseConn>& conn) {
+    lock_guard<mutex> locker(mtx_);
+    subscribers_[conn.get()] = conn;
+}
+
+void EventStream::Unsubscribe(SseConn* conn) {
+    lock_guard<mutex> locker(mtx_);
+    subscribers_.erase(conn);
+}
+
+size_t EventStream::Subscribers() {
+    lock_guard<mutex> locker(mtx_);
+    return subscribers_.size();
+}
+
+SseConn::SseConn(int fd, bool chunked, const shared_ptr<EventStream>& stream, const ArmFunc* arm):
+        fd_(fd), chunked_(chunked), stream_(stream), arm_(arm), frontOffset_(0), queuedBytes_(0),
+        next_(1), heartbeat_(false), idle_(false), armed_(false), closed_(false) {
+    assert(stream && arm);
+    count_++;
+}
+
+SseConn::~SseConn() {
+    count_--;
+}
+
+void SseConn::Open(const string& head, const string& lastEventId) {
+    auto owner = make_shared<const string>(head);
+    out_.push_back({ owner, owner->data(), owner->size() });
+    queuedBytes_ = owner->size();
+    uint64_t last = stream_->LastId();
+    next_ = last + 1;
+    if(!lastEventId.empty()) {
+        // 服务器重启后事件id重新开始，客户端带来的id可能比当前最新的还大
+        uint64_t id = strtoull(lastEventId.c_str(), nullptr, 10);
+        if(id < last) { next_ = id + 1; }
+    }
+    stream_->Subscribe(shared_from_this());
+    LOG_DEBUG("SSE[%d] open, next event: %llu", fd_, (unsigned long long)next_);
+}
+
+// 发布者已经把事件写进环里再调用，与Park()在同一把锁下交接：
+// Park()在这之前检查时已经能看到新事件，在这之后则由这里注册EPOLLOUT
+void SseConn::Wake() {
+    lock_guard<mutex> locker(mtx_);
+    if(idle_ && !armed_ && !closed_) {
+        armed_ = true;
+        (*arm_)(fd_, EPOLLIN | EPOLLOUT);
+    }
+}
+
+bool SseConn::Ping() {
+    if(heartbeat_.exchange(true)) {
+        return false;   // 整个心跳间隔内一个字节都没写出去
+    }
+    Wake();
+    return true;
+}
+
+void SseConn::Pull_() {
+    static const shared_ptr<const string> HEARTBEAT = make_shared<const string>("3\r\n:\n\n\r\n");
+    batch_.clear();
+    stream_->Read(next_, batch_, READ_BATCH);
+    for(const EventStream::Event& ev: batch_) {
+        const char* data = ev.wire->data();
+        size_t len = ev.wire->size();
+        if(!chunked_) {
+            data += ev.bodyOff;
+            len = ev.bodyLen;
+        }
+        out_.push_back({ ev.wire, data, len });
+        queuedBytes_ += len;
+    }
+    batch_.clear();
+    if(out_.empty() && heartbeat_) {
+        const char* data = HEARTBEAT->data();
+        size_t len = HEARTBEAT->size();
+        if(!chunked_) {
+            data += 3;
+            len -= 5;
+        }
+        out_.push_back({ HEARTBEAT, data, len });
+        queuedBytes_ += len;
+    }
+}
+
+int SseConn::FillIov(struct iovec* iov, int maxCnt) {
+    if(out_.empty()) { Pull_(); }
+    int cnt = 0;
+    size_t offset = frontOffset_;
+    for(auto it = out_.begin(); it != out_.end() && cnt < maxCnt; ++it, offset = 0) {
+        iov[cnt].iov_base = const_cast<char*>(it->data) + offset;
+        iov[cnt].iov_len = it->len - offset;
+        cnt++;
+    }
+    return cnt;
+}
+
+void SseConn::Consume(size_t len) {
+    if(len > 0) { heartbeat_ = false; }
+    queuedBytes_ -= len;
+    while(len > 0 && !out_.empty()) {
+        size_t left = out_.front().len - frontOffset_;
+        if(len < left) {
+            frontOffset_ += len;
+            return;
+        }
+        len -= left;
+        frontOffset_ = 0;
+        out_.pop_front();
+    }
+}
+
+bool SseConn::HasPending_() {
+    return !out_.empty() || heartbeat_ || stream_->LastId() >= next_;
+}
+
+void SseConn::Park() {
+    lock_guard<mutex> locker(mtx_);
+    idle_ = true;
+    armed_ = HasPending_();
+    (*arm_)(fd_, EPOLLIN | (armed_ ? EPOLLOUT : 0));
+}
+
+bool SseConn::Claim() {
+    lock_guard<mutex> locker(mtx_);
+    if(!idle_) { return false; }
+    idle_ = false;
+    armed_ = false;
+    return true;
+}
+
+void SseConn::Shutdown() {
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(closed_) { return; }
+        closed_ = true;
+    }
+    stream_->Unsubscribe(this);
+    out_.clear();
+    queuedBytes_ = 0;
+    LOG_DEBUG("SSE[%d] closed", fd_);
+}
@@ -0,0 +1,112 @@
+#ifndef SSE_H
+#define SSE_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "pushconn.h"
+
+class SseConn;
+
+// 一路Server-Sent Events：最近的capacity个事件保存在环形缓冲区中，每个事件发布时只编码一次
+// (chunked块的形式，HTTP/1.0连接只发送其中的事件部分)，所有订阅连接的发送队列引用同一块内存
+// 订阅连接只记录下一个要发送的事件id，由各自的工作线程从环中取，落后超过capacity的跳过最老的事件
+class EventStream {
+public:
+    struct Event {
+        uint64_t id;
+        std::shared_ptr<const std::string> wire;    // 块大小行 + 事件 + CRLF
+        uint32_t bodyOff;       // 事件部分(id:/event:/data:行和空行)在wire中的位置
+        uint32_t bodyLen;
+    };
+
+    explicit EventStream(size_t capacity = 1024);
+
+    // 发布一个事件，返回事件id(从1开始递增)；data中的每一行成为一个data:行；可在任何线程调用
+    uint64_t Publish(const std::string& data, const std::string& event = "");
+    uint64_t LastId();
+
+    // 从next开始取最多maxCnt个事件追加到out，next前移；返回因为落后太多被跳过的事件数
+    uint64_t Read(uint64_t& next, std::vector<Event>& out, size_t maxCnt);
+
+    void Subscribe(const std::shared_ptr<SseConn>& conn);
+    void Unsubscribe(SseConn* conn);
+    size_t Subscribers();
+
+    uint64_t Skipped() const { return skipped_.load(std::memory_order_relaxed); }
+
+private:
+    const size_t capacity_;
+    std::mutex mtx_;
+    std::vector<Event> ring_;   // id为k的事件在ring_[k % capacity_]
+    uint64_t nextId_;
+    std::unordered_map<SseConn*, std::shared_ptr<SseConn>> subscribers_;
+    std::atomic<uint64_t> skipped_;
+};
+
+// SSE长连接：请求的路径注册在HttpConn::sseStreams中时由HttpConn创建，响应永不结束
+// 不受空闲超时关闭，定时器到期时发心跳注释行；上一个心跳还没写出时认为对端已失联
+class SseConn: public PushConn, public std::enable_shared_from_this<SseConn> {
+public:
+    SseConn(int fd, bool chunked, const std::shared_ptr<EventStream>& stream, const ArmFunc* arm);
+    ~SseConn() override;
+
+    // 排入响应头并订阅；lastEventId非空时从它之后的事件开始发送(断线重连)，否则只发送新事件
+    void Open(const std::string& head, const std::string& lastEventId);
+    void Wake();    // 有新事件：连接空闲时注册EPOLLOUT
+
+    void Process(Buffer& readBuff) override { readBuff.RetrieveAll(); }    // 客户端不应再发送数据
+    int FillIov(struct iovec* iov, int maxCnt) override;
+    void Consume(size_t len) override;
+    size_t ToWriteBytes() override { return queuedBytes_; }
+    bool IsDone() override { return false; }
+    void Park() override;
+    bool Claim() override;
+    void Shutdown() override;
+    bool Ping() override;
+    int PingInterval(int idleMs) const override { return idleMs < HEARTBEAT_MS ? idleMs : HEARTBEAT_MS; }
+
+    static int Count() { return count_.load(std::memory_order_relaxed); }
+
+    static const int HEARTBEAT_MS = 15000;  // 代理通常在30~60秒无数据时断开
+    static const size_t READ_BATCH = 64;    // 每次从环中取的事件数
+
+private:
+    struct Segment {
+        std::shared_ptr<const std::string> owner;
+        const char* data;
+        size_t len;
+    };
+
+    void Pull_();   // 发送队列空时从环中取新事件或心跳
+    bool HasPending_();
+
+    int fd_;
+    bool chunked_;
+    std::shared_ptr<EventStream> stream_;
+    const ArmFunc* arm_;
+
+    // 只在持有连接的工作线程中访问
+    std::deque<Segment> out_;
+    size_t frontOffset_;
+    size_t queuedBytes_;
+    uint64_t next_;         // 下一个要发送的事件id
+    std::vector<EventStream::Event> batch_;
+
+    std::atomic<bool> heartbeat_;   // 定时器要求发心跳，写出任何数据后清除
+
+    std::mutex mtx_;        // 保护归属状态
+    bool idle_;             // 在epoll中等待事件，没有工作线程持有
+    bool armed_;            // 空闲期间已经注册过EPOLLOUT
+    bool closed_;
+
+    static std::atomic<int> count_;
+};
+
+#endif //SSE_H
@@ -0,0 +1,386 @@
+#include "websocket.h"
+#include <string.h>      // strcasecmp, strcasestr
+#include <sys/epoll.h>   // EPOLLIN, EPOLLOUT
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "broadcaster.h"
+#include "../log/log.h"
+
+using namespace std;
+
+std::atomic<int> WebSocketConn::count_(0);
+
+static const char WS_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// 握手字段的名字大小写不固定(Sec-WebSocket-Key / sec-websocket-key)
+static const string& FindHeader(const HttpRequest& request, const char* name) {
+    static const string empty;
+    for(const auto& kv: request.Headers()) {
+        if(strcasecmp(kv.first.c_str(), name) == 0) { return kv.second; }
+    }
+    return empty;
+}
+
+static inline uint32_t Rol(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+// Sec-WebSocket-Accept只需要对60字节做一次SHA-1，不为它依赖OpenSSL(WITH_TLS=0时也能用)
+static void Sha1(const string& in, uint8_t digest[20]) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    string msg = in;
+    uint64_t bits = static_cast<uint64_t>(in.size()) * 8;
+    msg += '\x80';
+    while(msg.size() % 64 != 56) { msg += '\0'; }
+    for(int i = 7; i >= 0; i--) { msg += static_cast<char>(bits >> (i * 8)); }
+    for(size_t off = 0; off < msg.size(); off += 64) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(msg.data()) + off;
+        uint32_t w[80];
+        for(int i = 0; i < 16; i++) {
+            w[i] = p[i * 4] << 24 | p[i * 4 + 1] << 16 | p[i * 4 + 2] << 8 | p[i * 4 + 3];
+        }
+        for(int i = 16; i < 80; i++) {
+            w[i] = Rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for(int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if(i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+            else if(i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+            else if(i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+            uint32_t temp = Rol(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = Rol(b, 30); b = a; a = temp;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for(int i = 0; i < 5; i++) {
+        digest[i * 4] = h[i] >> 24;
+        digest[i * 4 + 1] = h[i] >> 16;
+        digest[i * 4 + 2] = h[i] >> 8;
+        digest[i * 4 + 3] = h[i];
+    }
+}
+
+static string Base64Encode(const uint8_t* data, size_t len) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    string out;
+    for(size_t i = 0; i < len; i += 3) {
+        uint32_t n = data[i] << 16;
+        if(i + 1 < len) { n |= data[i + 1] << 8; }
+        if(i + 2 < len) { n |= data[i + 2]; }
+        out += table[(n >> 18) & 63];
+        out += table[(n >> 12) & 63];
+        out += i + 1 < len ? table[(n >> 6) & 63] : '=';
+        out += i + 2 < len ? table[n & 63] : '=';
+    }
+    return out;
+}
+
+WebSocketConn::WebSocketConn(int fd, const sockaddr_in& addr, const WsHandler* handler, const ArmFunc* arm):
+        fd_(fd), addr_(addr), handler_(handler), arm_(arm), msgOpcode_(0), closeReceived_(false),
+        failed_(false), closeSent_(false), awaitingPong_(false), dropped_(0), frontOffset_(0),
+        queuedBytes_(0), idle_(false), closed_(false) {
+    assert(handler && arm);
+    count_++;
+}
+
+WebSocketConn::~WebSocketConn() {
+    count_--;
+}
+
+bool WebSocketConn::IsUpgrade(const HttpRequest& request) {
+    return strcasestr(FindHeader(request, "Upgrade").c_str(), "websocket") != nullptr;
+}
+
+bool WebSocketConn::IsValidHandshake(const HttpRequest& request) {
+    return request.method() == "GET" && request.version() == "1.1" &&
+           strcasestr(FindHeader(request, "Connection").c_str(), "upgrade") != nullptr &&
+           FindHeader(request, "Sec-WebSocket-Version") == "13" &&
+           FindHeader(request, "Sec-WebSocket-Key").size() == 24;     // 16字节随机数的base64
+}
+
+string WebSocketConn::AcceptKey(const string& key) {
+    uint8_t digest[20];
+    Sha1(key + WS_GUID, digest);
+    return Base64Encode(digest, sizeof(digest));
+}
+
+void WebSocketConn::Open(const HttpRequest& request) {
+    string resp = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                  "Sec-WebSocket-Accept: " + AcceptKey(FindHeader(request, "Sec-WebSocket-Key")) + "\r\n\r\n";
+    Queue_(make_shared<const string>(move(resp)), true);
+    LOG_DEBUG("WebSocket[%d] open %s", fd_, request.path().c_str());
+    if(handler_->onOpen) {
+        handler_->onOpen(shared_from_this(), request);
+    }
+}
+
+void WebSocketConn::Unmask(char* data, size_t len, const uint8_t mask[4]) {
+    // 掩码按4字节循环，每次处理4的倍数字节时相位不变，整块异或同一个重复的掩码
+    uint32_t m;
+    memcpy(&m, mask, 4);
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i m256 = _mm256_set1_epi32(m);
+    for(; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(v, m256));
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i m128 = _mm_set1_epi32(m);
+    for(; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(v, m128));
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t m128 = vreinterpretq_u8_u32(vdupq_n_u32(m));
+    for(; i + 16 <= len; i += 16) {
+        uint8_t* p = reinterpret_cast<uint8_t*>(data + i);
+        vst1q_u8(p, veorq_u8(vld1q_u8(p), m128));
+    }
+#endif
+    const uint64_t m64 = static_cast<uint64_t>(m) << 32 | m;
+    for(; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        v ^= m64;
+        memcpy(data + i, &v, 8);
+    }
+    for(; i < len; i++) {
+        data[i] ^= mask[i & 3];
+    }
+}
+
+WsFrame WebSocketConn::MakeFrame(int opcode, const char* data, size_t len) {
+    string frame;
+    frame.reserve(len + 10);
+    frame += static_cast<char>(0x80 | opcode);     // FIN，不分片
+    if(len < 126) {
+        frame += static_cast<char>(len);
+    } else if(len <= 0xFFFF) {
+        frame += static_cast<char>(126);
+        frame += static_cast<char>(len >> 8);
+        frame += static_cast<char>(len);
+    } else {
+        frame += static_cast<char>(127);
+        for(int i = 7; i >= 0; i--) { frame += static_cast<char>(static_cast<uint64_t>(len) >> (i * 8)); }
+    }
+    frame.append(data, len);
+    return make_shared<const string>(move(frame));
+}
+
+void WebSocketConn::Process(Buffer& readBuff) {
+    while(!closeReceived_ && !failed_ && readBuff.ReadableBytes() >= 2) {
+        size_t avail = readBuff.ReadableBytes();
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(readBuff.Peek());
+        bool fin = p[0] & 0x80;
+        int opcode = p[0] & 0x0F;
+        uint64_t len = p[1] & 0x7F;
+        size_t head = 2;
+        if(len == 126) {
+            if(avail < 4) { break; }
+            len = p[2] << 8 | p[3];
+            head = 4;
+        } else if(len == 127) {
+            if(avail < 10) { break; }
+            len = 0;
+            for(int i = 2; i < 10; i++) { len = len << 8 | p[i]; }
+            head = 10;
+            if(len >> 63) {     // 64位长度的最高位必须为0
+                Fail_(PROTOCOL_ERROR);
+                break;
+            }
+        }
+        // 没有协商扩展，RSV必须为0；客户端的帧必须加掩码
+        if((p[0] & 0x70) || !(p[1] & 0x80) || (opcode > BINARY && opcode < CLOSE) || opcode > PONG) {
+            Fail_(PROTOCOL_ERROR);
+            break;
+        }
+        if((opcode & 0x8) && (!fin || len > 125)) {     // 控制帧不能分片，负载不超过125字节
+            Fail_(PROTOCOL_ERROR);
+            break;
+        }
+        // 比较时不做可能溢出的加法
+        if(!(opcode & 0x8) && (len > MAX_MESSAGE || len > MAX_MESSAGE - message_.size())) {
+            Fail_(MESSAGE_TOO_BIG);
+            break;
+        }
+        if(avail < head + 4 || len > avail - head - 4) { break; }   // 帧没有收完
+        uint8_t mask[4];
+        memcpy(mask, p + head, 4);
+        char* payload = const_cast<char*>(readBuff.Peek()) + head + 4;
+        Unmask(payload, len, mask);
+        bool ok = HandleFrame_(opcode, fin, payload, len);
+        readBuff.Retrieve(head + 4 + len);
+        if(!ok) { break; }
+    }
+    if(closeReceived_ || failed_) {
+        readBuff.RetrieveAll();     // 关闭之后的数据不再处理
+    }
+}
+
+bool WebSocketConn::HandleFrame_(int opcode, bool fin, char* payload, size_t len) {
+    awaitingPong_ = false;      // 收到任何帧都说明对端还在
+    switch(opcode) {
+    case PING:
+        Queue_(MakeFrame(PONG, payload, len), true);
+        return true;
+    case PONG:
+        return true;
+    case CLOSE: {
+        closeReceived_ = true;
+        if(len == 1) { return Fail_(PROTOCOL_ERROR); }
+        // 回一个关闭帧(带上对方的状态码)，写完后关闭连接
+        if(!closeSent_.exchange(true)) {
+            Queue_(MakeFrame(CLOSE, payload, len >= 2 ? 2 : 0), true);
+        }
+        return false;
+    }
+    default:
+        break;
+    }
+    if(opcode == CONTINUATION ? msgOpcode_ == 0 : msgOpcode_ != 0) {
+        return Fail_(PROTOCOL_ERROR);   // 分片顺序错误
+    }
+    if(opcode != CONTINUATION) { msgOpcode_ = opcode; }
+    message_.append(payload, len);
+    if(!fin) { return true; }
+    int msgOpcode = msgOpcode_;
+    msgOpcode_ = 0;
+    if(!closeSent_ && handler_->onMessage) {
+        handler_->onMessage(shared_from_this(), msgOpcode, message_);
+    }
+    if(message_.capacity() > 64 * 1024) {
+        string().swap(message_);    // 大消息之后不长期占着内存
+    } else {
+        message_.clear();
+    }
+    return true;
+}
+
+bool WebSocketConn::Fail_(int code) {
+    LOG_DEBUG("WebSocket[%d] close with %d", fd_, code);
+    failed_ = true;
+    Close(code);
+    return false;
+}
+
+bool WebSocketConn::Send(const string& msg, int opcode) {
+    return Queue_(MakeFrame(opcode, msg.data(), msg.size()), false);
+}
+
+bool WebSocketConn::SendFrame(const WsFrame& frame) {
+    return Queue_(frame, false);
+}
+
+void WebSocketConn::Close(int code) {
+    if(closeSent_.exchange(true)) { return; }
+    char payload[2] = { static_cast<char>(code >> 8), static_cast<char>(code) };
+    Queue_(MakeFrame(CLOSE, payload, 2), true);
+}
+
+bool WebSocketConn::Ping() {
+    if(closeSent_ || awaitingPong_.exchange(true)) {
+        return false;
+    }
+    Queue_(MakeFrame(PING, nullptr, 0), true);
+    return true;
+}
+
+// 控制帧(pong/close/ping)不受HIGH_WATER限制，也不会在关闭帧之后被丢弃
+bool WebSocketConn::Queue_(const WsFrame& frame, bool control) {
+    lock_guard<mutex> locker(mtx_);
+    if(closed_) { return false; }
+    if(!control && (closeSent_ || queuedBytes_ >= HIGH_WATER)) {
+        dropped_.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    bool wasEmpty = out_.empty();
+    out_.push_back(frame);
+    queuedBytes_ += frame->size();
+    if(idle_ && wasEmpty) {
+        // 连接在epoll中只等EPOLLIN，加上EPOLLOUT；持有连接的工作线程在Park()时自己检查
+        (*arm_)(fd_, EPOLLIN | EPOLLOUT);
+    }
+    return true;
+}
+
+int WebSocketConn::FillIov(struct iovec* iov, int maxCnt) {
+    lock_guard<mutex> locker(mtx_);
+    int cnt = 0;
+    size_t offset = frontOffset_;
+    // 其他线程只在队尾追加，deque的push_back不会移动已有元素，帧本身只读，解锁后iov仍然有效
+    for(auto it = out_.begin(); it != out_.end() && cnt < maxCnt; ++it, offset = 0) {
+        iov[cnt].iov_base = const_cast<char*>((*it)->data()) + offset;
+        iov[cnt].iov_len = (*it)->size() - offset;
+        cnt++;
+    }
+    return cnt;
+}
+
+void WebSocketConn::Consume(size_t len) {
+    lock_guard<mutex> locker(mtx_);
+    queuedBytes_ -= len;
+    while(len > 0 && !out_.empty()) {
+        size_t left = out_.front()->size() - frontOffset_;
+        if(len < left) {
+            frontOffset_ += len;
+            return;
+        }
+        len -= left;
+        frontOffset_ = 0;
+        out_.pop_front();   // 最后一个引用释放时帧的内存才释放
+    }
+}
+
+size_t WebSocketConn::ToWriteBytes() {
+    lock_guard<mutex> locker(mtx_);
+    return queuedBytes_;
+}
+
+bool WebSocketConn::IsDone() {
+    return closeSent_ && (closeReceived_ || failed_) && ToWriteBytes() == 0;
+}
+
+void WebSocketConn::Park() {
+    lock_guard<mutex> locker(mtx_);
+    idle_ = true;
+    // 发送队列积压时先不读：对端只发不收时ping的回复、应用的回复都会继续堆积
+    uint32_t events = (queuedBytes_ < HIGH_WATER && !closeReceived_) ? EPOLLIN : 0;
+    if(queuedBytes_ > 0) { events |= EPOLLOUT; }
+    (*arm_)(fd_, events);
+}
+
+bool WebSocketConn::Claim() {
+    lock_guard<mutex> locker(mtx_);
+    if(!idle_) { return false; }
+    idle_ = false;
+    return true;
+}
+
+void WebSocketConn::Shutdown() {
+    vector<string> topics;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(closed_) { return; }
+        closed_ = true;
+        out_.clear();
+        queuedBytes_ = 0;
+        topics.swap(topics_);
+    }
+    // 设置closed_之后Subscribe()不会再加入这个连接
+    Broadcaster* broadcaster = Broadcaster::Instance();
+    {
+        lock_guard<mutex> locker(broadcaster->mtx_);
+        for(const string& topic: topics) {
+            broadcaster->Remove_(topic, this);
+        }
+    }
+    LOG_DEBUG("WebSocket[%d] closed, dropped: %llu", fd_, (unsigned long long)Dropped());
+    if(handler_->onClose) {
+        handler_->onClose(shared_from_this());
+    }
+}
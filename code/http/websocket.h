@@ -0,0 +1,115 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+#include <sys/uio.h>     // iovec
+#include <arpa/inet.h>   // sockaddr_in
+
+#include "../buffer/buffer.h"
+#include "httprequest.h"
+#include "pushconn.h"
+
+class WebSocketConn;
+typedef std::shared_ptr<WebSocketConn> WsConnPtr;
+typedef std::shared_ptr<const std::string> WsFrame;     // 编码好的完整帧，多个连接的发送队列共用
+
+// 注册在路径上的WebSocket应用，回调都在工作线程中执行
+struct WsHandler {
+    std::function<void(const WsConnPtr&, const HttpRequest&)> onOpen;  // 握手完成，可以在这里订阅主题
+    std::function<void(const WsConnPtr&, int opcode, const std::string& msg)> onMessage;  // 一条完整的消息
+    std::function<void(const WsConnPtr&)> onClose;
+};
+
+// WebSocket(RFC 6455)协议层：HTTP/1.1请求带Upgrade: websocket且路径注册了WsHandler时由HttpConn创建
+// 发送队列的每段引用一个共享的只读帧，广播时一条消息只编码一次；发布消息、定时器发ping的线程会追加帧
+class WebSocketConn: public PushConn, public std::enable_shared_from_this<WebSocketConn> {
+public:
+    enum OPCODE { CONTINUATION = 0x0, TEXT = 0x1, BINARY = 0x2, CLOSE = 0x8, PING = 0x9, PONG = 0xA };
+
+    enum CLOSE_CODE {
+        NORMAL = 1000, GOING_AWAY = 1001, PROTOCOL_ERROR = 1002, UNSUPPORTED_DATA = 1003,
+        NO_STATUS = 1005, POLICY_VIOLATION = 1008, MESSAGE_TOO_BIG = 1009,
+    };
+
+    WebSocketConn(int fd, const sockaddr_in& addr, const WsHandler* handler, const ArmFunc* arm);
+    ~WebSocketConn() override;
+
+    // 请求是否要求升级到WebSocket；是的话检查握手字段，不合法的请求回400
+    static bool IsUpgrade(const HttpRequest& request);
+    static bool IsValidHandshake(const HttpRequest& request);
+    static std::string AcceptKey(const std::string& key);   // Sec-WebSocket-Accept的值
+
+    // 排入101响应并回调onOpen，之后的数据按帧处理
+    void Open(const HttpRequest& request);
+    // 处理readBuff中完整的帧
+    void Process(Buffer& readBuff) override;
+
+    // 发送一条消息，发送队列超过HIGH_WATER或连接正在关闭时丢弃并返回false；可在任何线程调用
+    bool Send(const std::string& msg, int opcode = TEXT);
+    bool SendFrame(const WsFrame& frame);
+    void Close(int code = NORMAL);      // 发关闭帧，写完后关闭连接
+    // 定时器到期时调用：上一个ping之后没有收到任何帧返回false(对端已失联)，否则发ping
+    bool Ping() override;
+
+    static WsFrame MakeFrame(int opcode, const char* data, size_t len);    // 服务端的帧不加掩码
+    // 就地去掩码：按平台使用AVX2/SSE2/NEON，每次处理16~32字节，剩余部分按8字节和单字节处理
+    static void Unmask(char* data, size_t len, const uint8_t mask[4]);
+
+    int FillIov(struct iovec* iov, int maxCnt) override;
+    void Consume(size_t len) override;
+    size_t ToWriteBytes() override;
+    bool IsDone() override;     // 关闭握手已完成(或协议错误)且关闭帧已写出
+    void Park() override;       // 发送队列非空时等EPOLLOUT，超过HIGH_WATER时暂停读
+    bool Claim() override;
+    void Shutdown() override;   // 同时退订所有主题
+
+    int GetFd() const { return fd_; }
+    sockaddr_in GetAddr() const { return addr_; }
+    uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    static int Count() { return count_.load(std::memory_order_relaxed); }
+
+    static const size_t MAX_MESSAGE = 1024 * 1024;  // 接收消息(合并分片后)的上限
+    static const size_t HIGH_WATER = 256 * 1024;    // 发送队列超过它时丢弃新消息、暂停读
+
+private:
+    bool HandleFrame_(int opcode, bool fin, char* payload, size_t len);
+    bool Fail_(int code);   // 协议错误：发关闭帧，返回false
+    bool Queue_(const WsFrame& frame, bool control);
+
+    int fd_;
+    sockaddr_in addr_;
+    const WsHandler* handler_;
+    const ArmFunc* arm_;
+
+    // 接收：只在持有连接的工作线程中访问
+    int msgOpcode_;         // 正在接收的分片消息的类型，0表示没有
+    std::string message_;
+    bool closeReceived_;
+    bool failed_;           // 协议错误，已发关闭帧
+
+    std::atomic<bool> closeSent_;
+    std::atomic<bool> awaitingPong_;
+    std::atomic<uint64_t> dropped_;
+
+    std::mutex mtx_;        // 保护下面的发送队列和归属状态
+    std::deque<WsFrame> out_;
+    size_t frontOffset_;    // 队首一帧已写出的字节数
+    size_t queuedBytes_;
+    bool idle_;             // 在epoll中等待事件，没有工作线程持有
+    bool closed_;
+    std::vector<std::string> topics_;   // 订阅的主题，关闭时退订
+
+    friend class Broadcaster;
+
+    static std::atomic<int> count_;
+};
+
+#endif //WEBSOCKET_H
@@ -0,0 +1,193 @@
+#include "accesslog.h"
+#include <arpa/inet.h>  // inet_ntop
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+using namespace std;
+
+AccessLog::AccessLog() {
+    isOpen_ = false;
+    format_ = CLF;
+    sampleThreshold_ = UINT32_MAX;
+    dropped_ = 0;
+    fp_ = nullptr;
+    deque_ = nullptr;
+    writeThread_ = nullptr;
+}
+
+AccessLog::~AccessLog() {
+    if(writeThread_ && writeThread_->joinable()) {
+        while(!deque_->empty()) {
+            deque_->flush();
+        };
+        deque_->Close();
+        writeThread_->join();
+    }
+    if(fp_) {
+        lock_guard<mutex> locker(mtx_);
+        fflush(fp_);
+        fclose(fp_);
+    }
+}
+
+AccessLog* AccessLog::Instance() {
+    static AccessLog inst;
+    return &inst;
+}
+
+void AccessLog::FlushLogThread() {
+    AccessLog::Instance()->AsyncWrite_();
+}
+
+void AccessLog::init(const char* path, const char* fileName,
+                     int format, double sampleRate, int maxQueueCapacity) {
+    assert(maxQueueCapacity > 0);
+    format_ = format;
+    if(sampleRate >= 1.0) { sampleThreshold_ = UINT32_MAX; }
+    else if(sampleRate <= 0.0) { sampleThreshold_ = 0; }
+    else { sampleThreshold_ = static_cast<uint32_t>(sampleRate * UINT32_MAX); }
+
+    char name[LOG_NAME_LEN] = {0};
+    snprintf(name, LOG_NAME_LEN - 1, "%s/%s", path, fileName);
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(fp_) {
+            fflush(fp_);
+            fclose(fp_);
+        }
+        fp_ = fopen(name, "a");
+        if(fp_ == nullptr) {
+            mkdir(path, 0777);
+            fp_ = fopen(name, "a");
+        }
+        assert(fp_ != nullptr);
+    }
+    if(!deque_) {
+        deque_.reset(new BlockDeque<std::string>(maxQueueCapacity));
+        writeThread_.reset(new thread(FlushLogThread));
+    }
+    isOpen_ = true;
+}
+
+bool AccessLog::Sample() {
+    if(sampleThreshold_ == UINT32_MAX) { return true; }
+    if(sampleThreshold_ == 0) { return false; }
+    // 每个线程独立的xorshift随机数，避免共享状态
+    static thread_local uint32_t seed = static_cast<uint32_t>(
+            hash<thread::id>()(this_thread::get_id())) | 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed < sampleThreshold_;
+}
+
+// 转义字符串中的引号、反斜杠和控制字符，防止日志注入
+static void AppendEscaped_(string& out, const char* str) {
+    if(str == nullptr || *str == '\0') {
+        out += '-';
+        return;
+    }
+    for(const char* p = str; *p; p++) {
+        unsigned char ch = static_cast<unsigned char>(*p);
+        if(ch == '"' || ch == '\\') {
+            out += '\\';
+            out += ch;
+        } else if(ch < 0x20 || ch == 0x7f) {
+            char hex[8];
+            snprintf(hex, sizeof(hex), "\\u%04x", ch);
+            out += hex;
+        } else {
+            out += ch;
+        }
+    }
+}
+
+void AccessLog::Format_(const Record& rec, string& line) {
+    // 时间字符串按秒缓存，同一秒内的记录不再重复格式化
+    static thread_local time_t lastSec = 0;
+    static thread_local char clfTime[64];
+    static thread_local char isoTime[64];
+    time_t now = time(nullptr);
+    if(now != lastSec) {
+        struct tm t;
+        localtime_r(&now, &t);
+        strftime(clfTime, sizeof(clfTime), "%d/%b/%Y:%H:%M:%S %z", &t);
+        strftime(isoTime, sizeof(isoTime), "%Y-%m-%dT%H:%M:%S%z", &t);
+        lastSec = now;
+    }
+
+    char ip[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &rec.addr, ip, sizeof(ip));
+    char num[96];
+
+    line.reserve(256);
+    if(format_ == JSON) {
+        line += "{\"time\":\"";
+        line += isoTime;
+        line += "\",\"ip\":\"";
+        line += ip;
+        line += "\",\"method\":\"";
+        AppendEscaped_(line, rec.method);
+        line += "\",\"path\":\"";
+        AppendEscaped_(line, rec.path);
+        line += "\",\"version\":\"";
+        AppendEscaped_(line, rec.version);
+        snprintf(num, sizeof(num), "\",\"status\":%d,\"bytes\":%zu,\"duration_us\":%lld",
+                 rec.status, rec.bytes, static_cast<long long>(rec.durationUs));
+        line += num;
+        line += ",\"referer\":\"";
+        AppendEscaped_(line, rec.referer);
+        line += "\",\"user_agent\":\"";
+        AppendEscaped_(line, rec.userAgent);
+        line += "\"}\n";
+        return;
+    }
+
+    // 127.0.0.1 - - [10/Oct/2000:13:55:36 +0800] "GET /index.html HTTP/1.1" 200 2326
+    line += ip;
+    line += " - - [";
+    line += clfTime;
+    line += "] \"";
+    AppendEscaped_(line, rec.method);
+    line += ' ';
+    AppendEscaped_(line, rec.path);
+    line += " HTTP/";
+    AppendEscaped_(line, rec.version);
+    snprintf(num, sizeof(num), "\" %d %zu", rec.status, rec.bytes);
+    line += num;
+    if(format_ == COMBINED) {
+        line += " \"";
+        AppendEscaped_(line, rec.referer);
+        line += "\" \"";
+        AppendEscaped_(line, rec.userAgent);
+        line += '"';
+    }
+    snprintf(num, sizeof(num), " %lld\n", static_cast<long long>(rec.durationUs));
+    line += num;
+}
+
+void AccessLog::write(const Record& rec) {
+    if(!IsOpen()) { return; }
+    string line;
+    Format_(rec, line);
+    // 工作线程不能因为访问日志阻塞，队列满时直接丢弃并计数(判断和入队在同一次加锁中)
+    if(!deque_->try_push_back(move(line))) {
+        dropped_.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void AccessLog::flush() {
+    if(deque_) { deque_->flush(); }
+    lock_guard<mutex> locker(mtx_);
+    if(fp_) { fflush(fp_); }
+}
+
+void AccessLog::AsyncWrite_() {
+    string str = "";
+    while(deque_->pop(str)) {
+        lock_guard<mutex> locker(mtx_);
+        fputs(str.c_str(), fp_);
+        if(deque_->empty()) { fflush(fp_); }    // 队列清空时落盘，批量写入
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <memory>
+#include <stdint.h>
+#include <sys/stat.h>         // mkdir
+#include <netinet/in.h>       // in_addr
+#include "blockqueue.h"
+
+// 访问日志：每个完成的请求一条记录，单独的文件和异步写线程，支持按比例采样
+class AccessLog {
+public:
+    enum FORMAT {
+        CLF = 0,        // Common Log Format + 耗时(us)
+        COMBINED,       // Combined Log Format(带Referer和User-Agent) + 耗时(us)
+        JSON,           // 每行一个JSON对象
+    };
+
+    struct Record {
+        struct in_addr addr;    // 客户端地址
+        const char* method;
+        const char* path;
+        const char* version;
+        const char* referer;
+        const char* userAgent;
+        int status;             // 响应状态码
+        size_t bytes;           // 响应字节数(头+体)
+        int64_t durationUs;     // 请求耗时(读到请求 -> 写完响应)
+    };
+
+    void init(const char* path = "./log", const char* fileName = "access.log",
+              int format = CLF, double sampleRate = 1.0, int maxQueueCapacity = 1024);
+
+    static AccessLog* Instance();
+    static void FlushLogThread();
+
+    bool IsOpen() { return isOpen_.load(std::memory_order_relaxed); }
+    bool Sample();  // 按采样率决定本次请求是否记录
+
+    void write(const Record& rec);
+    void flush();
+
+    size_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    AccessLog();
+    virtual ~AccessLog();
+    void AsyncWrite_();
+    void Format_(const Record& rec, std::string& line);
+
+    static const int LOG_NAME_LEN = 256;
+
+    std::atomic<bool> isOpen_;
+    int format_;
+    uint32_t sampleThreshold_;  // 采样阈值，随机数小于该值才记录，UINT32_MAX表示全部记录
+    std::atomic<size_t> dropped_;   // 队列满被丢弃的记录数
+
+    FILE* fp_;
+    std::unique_ptr<BlockDeque<std::string>> deque_;
+    std::unique_ptr<std::thread> writeThread_;
+    std::mutex mtx_;
+};
+
+#endif //ACCESS_LOG_H
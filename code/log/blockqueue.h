@@ -5,6 +5,7 @@
 #include <deque>
 #include <condition_variable>
 #include <sys/time.h>
+#include <assert.h>
 
 template<class T>
 class BlockDeque {
@@ -31,6 +32,9 @@ public:
 
     void push_back(const T &item);
 
+    // 不阻塞：队列满(或已关闭)时返回false
+    bool try_push_back(T &&item);
+
     void push_front(const T &item);
 
     bool pop(T &item);
@@ -121,6 +125,19 @@ void BlockDeque<T>::push_back(const T &item) {
     condConsumer_.notify_one();
 }
 
+template<class T>
+bool BlockDeque<T>::try_push_back(T &&item) {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(isClose_ || deq_.size() >= capacity_) {
+            return false;
+        }
+        deq_.push_back(std::move(item));
+    }
+    condConsumer_.notify_one();
+    return true;
+}
+
 template<class T>
 void BlockDeque<T>::push_front(const T &item) {
     std::unique_lock<std::mutex> locker(mtx_);
@@ -9,6 +9,8 @@ Log::Log() {
     deque_ = nullptr;
     toDay_ = 0;
     fp_ = nullptr;
+    isOpen_ = false;
+    level_ = 1;
 }
 
 Log::~Log() {
@@ -27,13 +29,11 @@ Log::~Log() {
 }
 
 int Log::GetLevel() {
-    lock_guard<mutex> locker(mtx_);
-    return level_;
+    return level_.load(std::memory_order_relaxed);
 }
 
 void Log::SetLevel(int level) {
-    lock_guard<mutex> locker(mtx_);
-    level_ = level;
+    level_.store(level, std::memory_order_relaxed);
 }
 
 void Log::init(int level = 1, const char* path, const char* suffix,
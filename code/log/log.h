@@ -2,6 +2,7 @@
 #define LOG_H
 
 #include <mutex>
+#include <atomic>
 #include <string>
 #include <thread>
 #include <sys/time.h>
@@ -12,6 +13,12 @@
 #include "blockqueue.h"
 #include "../buffer/buffer.h"
 
+/* 编译期最低日志等级，低于该等级的LOG_XXX调用直接被编译器消除
+ * 例如 make LOG_MIN_LEVEL=1 去掉所有LOG_DEBUG */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
 class Log {
 public:
     void init(int level, const char* path = "./log",
@@ -26,7 +33,13 @@ public:
 
     int GetLevel();
     void SetLevel(int level);
-    bool IsOpen() { return isOpen_; }
+    bool IsOpen() { return isOpen_.load(std::memory_order_relaxed); }
+    size_t QueueSize() { return isAsync_ && deque_ ? deque_->size() : 0; }  // 异步队列中待写的日志数
+
+    // 热路径上的等级判断，不加锁
+    bool IsEnabled(int level) {
+        return IsOpen() && level_.load(std::memory_order_relaxed) <= level;
+    }
     
 private:
     Log();
@@ -47,10 +60,10 @@ private:
     int lineCount_;
     int toDay_;
 
-    bool isOpen_;
+    std::atomic<bool> isOpen_;
  
     Buffer buff_;
-    int level_;
+    std::atomic<int> level_;
     bool isAsync_;
 
     FILE* fp_;
@@ -60,14 +73,15 @@ private:
 };
 
 // level = 1
-// LOG_DEBUG  0 <= 1  y
+// LOG_DEBUG  0 <= 1  n
 // LOG_INFO   1 <= 1  y
-// LOG_WARN   2 <= 1  n
-// LOG_ERROR  3 <= 1  n
+// LOG_WARN   2 <= 1  y
+// LOG_ERROR  3 <= 1  y
+// 参数只在等级开启时才会求值(惰性求值)，低于LOG_MIN_LEVEL的分支是常量false，会被整体消除
 #define LOG_BASE(level, format, ...) \
     do {\
         Log* log = Log::Instance();\
-        if (log->IsOpen() && log->GetLevel() <= level) {\
+        if ((level) >= LOG_MIN_LEVEL && log->IsEnabled(level)) {\
             log->write(level, format, ##__VA_ARGS__); \
             log->flush();\
         }\
@@ -0,0 +1,138 @@
+#include "slowlog.h"
+#include <arpa/inet.h>  // inet_ntop
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/stat.h>   // mkdir
+#include <assert.h>
+
+using namespace std;
+
+SlowLog::SlowLog() {
+    isOpen_ = false;
+    thresholdUs_ = 0;
+    maxPerSec_ = 0;
+    capacity_ = 0;
+    fd_ = -1;
+    next_ = 0;
+    windowSec_ = 0;
+    windowCount_ = 0;
+    written_ = 0;
+    suppressed_ = 0;
+}
+
+SlowLog::~SlowLog() {
+    if(fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+SlowLog* SlowLog::Instance() {
+    static SlowLog inst;
+    return &inst;
+}
+
+void SlowLog::init(int thresholdMs, int maxPerSec, const char* path,
+                   const char* fileName, int capacity) {
+    assert(thresholdMs >= 0 && maxPerSec > 0 && capacity > 0);
+    char name[256] = {0};
+    snprintf(name, sizeof(name) - 1, "%s/%s", path, fileName);
+
+    lock_guard<mutex> locker(mtx_);
+    if(fd_ >= 0) {
+        close(fd_);
+    }
+    fd_ = open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd_ < 0) {
+        mkdir(path, 0777);
+        fd_ = open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
+    assert(fd_ >= 0);
+    thresholdUs_ = static_cast<int64_t>(thresholdMs) * 1000;
+    maxPerSec_ = maxPerSec;
+    capacity_ = capacity;
+    // 上次没写满时接着往后写，写满过则从头覆盖(每条记录带时间，sort后即为时间顺序)
+    struct stat st;
+    next_ = 0;
+    if(fstat(fd_, &st) == 0 && st.st_size / SLOT_SIZE < capacity_) {
+        next_ = static_cast<int>(st.st_size / SLOT_SIZE);
+    }
+    isOpen_ = true;
+}
+
+// 两个时间点之间的微秒数，任一时间点没有记录时为-1
+static long long Span_(const RequestPhases::TimePoint& from, const RequestPhases::TimePoint& to) {
+    if(from == RequestPhases::TimePoint() || to == RequestPhases::TimePoint()) {
+        return -1;
+    }
+    return chrono::duration_cast<chrono::microseconds>(to - from).count();
+}
+
+void SlowLog::Format_(const Record& rec, char* slot) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    struct tm t;
+    localtime_r(&now.tv_sec, &t);
+    char ip[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &rec.addr, ip, sizeof(ip));
+
+    // 路径截断并把空白和控制字符替换掉，保证一条记录一行
+    char path[160];
+    size_t i = 0;
+    for(const char* p = rec.path ? rec.path : "-"; *p && i < sizeof(path) - 1; p++, i++) {
+        unsigned char ch = static_cast<unsigned char>(*p);
+        path[i] = (ch <= 0x20 || ch == 0x7f) ? '_' : *p;
+    }
+    path[i] = '\0';
+
+    const RequestPhases& ph = *rec.phases;
+    // 没有经过验证的请求，解析完到生成响应都算作build
+    bool verified = ph.verifyStart != RequestPhases::TimePoint();
+    int len = snprintf(slot, SLOT_SIZE,
+        "%d-%02d-%02d %02d:%02d:%02d.%06ld %s:%d fd=%d %s %s %d bytes=%zu total=%lld"
+        " conn_age=%lld queue=%lld read=%lld parse=%lld verify_queue=%lld verify=%lld"
+        " build=%lld send_wait=%lld write=%lld",
+        t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, (long)now.tv_usec,
+        ip, rec.port, rec.fd, rec.method && rec.method[0] ? rec.method : "-", path, rec.status, rec.bytes,
+        Span_(ph.queued, ph.lastWrite), Span_(ph.accept, ph.lastWrite),
+        Span_(ph.queued, ph.dequeued), Span_(ph.dequeued, ph.firstRead), Span_(ph.firstRead, ph.parsed),
+        verified ? Span_(ph.parsed, ph.verifyStart) : -1, verified ? Span_(ph.verifyStart, ph.built) : -1,
+        verified ? -1 : Span_(ph.parsed, ph.built),
+        Span_(ph.built, ph.firstWrite), Span_(ph.firstWrite, ph.lastWrite));
+    if(len < 0) { len = 0; }
+    if(len > SLOT_SIZE - 1) { len = SLOT_SIZE - 1; }
+    // 定长槽位：不足的部分补空格，最后一个字节为换行
+    memset(slot + len, ' ', SLOT_SIZE - 1 - len);
+    slot[SLOT_SIZE - 1] = '\n';
+}
+
+bool SlowLog::write(const Record& rec) {
+    if(!IsOpen()) { return false; }
+    time_t sec = time(nullptr);
+    int slot;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(sec != windowSec_) {
+            windowSec_ = sec;
+            windowCount_ = 0;
+        }
+        if(windowCount_ >= maxPerSec_) {
+            suppressed_++;
+            return false;
+        }
+        windowCount_++;
+        slot = next_;
+        next_ = (next_ + 1) % capacity_;
+    }
+    // 格式化和写入不持锁，各线程写不同的槽位
+    char buf[SLOT_SIZE];
+    Format_(rec, buf);
+    if(pwrite(fd_, buf, SLOT_SIZE, static_cast<off_t>(slot) * SLOT_SIZE) != SLOT_SIZE) {
+        return false;
+    }
+    written_++;
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef SLOW_LOG_H
+#define SLOW_LOG_H
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <netinet/in.h>       // in_addr
+
+// 一个请求各阶段的时间点(steady_clock)，未经过的阶段为默认值(epoch)
+struct RequestPhases {
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    TimePoint accept;       // 连接建立
+    TimePoint queued;       // 读任务投递到线程池
+    TimePoint dequeued;     // 工作线程开始读
+    TimePoint firstRead;    // 读到请求的第一批数据
+    TimePoint parsed;       // 解析完成
+    TimePoint verifyStart;  // 验证线程开始验证(只有登录/注册)
+    TimePoint built;        // 响应生成
+    TimePoint firstWrite;   // 写出第一个字节
+    TimePoint lastWrite;    // 写出最后一个字节
+};
+
+// 慢请求日志：总耗时超过阈值的请求输出各阶段耗时，用来定位尾延迟出在哪一段
+// 文件是固定大小的环形缓冲：capacity个定长槽位循环覆盖，不会无限增长；每秒最多记录maxPerSec条
+class SlowLog {
+public:
+    struct Record {
+        struct in_addr addr;    // 客户端地址
+        int port;
+        int fd;
+        const char* method;
+        const char* path;
+        int status;
+        size_t bytes;
+        const RequestPhases* phases;
+    };
+
+    void init(int thresholdMs, int maxPerSec = 10, const char* path = "./log",
+              const char* fileName = "slow.log", int capacity = 1024);
+
+    static SlowLog* Instance();
+
+    bool IsOpen() const { return isOpen_.load(std::memory_order_relaxed); }
+    int64_t ThresholdUs() const { return thresholdUs_; }
+
+    // 超过每秒的条数限制时丢弃，返回是否写入
+    bool write(const Record& rec);
+
+    uint64_t Written() const { return written_.load(std::memory_order_relaxed); }
+    uint64_t Suppressed() const { return suppressed_.load(std::memory_order_relaxed); }
+
+    static const int SLOT_SIZE = 512;   // 每条记录占用的字节数(含换行)，超长的路径被截断
+
+private:
+    SlowLog();
+    ~SlowLog();
+    void Format_(const Record& rec, char* slot);
+
+    std::atomic<bool> isOpen_;
+    int64_t thresholdUs_;
+    int maxPerSec_;
+    int capacity_;
+
+    int fd_;
+    int next_;              // 下一条记录写入的槽位
+    time_t windowSec_;      // 限流的当前秒
+    int windowCount_;       // 当前秒已写入的条数
+    std::atomic<uint64_t> written_;
+    std::atomic<uint64_t> suppressed_;  // 超过限流被丢弃的条数
+    std::mutex mtx_;
+};
+
+#endif //SLOW_LOG_H
@@ -1,17 +1,49 @@
 #include <unistd.h>
+#include <stdlib.h>
 #include "server/webserver.h"
 
-int main() {
+int main(int argc, char* argv[]) {
     /* 守护进程 后台运行 */
     // daemon(1, 0); 
 
+    /* 压测对比用：-p 端口 -m 触发模式(0~3) -t 线程池的线程数量 -s 慢请求阈值(ms，0为关闭)
+       -c 证书 -k 私钥(PEM，同时指定时开启TLS)
+       -l 每个IP的并发连接数上限 -r 每个IP每秒的请求数(允许2倍的突发)，0为不限 */
+    int port = 1316, trigMode = 3, threadNum = 6, slowLogMs = 500, ipMaxConns = 0, ipRps = 0;
+    const char* tlsCert = nullptr;
+    const char* tlsKey = nullptr;
+    // kill -USR2：启动新版本的程序并交出监听socket，处理完进行中的请求后退出；kill -QUIT：平滑退出
+    GracefulRestart::Instance()->Init(argc, argv);
+    int ch;
+    while((ch = getopt(argc, argv, "p:m:t:s:c:k:l:r:")) != -1) {
+        switch(ch) {
+        case 'p': port = atoi(optarg); break;
+        case 'm': trigMode = atoi(optarg); break;
+        case 't': threadNum = atoi(optarg); break;
+        case 's': slowLogMs = atoi(optarg); break;
+        case 'c': tlsCert = optarg; break;
+        case 'k': tlsKey = optarg; break;
+        case 'l': ipMaxConns = atoi(optarg); break;
+        case 'r': ipRps = atoi(optarg); break;
+        default: return 2;
+        }
+    }
+
     WebServer server(
-        1316, 3, 60000, false,             /* 端口 ET模式 timeoutMs 优雅退出  */
+        port, trigMode, 60000, false,      /* 端口 ET模式 timeoutMs 优雅退出  */
         3306, "root", "root", "webserver", /* Mysql配置 */
-        12, 6, true, 1, 1024);             /* 连接池数量 线程池的线程数量 日志开关 日志等级 日志异步队列容量 */
+        12, threadNum, true, 1, 1024,      /* 连接池数量 线程池的线程数量 日志开关 日志等级 日志异步队列容量 */
+        true, 0, 1.0,                      /* 访问日志开关 访问日志格式(0:CLF 1:Combined 2:JSON) 采样率 */
+        true, nullptr, true,               /* 数据库后台预热 本地用户文件(nullptr:使用MySQL) /metrics开关 */
+        slowLogMs, 10,                     /* 慢请求阈值(ms) 慢请求日志每秒最多条数 */
+        tlsCert, tlsKey,                   /* TLS证书和私钥(nullptr:不开启) */
+        100, 1024,                         /* 单个请求体上限(MB) 所有请求体合计上限(MB) */
+        1000, 10000, 0,                    /* 每个连接的请求数上限 请求头期限(ms) 内存上限(MB，0:不看内存) */
+        10,                                /* 过载保护：I/O任务排队延迟目标(ms，0:关闭) */
+        ipMaxConns, ipRps, ipRps * 2,      /* 每个IP的并发连接数 每秒请求数 突发请求数 */
+        10000);                            /* 平滑重启/退出时等待进行中请求的期限(ms) */
     
     
     // 启动服务器
     server.Start();
-} 
-  
\ No newline at end of file
+}
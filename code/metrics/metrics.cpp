@@ -0,0 +1,157 @@
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <new>
+
+using namespace std;
+
+// 直方图的桶上界(us)，从50us到2.5s
+const uint64_t Metrics::BOUNDS_US[BUCKET_COUNT - 1] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000,
+    25000, 50000, 100000, 250000, 500000, 1000000, 2500000,
+};
+
+static const struct {
+    const char* name;
+    const char* help;
+} COUNTER_INFO[Metrics::COUNTER_COUNT] = {
+    {"webserver_accepts_total", "Accepted connections."},
+    {"webserver_requests_total", "Responses written completely."},
+    {"webserver_bytes_sent_total", "Bytes written to clients."},
+    {"webserver_timer_expirations_total", "Connections closed by the idle timer."},
+    {"webserver_header_timeouts_total", "Connections closed for not sending request headers in time."},
+    {"webserver_keepalive_limit_closes_total", "Connections closed after reaching the keep-alive request limit."},
+    {"webserver_shed_connections_total", "Connections rejected with 503 at accept because the server was overloaded."},
+    {"webserver_shed_requests_total", "Requests rejected with 503 before entering the thread pool."},
+};
+
+// 同名的直方图连续排列，用label区分
+static const struct {
+    const char* name;
+    const char* label;
+    const char* help;
+} HISTOGRAM_INFO[Metrics::HISTOGRAM_COUNT] = {
+    {"webserver_threadpool_task_wait_seconds", "pool=\"io\"", "Time tasks wait in the thread pool queue."},
+    {"webserver_threadpool_task_wait_seconds", "pool=\"auth\"", "Time tasks wait in the thread pool queue."},
+    {"webserver_request_parse_seconds", "", "Time to parse a request."},
+    {"webserver_time_to_first_byte_seconds", "", "From reading a request to writing the first response byte."},
+    {"webserver_response_write_seconds", "", "From the first to the last response byte written."},
+    {"webserver_sql_conn_wait_seconds", "", "Time waiting for a database connection."},
+};
+
+Metrics* Metrics::Instance() {
+    static Metrics inst;
+    return &inst;
+}
+
+Metrics::Shard* Metrics::Local_() {
+    static thread_local Shard* local = nullptr;
+    if(!local) {
+        // 线程第一次记录时分配，之后不再加锁
+        void* mem = aligned_alloc(alignof(Shard), sizeof(Shard));
+        memset(mem, 0, sizeof(Shard));
+        local = new(mem) Shard();
+        lock_guard<mutex> locker(mtx_);
+        shards_.push_back(local);
+    }
+    return local;
+}
+
+// 只有所属线程写，读-改-写不需要原子指令(lock前缀)，抓取线程用relaxed读
+static inline void Bump(atomic<uint64_t>& value, uint64_t n) {
+    value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+void Metrics::Add(COUNTER counter, uint64_t n) {
+    if(!IsOpen()) { return; }
+    Bump(Local_()->counters[counter], n);
+}
+
+void Metrics::Observe(HISTOGRAM hist, uint64_t us) {
+    if(!IsOpen()) { return; }
+    int i = 0;
+    while(i < BUCKET_COUNT - 1 && us > BOUNDS_US[i]) { i++; }
+    Shard* shard = Local_();
+    Bump(shard->hists[hist].buckets[i], 1);
+    Bump(shard->hists[hist].sumUs, us);
+}
+
+uint64_t Metrics::Counter(COUNTER counter) {
+    lock_guard<mutex> locker(mtx_);
+    uint64_t total = 0;
+    for(Shard* shard: shards_) {
+        total += shard->counters[counter].load(memory_order_relaxed);
+    }
+    return total;
+}
+
+Metrics::HistogramValue Metrics::Histogram(HISTOGRAM hist) {
+    HistogramValue value;
+    memset(&value, 0, sizeof(value));
+    lock_guard<mutex> locker(mtx_);
+    for(Shard* shard: shards_) {
+        for(int i = 0; i < BUCKET_COUNT; i++) {
+            uint64_t n = shard->hists[hist].buckets[i].load(memory_order_relaxed);
+            value.buckets[i] += n;
+            value.count += n;
+        }
+        value.sumUs += shard->hists[hist].sumUs.load(memory_order_relaxed);
+    }
+    return value;
+}
+
+void Metrics::Render(string& out) {
+    char line[256];
+    for(int c = 0; c < COUNTER_COUNT; c++) {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+                 COUNTER_INFO[c].name, COUNTER_INFO[c].help, COUNTER_INFO[c].name,
+                 COUNTER_INFO[c].name, (unsigned long long)Counter(static_cast<COUNTER>(c)));
+        out += line;
+    }
+    for(int h = 0; h < HISTOGRAM_COUNT; h++) {
+        const char* name = HISTOGRAM_INFO[h].name;
+        const char* label = HISTOGRAM_INFO[h].label;
+        const char* sep = label[0] ? "," : "";
+        if(h == 0 || strcmp(name, HISTOGRAM_INFO[h - 1].name) != 0) {
+            snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n",
+                     name, HISTOGRAM_INFO[h].help, name);
+            out += line;
+        }
+        HistogramValue value = Histogram(static_cast<HISTOGRAM>(h));
+        uint64_t cumulative = 0;
+        for(int i = 0; i < BUCKET_COUNT; i++) {
+            cumulative += value.buckets[i];
+            if(i < BUCKET_COUNT - 1) {
+                snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%g\"} %llu\n", name, label, sep,
+                         BOUNDS_US[i] / 1e6, (unsigned long long)cumulative);
+            } else {
+                snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, label, sep,
+                         (unsigned long long)cumulative);
+            }
+            out += line;
+        }
+        const char* open = label[0] ? "{" : "";
+        const char* close = label[0] ? "}" : "";
+        snprintf(line, sizeof(line), "%s_sum%s%s%s %.6f\n%s_count%s%s%s %llu\n",
+                 name, open, label, close, value.sumUs / 1e6,
+                 name, open, label, close, (unsigned long long)value.count);
+        out += line;
+    }
+}
+
+void Metrics::RenderValue(string& out, const char* type, const char* name,
+                          const char* help, double value, const char* label) {
+    char line[256];
+    if(help) {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+        out += line;
+    }
+    if(label) {
+        snprintf(line, sizeof(line), "%s{%s} %.17g\n", name, label, value);
+    } else {
+        snprintf(line, sizeof(line), "%s %.17g\n", name, value);
+    }
+    out += line;
+}
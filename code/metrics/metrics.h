@@ -0,0 +1,90 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <stdint.h>
+
+// 运行时指标：每个线程只写自己的分片(单写者，不加锁，不共享缓存行)，抓取时合并各分片，
+// 输出Prometheus文本格式。gauge类的值(连接数、队列长度等)由调用者在抓取时读取后追加
+class Metrics {
+public:
+    enum COUNTER {
+        ACCEPTS = 0,        // 接受的连接数
+        REQUESTS,           // 写完的响应数
+        BYTES_SENT,         // 发送的字节数
+        TIMER_EXPIRED,      // 超时关闭的连接数
+        HEADER_TIMEOUTS,    // 其中没有在期限内收齐请求头的
+        KEEPALIVE_LIMIT,    // 达到每个连接的请求数上限而关闭的连接数
+        SHED_CONNS,         // 过载时在accept时拒绝的连接数
+        SHED_REQUESTS,      // 过载时在读事件中拒绝的请求数
+        COUNTER_COUNT,
+    };
+
+    enum HISTOGRAM {
+        IO_TASK_WAIT = 0,   // I/O线程池任务的排队时间
+        AUTH_TASK_WAIT,     // 验证线程池任务的排队时间
+        PARSE,              // 解析请求
+        TTFB,               // 开始读请求到写出第一个字节
+        WRITE,              // 写出第一个字节到最后一个字节
+        SQL_WAIT,           // 等待数据库连接
+        HISTOGRAM_COUNT,
+    };
+
+    static const int BUCKET_COUNT = 16;     // 最后一个桶为+Inf
+
+    struct HistogramValue {
+        uint64_t buckets[BUCKET_COUNT];     // 各桶(不累加)的次数
+        uint64_t count;
+        uint64_t sumUs;
+    };
+
+    static Metrics* Instance();
+
+    void Init() { isOpen_ = true; }
+    bool IsOpen() const { return isOpen_.load(std::memory_order_relaxed); }
+
+    void Add(COUNTER counter, uint64_t n = 1);
+    void Observe(HISTOGRAM hist, uint64_t us);
+
+    // 从start到现在的微秒数
+    static uint64_t SinceUs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+    // 合并各线程的分片
+    uint64_t Counter(COUNTER counter);
+    HistogramValue Histogram(HISTOGRAM hist);
+
+    // 追加所有计数器和直方图
+    void Render(std::string& out);
+    // 追加单个值，type为"gauge"或"counter"；同一指标的多个label只在第一次传help
+    static void RenderValue(std::string& out, const char* type, const char* name,
+                            const char* help, double value, const char* label = nullptr);
+
+private:
+    Metrics() : isOpen_(false) {}
+
+    // 对齐到缓存行，相邻线程的分片不会互相干扰
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        struct {
+            std::atomic<uint64_t> buckets[BUCKET_COUNT];
+            std::atomic<uint64_t> sumUs;
+        } hists[HISTOGRAM_COUNT];
+    };
+
+    Shard* Local_();
+
+    static const uint64_t BOUNDS_US[BUCKET_COUNT - 1];
+
+    std::atomic<bool> isOpen_;
+    std::mutex mtx_;
+    std::vector<Shard*> shards_;    // 线程退出后分片保留，计数保持单调递增
+};
+
+#endif //METRICS_H
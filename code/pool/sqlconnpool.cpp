@@ -1,9 +1,24 @@
 #include "sqlconnpool.h"
 using namespace std;
 
+const char* SqlConnPool::STMT_SQL[STMT_COUNT] = {
+    "SELECT password FROM user WHERE username=? LIMIT 1",
+    "INSERT INTO user(username, password) VALUES(?, ?)",
+};
+
 SqlConnPool::SqlConnPool() {
+    port_ = 0;
+    minConn_ = maxConn_ = 0;
+    totalConn_ = 0;
     useCount_ = 0;
-    freeCount_ = 0;
+    growRequests_ = 0;
+    waitTimeoutMS_ = 1000;
+    idleTimeoutMS_ = 60000;
+    checkIntervalMS_ = 10000;
+    isClosed_ = true;
+    isReady_ = false;
+    gets_ = timeouts_ = reconnects_ = 0;
+    waitUsTotal_ = waitUsMax_ = 0;
 }
 
 SqlConnPool* SqlConnPool::Instance() {
@@ -13,55 +28,349 @@ SqlConnPool* SqlConnPool::Instance() {
 
 void SqlConnPool::Init(const char* host, int port,
             const char* user,const char* pwd, const char* dbName,
-            int connSize = 10) {
+            int connSize, int maxConnSize, int waitTimeoutMS,
+            int idleTimeoutMS, int checkIntervalMS, bool lazy) {
     assert(connSize > 0);
-    for (int i = 0; i < connSize; i++) {
-        MYSQL *sql = nullptr;
-        sql = mysql_init(sql);
-        if (!sql) {
-            LOG_ERROR("MySql init error!");
-            assert(sql);
+    host_ = host;
+    port_ = port;
+    user_ = user;
+    pwd_ = pwd;
+    dbName_ = dbName;
+    minConn_ = connSize;
+    maxConn_ = maxConnSize > connSize ? maxConnSize : connSize;
+    waitTimeoutMS_ = waitTimeoutMS;
+    idleTimeoutMS_ = idleTimeoutMS;
+    checkIntervalMS_ = checkIntervalMS;
+    isClosed_ = false;
+    // 多线程建立连接之前必须先初始化客户端库
+    mysql_library_init(0, nullptr, nullptr);
+
+    if(!lazy) {
+        // 连接失败的不放入队列，由后台线程补足
+        vector<MYSQL *> conns = ConnectParallel_(connSize);
+        lock_guard<mutex> locker(mtx_);
+        for(auto sql: conns) {
+            connQue_.push_back({sql, Clock::now()});
         }
-        sql = mysql_real_connect(sql, host,
-                                 user, pwd,
-                                 dbName, port, nullptr, 0);
-        if (!sql) {
-            LOG_ERROR("MySql Connect error!");
+        totalConn_ += conns.size();
+        isReady_ = totalConn_ > 0;
+        if(totalConn_ < minConn_) {
+            LOG_WARN("SqlConnPool only %d/%d connections, retry in background", totalConn_, minConn_);
         }
-        connQue_.push(sql);
     }
-    MAX_CONN_ = connSize;
-    sem_init(&semId_, 0, MAX_CONN_);
+    maintThread_ = thread(&SqlConnPool::Maintain_, this);
 }
 
-MYSQL* SqlConnPool::GetConn() {
-    MYSQL *sql = nullptr;
-    if(connQue_.empty()){
-        LOG_WARN("SqlConnPool busy!");
+vector<MYSQL *> SqlConnPool::ConnectParallel_(int n) {
+    vector<MYSQL *> conns(n, nullptr);
+    vector<thread> workers;
+    for(int i = 1; i < n; i++) {
+        workers.emplace_back([this, &conns, i] {
+            mysql_thread_init();
+            conns[i] = Connect_();
+            mysql_thread_end();
+        });
+    }
+    if(n > 0) { conns[0] = Connect_(); }
+    for(auto& t: workers) {
+        t.join();
+    }
+    conns.erase(remove(conns.begin(), conns.end(), nullptr), conns.end());
+    return conns;
+}
+
+MYSQL* SqlConnPool::Connect_() {
+    MYSQL *sql = mysql_init(nullptr);
+    if (!sql) {
+        LOG_ERROR("MySql init error!");
+        return nullptr;
+    }
+    unsigned int timeout = CONNECT_TIMEOUT_S;
+    mysql_options(sql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    if (!mysql_real_connect(sql, host_.c_str(),
+                            user_.c_str(), pwd_.c_str(),
+                            dbName_.c_str(), port_, nullptr, 0)) {
+        LOG_ERROR("MySql Connect error: %s", mysql_error(sql));
+        mysql_close(sql);
         return nullptr;
     }
-    sem_wait(&semId_);
+    // 连接建立时预处理语句
+    vector<MYSQL_STMT *> stmts;
+    PrepareStmts_(sql, stmts);
+    lock_guard<mutex> locker(mtx_);
+    stmts_[sql] = stmts;
+    return sql;
+}
+
+void SqlConnPool::CloseConn_(MYSQL* sql) {
+    assert(sql);
+    vector<MYSQL_STMT *> stmts;
     {
         lock_guard<mutex> locker(mtx_);
-        sql = connQue_.front();
-        connQue_.pop();
+        auto it = stmts_.find(sql);
+        if(it != stmts_.end()) {
+            stmts.swap(it->second);
+            stmts_.erase(it);
+        }
+    }
+    CloseStmts_(stmts);
+    mysql_close(sql);
+}
+
+bool SqlConnPool::CheckConn_(MYSQL*& sql) {
+    if(mysql_ping(sql) == 0) {
+        return true;
+    }
+    LOG_WARN("MySql ping error: %s, reconnect", mysql_error(sql));
+    CloseConn_(sql);
+    sql = Connect_();
+    lock_guard<mutex> locker(mtx_);
+    reconnects_++;
+    return sql != nullptr;
+}
+
+MYSQL* SqlConnPool::GetConn() {
+    return GetConn(waitTimeoutMS_);
+}
+
+MYSQL* SqlConnPool::GetConn(int timeoutMS) {
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + chrono::milliseconds(timeoutMS);
+    MYSQL *sql = nullptr;
+    bool requested = false;
+    bool suspect = false;
+    {
+        unique_lock<mutex> locker(mtx_);
+        while(true) {
+            if(isClosed_) { return nullptr; }
+            if(!connQue_.empty()) {
+                sql = connQue_.front().sql;
+                connQue_.pop_front();
+                break;
+            }
+            if(!requested && totalConn_ + growRequests_ < maxConn_) {
+                // 没有空闲连接且未达到上限，请求后台线程扩容(建立连接可能很慢，不在这里等)
+                requested = true;
+                growRequests_++;
+                maintCond_.notify_one();
+            }
+            if(cond_.wait_until(locker, deadline) == cv_status::timeout && connQue_.empty()) {
+                timeouts_++;
+                LOG_WARN("SqlConnPool busy!");
+                return nullptr;
+            }
+        }
+        useCount_++;
+        gets_++;
+        uint64_t waitUs = chrono::duration_cast<chrono::microseconds>(Clock::now() - start).count();
+        waitUsTotal_ += waitUs;
+        if(waitUs > waitUsMax_) { waitUsMax_ = waitUs; }
+        Metrics::Instance()->Observe(Metrics::SQL_WAIT, waitUs);
+        // 语句缓存被清空说明上次使用时连接出过错，交给调用者之前先检查
+        auto it = stmts_.find(sql);
+        suspect = (it == stmts_.end() || it->second.size() != STMT_COUNT);
+    }
+    if(suspect && !CheckConn_(sql)) {
+        {
+            lock_guard<mutex> locker(mtx_);
+            useCount_--;
+            totalConn_--;
+        }
+        maintCond_.notify_one();    // 由后台线程补足连接
+        return nullptr;
     }
     return sql;
 }
 
 void SqlConnPool::FreeConn(MYSQL* sql) {
     assert(sql);
+    bool closed = false;
+    {
+        lock_guard<mutex> locker(mtx_);
+        useCount_--;
+        if(isClosed_) {
+            totalConn_--;
+            closed = true;
+        } else {
+            connQue_.push_front({sql, Clock::now()});
+        }
+    }
+    if(closed) {
+        CloseConn_(sql);
+        return;
+    }
+    cond_.notify_one();
+}
+
+void SqlConnPool::Maintain_() {
+    mysql_thread_init();
+    int waitMS = 0;     // 启动后立即补足(预热)
+    int backoffMS = 0;  // 建立连接失败后的重试间隔，指数增长到checkIntervalMS_
+    unique_lock<mutex> locker(mtx_);
+    while(!isClosed_) {
+        if(waitMS > 0) {
+            maintCond_.wait_for(locker, chrono::milliseconds(waitMS), [this, &backoffMS] {
+                return isClosed_ || (growRequests_ > 0 && backoffMS == 0);
+            });
+        }
+        if(isClosed_) { break; }
+
+        /* 取出需要检查的空闲连接：空闲超时的关闭(保留minConn_)，其余的ping */
+        Clock::time_point now = Clock::now();
+        vector<MYSQL *> toCheck, toClose;
+        for(auto it = connQue_.begin(); it != connQue_.end();) {
+            int64_t idleMS = chrono::duration_cast<chrono::milliseconds>(now - it->lastUsed).count();
+            if(idleMS >= idleTimeoutMS_ && totalConn_ - static_cast<int>(toClose.size()) > minConn_) {
+                toClose.push_back(it->sql);
+                it = connQue_.erase(it);
+            }
+            else if(idleMS >= checkIntervalMS_) {
+                toCheck.push_back(it->sql);
+                it = connQue_.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        totalConn_ -= toClose.size();
+        /* 补足最少的连接数，再加上等待者请求的扩容 */
+        int missing = max(minConn_ - totalConn_, 0);
+        missing += max(min(growRequests_, maxConn_ - totalConn_ - missing), 0);
+        growRequests_ = 0;
+        totalConn_ += missing;
+        locker.unlock();
+
+        for(auto sql: toClose) {
+            CloseConn_(sql);
+        }
+        if(!toClose.empty()) {
+            LOG_INFO("SqlConnPool shrink by %d", static_cast<int>(toClose.size()));
+        }
+        vector<MYSQL *> alive;
+        int lost = 0;
+        for(auto sql: toCheck) {
+            if(CheckConn_(sql)) { alive.push_back(sql); }
+            else { lost++; }
+        }
+        vector<MYSQL *> conns = ConnectParallel_(missing);
+        int added = conns.size();
+        lost += missing - added;
+        alive.insert(alive.end(), conns.begin(), conns.end());
+        if(added > 0) {
+            LOG_INFO("SqlConnPool add %d connections", added);
+        }
+        // 建立失败的和检查时重连失败的都使连接数低于minConn_，按重试间隔尽快补足，而不是等下一次检查
+        if(lost > 0) {
+            backoffMS = backoffMS ? min(backoffMS * 2, checkIntervalMS_) : RETRY_MIN_MS;
+            waitMS = backoffMS;
+        } else {
+            backoffMS = 0;
+            waitMS = checkIntervalMS_;
+        }
+
+        locker.lock();
+        totalConn_ -= lost;
+        for(auto sql: alive) {
+            connQue_.push_back({sql, Clock::now()});
+        }
+        isReady_ = totalConn_ > 0;
+        if(!alive.empty()) { cond_.notify_all(); }
+    }
+    locker.unlock();
+    mysql_thread_end();
+}
+
+SqlConnPool::Stats SqlConnPool::GetStats() {
     lock_guard<mutex> locker(mtx_);
-    connQue_.push(sql);
-    sem_post(&semId_);
+    Stats stats;
+    stats.total = totalConn_;
+    stats.inUse = useCount_;
+    stats.free = connQue_.size();
+    stats.minConn = minConn_;
+    stats.maxConn = maxConn_;
+    stats.gets = gets_;
+    stats.timeouts = timeouts_;
+    stats.reconnects = reconnects_;
+    stats.waitUsTotal = waitUsTotal_;
+    stats.waitUsMax = waitUsMax_;
+    return stats;
+}
+
+bool SqlConnPool::PrepareStmts_(MYSQL* sql, vector<MYSQL_STMT *>& stmts) {
+    assert(sql);
+    CloseStmts_(stmts);
+    stmts.assign(STMT_COUNT, nullptr);
+    for(int i = 0; i < STMT_COUNT; i++) {
+        MYSQL_STMT* stmt = mysql_stmt_init(sql);
+        if(!stmt) {
+            LOG_ERROR("MySql stmt init error!");
+            CloseStmts_(stmts);
+            return false;
+        }
+        if(mysql_stmt_prepare(stmt, STMT_SQL[i], strlen(STMT_SQL[i]))) {
+            LOG_ERROR("MySql prepare error: %s", mysql_stmt_error(stmt));
+            mysql_stmt_close(stmt);
+            CloseStmts_(stmts);
+            return false;
+        }
+        stmts[i] = stmt;
+    }
+    return true;
+}
+
+void SqlConnPool::CloseStmts_(vector<MYSQL_STMT *>& stmts) {
+    for(auto& stmt: stmts) {
+        if(stmt) { mysql_stmt_close(stmt); }
+        stmt = nullptr;
+    }
+    stmts.clear();
+}
+
+MYSQL_STMT* SqlConnPool::GetStmt(MYSQL* sql, SQL_STMT id) {
+    assert(sql && id >= 0 && id < STMT_COUNT);
+    vector<MYSQL_STMT *>* stmts = nullptr;
+    {
+        lock_guard<mutex> locker(mtx_);
+        stmts = &stmts_[sql];
+    }
+    // 连接被调用者独占，语句缓存只会被当前线程修改
+    if(stmts->size() != STMT_COUNT || !(*stmts)[id]) {
+        if(!PrepareStmts_(sql, *stmts)) {
+            return nullptr;
+        }
+    }
+    return (*stmts)[id];
+}
+
+void SqlConnPool::ResetStmts(MYSQL* sql) {
+    assert(sql);
+    vector<MYSQL_STMT *>* stmts = nullptr;
+    {
+        lock_guard<mutex> locker(mtx_);
+        stmts = &stmts_[sql];
+    }
+    CloseStmts_(*stmts);
 }
 
 void SqlConnPool::ClosePool() {
-    lock_guard<mutex> locker(mtx_);
-    while(!connQue_.empty()) {
-        auto item = connQue_.front();
-        connQue_.pop();
-        mysql_close(item);
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(isClosed_ && !maintThread_.joinable()) { return; }
+        isClosed_ = true;
+    }
+    cond_.notify_all();
+    maintCond_.notify_all();
+    if(maintThread_.joinable()) {
+        maintThread_.join();
+    }
+    deque<IdleConn> conns;
+    {
+        lock_guard<mutex> locker(mtx_);
+        conns.swap(connQue_);
+        totalConn_ -= conns.size();
+    }
+    for(auto& item: conns) {
+        CloseConn_(item.sql);
     }
     mysql_library_end();        
 }
@@ -3,37 +3,120 @@
 
 #include <mysql/mysql.h>
 #include <string>
-#include <queue>
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
 #include <mutex>
-#include <semaphore.h>
+#include <condition_variable>
+#include <chrono>
 #include <thread>
+#include <atomic>
+#include <stdint.h>
 #include "../log/log.h"
+#include "../metrics/metrics.h"
+
+// 每个连接上预处理的语句
+enum SQL_STMT {
+    STMT_SELECT_USER = 0,   // 查询用户密码
+    STMT_INSERT_USER,       // 注册用户
+    STMT_COUNT,
+};
 
 class SqlConnPool {
 public:
+    // 连接池的运行指标
+    struct Stats {
+        int total;              // 当前的连接总数(包括正在使用的)
+        int inUse;              // 正在使用的连接数
+        int free;               // 空闲的连接数
+        int minConn;
+        int maxConn;
+        uint64_t gets;          // 获取连接的次数
+        uint64_t timeouts;      // 等待超时的次数
+        uint64_t reconnects;    // 重连的次数
+        uint64_t waitUsTotal;   // 累计等待时间(us)
+        uint64_t waitUsMax;     // 最长等待时间(us)
+    };
+
     static SqlConnPool *Instance();
 
-    MYSQL *GetConn();
+    // 至少有一个可用连接；预热中或数据库不可用时，验证请求直接失败而不是等待
+    bool IsReady() const { return isReady_.load(std::memory_order_acquire); }
+
+    MYSQL *GetConn();                   // 最多等待waitTimeoutMS，超时返回nullptr
+    MYSQL *GetConn(int timeoutMS);
     void FreeConn(MYSQL * conn);
     int GetFreeConnCount();
+    Stats GetStats();
+
+    // 获取连接上预处理好的语句，不存在(如重连之后)时重新预处理
+    MYSQL_STMT *GetStmt(MYSQL *conn, SQL_STMT id);
+    // 语句失效(连接断开或服务端丢失语句)时关闭，下次GetStmt重新预处理
+    void ResetStmts(MYSQL *conn);
 
+    // connSize是最少保持的连接数，需求增加时最多扩展到maxConnSize，空闲超过idleTimeoutMS后收缩
+    // 后台线程每checkIntervalMS检查一次空闲连接(ping)，断开的连接自动重连
+    // 连接并行建立；lazy为true时立即返回，由后台线程预热
     void Init(const char* host, int port,
               const char* user,const char* pwd, 
-              const char* dbName, int connSize);
+              const char* dbName, int connSize,
+              int maxConnSize = 0, int waitTimeoutMS = 1000,
+              int idleTimeoutMS = 60000, int checkIntervalMS = 10000,
+              bool lazy = false);
     void ClosePool();
 
 private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct IdleConn {
+        MYSQL *sql;
+        Clock::time_point lastUsed;    // 最后一次归还的时间
+    };
+
     SqlConnPool();
     ~SqlConnPool();
 
-    int MAX_CONN_;  // 最大的连接数
-    int useCount_;  // 当前的用户数
-    int freeCount_; // 空闲的用户数
+    MYSQL *Connect_();                  // 建立连接并预处理语句
+    std::vector<MYSQL *> ConnectParallel_(int n);   // 并行建立n个连接，返回成功的
+    void CloseConn_(MYSQL *conn);       // 关闭连接及其语句
+    bool CheckConn_(MYSQL *&conn);      // ping，失败时重连
+    void Maintain_();                   // 后台线程：健康检查、收缩、扩容
+
+    bool PrepareStmts_(MYSQL *conn, std::vector<MYSQL_STMT *>& stmts);
+    static void CloseStmts_(std::vector<MYSQL_STMT *>& stmts);
+
+    static const char* STMT_SQL[STMT_COUNT];
+    static const unsigned int CONNECT_TIMEOUT_S = 3;
+    static const int RETRY_MIN_MS = 100;    // 建立连接失败后重试的最短间隔
+
+    std::string host_, user_, pwd_, dbName_;
+    int port_;
+
+    int minConn_;   // 最少的连接数
+    int maxConn_;   // 最大的连接数
+    int totalConn_; // 当前的连接数(包括正在建立的)
+    int useCount_;  // 正在使用的连接数
+    int growRequests_;  // 等待者请求扩容的连接数
+    int waitTimeoutMS_;
+    int idleTimeoutMS_;
+    int checkIntervalMS_;
+    bool isClosed_;
+    std::atomic<bool> isReady_;
+
+    uint64_t gets_;
+    uint64_t timeouts_;
+    uint64_t reconnects_;
+    uint64_t waitUsTotal_;
+    uint64_t waitUsMax_;
 
-    std::queue<MYSQL *> connQue_;   // 队列（MYSQL *）
+    std::deque<IdleConn> connQue_;  // 空闲连接，队头是最近归还的
+    std::unordered_map<MYSQL *, std::vector<MYSQL_STMT *>> stmts_;  // 每个连接的语句缓存
     std::mutex mtx_;    // 互斥锁
-    sem_t semId_;   // 信号量
+    std::condition_variable cond_;      // 等待空闲连接
+    std::condition_variable maintCond_; // 唤醒后台线程
+    std::thread maintThread_;
 };
 
 
-#endif // SQLCONNPOOL_H
\ No newline at end of file
+#endif // SQLCONNPOOL_H
@@ -6,10 +6,14 @@
 #include <queue>
 #include <thread>
 #include <functional>
+#include <atomic>
+#include <chrono>
+#include <assert.h>
 class ThreadPool {
 public:
     explicit ThreadPool(size_t threadCount = 8): pool_(std::make_shared<Pool>()) {  // explicit防止构造函数进行隐式类型转换
             assert(threadCount > 0);
+            pool_->running = threadCount;
 
             // 创建threadCount个子线程
             for(size_t i = 0; i < threadCount; i++) {
@@ -18,7 +22,8 @@ public:
                     while(true) {
                         if(!pool->tasks.empty()) {
                             // 从任务队列中取第一个任务
-                            auto task = std::move(pool->tasks.front());
+                            auto task = std::move(pool->tasks.front().fn);
+                            if(pool->targetUs > 0) { pool->CheckDelay(pool->tasks.front().enqueued); }
                             // 移除掉队列中第一个元素
                             pool->tasks.pop();
                             locker.unlock();
@@ -28,6 +33,7 @@ public:
                         else if(pool->isClosed) break;
                         else pool->cond.wait(locker);   // 如果队列为空，等待
                     }
+                    if(--pool->running == 0) { pool->exited.notify_all(); }
                 }).detach();// 线程分离
             }
     }
@@ -50,18 +56,89 @@ public:
     void AddTask(F&& task) {
         {
             std::lock_guard<std::mutex> locker(pool_->mtx);
-            pool_->tasks.emplace(std::forward<F>(task));
+            Pool::TimePoint now;
+            if(pool_->targetUs > 0) {
+                now = std::chrono::steady_clock::now();
+                if(pool_->tasks.empty()) { pool_->progress.store(now.time_since_epoch().count()); }
+                pool_->pending.store(pool_->tasks.size() + 1, std::memory_order_relaxed);
+            }
+            pool_->tasks.push({ std::forward<F>(task), now });
         }
         pool_->cond.notify_one();   // 唤醒一个等待的线程
     }
 
+    // 开启排队延迟检测(CoDel)：任务在队列中的等待时间在interval内一直高于target时认为过载，
+    // 取出的任务低于target或队列排空时恢复；只反映持续的积压，瞬时的突发不算过载
+    void SetDelayTarget(std::chrono::microseconds target, std::chrono::microseconds interval) {
+        std::lock_guard<std::mutex> locker(pool_->mtx);
+        pool_->targetUs = target.count();
+        pool_->intervalUs = interval.count();
+    }
+
+    // 可在任何线程调用；任务都卡住、一个interval没有取出任务时也认为过载
+    bool Overloaded() const {
+        if(pool_->overloaded.load(std::memory_order_relaxed)) { return true; }
+        if(pool_->pending.load(std::memory_order_relaxed) == 0) { return false; }
+        auto stalled = std::chrono::steady_clock::now().time_since_epoch() -
+                       Pool::TimePoint::duration(pool_->progress.load(std::memory_order_relaxed));
+        return std::chrono::duration_cast<std::chrono::microseconds>(stalled).count() > pool_->intervalUs;
+    }
+
+    // 关闭线程池，等队列中剩下的任务执行完、线程都退出后返回(析构时不等待)；不能在池中的线程里调用
+    // 之后添加的任务不会执行
+    void Close() {
+        std::unique_lock<std::mutex> locker(pool_->mtx);
+        pool_->isClosed = true;
+        pool_->cond.notify_all();
+        pool_->exited.wait(locker, [this] { return pool_->running == 0; });
+    }
+
+    // 等待执行的任务数(抓取指标时调用)
+    size_t QueueSize() {
+        std::lock_guard<std::mutex> locker(pool_->mtx);
+        return pool_->tasks.size();
+    }
+
 private:
     // 结构体
     struct Pool {
+        typedef std::chrono::steady_clock::time_point TimePoint;
+        struct Task {
+            std::function<void()> fn;
+            TimePoint enqueued;     // 开启排队延迟检测时记录
+        };
+
         std::mutex mtx;     // 互斥锁
         std::condition_variable cond;   // 条件变量
         bool isClosed;          // 是否关闭
-        std::queue<std::function<void()>> tasks;    // 队列（保存的是任务）
+        std::queue<Task> tasks;    // 队列（保存的是任务）
+        size_t running;         // 还没有退出的线程数
+        std::condition_variable exited;     // 最后一个线程退出时通知Close()
+
+        // 排队延迟检测，targetUs为0时关闭；以下除原子变量外由mtx保护
+        int64_t targetUs;
+        int64_t intervalUs;
+        int64_t firstAboveUs;   // 等待时间开始连续高于target的时刻 + interval，0为没有高于target
+        std::atomic<bool> overloaded;
+        std::atomic<size_t> pending;            // 队列中的任务数
+        std::atomic<TimePoint::rep> progress;   // 最近一次取出任务(或队列由空变为非空)的时刻
+
+        // 取出任务时调用
+        void CheckDelay(TimePoint enqueued) {
+            TimePoint now = std::chrono::steady_clock::now();
+            progress.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+            pending.store(tasks.size() - 1, std::memory_order_relaxed);
+            int64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+            int64_t delayUs = std::chrono::duration_cast<std::chrono::microseconds>(now - enqueued).count();
+            if(delayUs < targetUs || tasks.size() == 1) {
+                firstAboveUs = 0;
+                overloaded.store(false, std::memory_order_relaxed);
+            } else if(firstAboveUs == 0) {
+                firstAboveUs = nowUs + intervalUs;
+            } else if(nowUs >= firstAboveUs) {
+                overloaded.store(true, std::memory_order_relaxed);
+            }
+        }
     };
     std::shared_ptr<Pool> pool_;  //  池子
 };
@@ -0,0 +1,67 @@
+#include "admission.h"
+#include <sys/socket.h>
+#include <string.h>      // strlen
+#include "../log/log.h"
+#include "../http/keepalive.h"
+
+using namespace std;
+
+Admission* Admission::Instance() {
+    static Admission instance;
+    return &instance;
+}
+
+Admission::Admission(): pool_(nullptr), overloaded_(false) {
+    response_ = MakeResponse_("503 Service Unavailable",
+                              "<html><title>503</title><body>Server busy, please retry later.</body></html>");
+    tooMany_ = MakeResponse_("429 Too Many Requests",
+                             "<html><title>429</title><body>Too many connections, please retry later.</body></html>");
+}
+
+string Admission::MakeResponse_(const char* status, const char* body) {
+    return string("HTTP/1.1 ") + status + "\r\n"
+           "Retry-After: " + to_string(RETRY_AFTER) + "\r\n"
+           "Connection: close\r\n"
+           "Content-type: text/html\r\n"
+           "Content-length: " + to_string(strlen(body)) + "\r\n\r\n" + body;
+}
+
+void Admission::Init(ThreadPool* pool, int delayTargetMs) {
+    overloaded_ = false;
+    if(delayTargetMs <= 0) {
+        pool_ = nullptr;
+        return;
+    }
+    pool_ = pool;
+    pool_->SetDelayTarget(chrono::milliseconds(delayTargetMs), chrono::milliseconds(DELAY_INTERVAL_MS));
+}
+
+bool Admission::Overloaded() {
+    if(!pool_) { return false; }
+    bool queue = QueueOverloaded();
+    bool overloaded = queue || LoadOverloaded();
+    if(overloaded != overloaded_) {
+        overloaded_ = overloaded;
+        if(overloaded) {
+            LOG_WARN("Overloaded (queue delay: %s, load: %.3f), shedding new requests",
+                     queue ? "high" : "ok", KeepAlivePolicy::Instance()->Load());
+        } else {
+            LOG_WARN("Overload cleared");
+        }
+    }
+    return overloaded;
+}
+
+bool Admission::LoadOverloaded() const {
+    return pool_ && KeepAlivePolicy::Instance()->Load() * 1000 >= SHED_LOAD;
+}
+
+void Admission::Reject(int fd, bool sendResponse, int code) {
+    char buf[4096];
+    for(int i = 0; i < 4 && recv(fd, buf, sizeof(buf), MSG_DONTWAIT) == sizeof(buf); i++) {}
+    if(sendResponse) {
+        const string& response = code == 429 ? tooMany_ : response_;
+        ssize_t ret = send(fd, response.data(), response.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        (void)ret;
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <string>
+#include <chrono>
+
+#include "../pool/threadpool.h"
+
+// 过载保护(准入控制)：I/O线程池的排队延迟持续超过目标(CoDel)，或者负载(连接数占fd上限、内存占内存上限)
+// 超过SHED_LOAD时拒绝新的连接和新的请求。主线程在accept和读事件中直接写出预先生成的503响应(带Retry-After)
+// 后关闭连接，不进线程池，拒绝一个请求只需要几个系统调用；已经开始处理的请求不受影响
+class Admission {
+public:
+    static Admission* Instance();
+
+    // delayTargetMs为0时关闭(只在连接数达到MAX_FD时拒绝)
+    void Init(ThreadPool* pool, int delayTargetMs);
+    bool IsOpen() const { return pool_ != nullptr; }
+
+    // 主线程中调用，过载开始和结束时各记一条日志
+    bool Overloaded();
+    bool QueueOverloaded() const { return pool_ && pool_->Overloaded(); }
+    bool LoadOverloaded() const;
+
+    // 读掉已经到达的请求数据(关闭时接收缓冲区不空会发RST，客户端可能收不到响应)，明文连接写出503；不关闭fd
+    // code为429时写出429(单个IP超过连接数上限)
+    void Reject(int fd, bool sendResponse, int code = 503);
+
+    static const int SHED_LOAD = 950;           // 千分比
+    static const int RETRY_AFTER = 1;           // 秒
+    static const int DELAY_INTERVAL_MS = 100;   // CoDel的interval
+
+private:
+    Admission();
+    ~Admission() = default;
+
+    static std::string MakeResponse_(const char* status, const char* body);
+
+    ThreadPool* pool_;
+    bool overloaded_;
+    std::string response_;
+    std::string tooMany_;   // 429
+};
+
+#endif //ADMISSION_H
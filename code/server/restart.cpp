@@ -0,0 +1,175 @@
+#include "restart.h"
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+const char* GracefulRestart::ENV_NAME = "WEBSERVER_LISTEN_SOCK";
+
+static const int CHILD_FD = 3;  // 新进程中Unix socket的fd
+
+GracefulRestart* GracefulRestart::Instance() {
+    static GracefulRestart instance;
+    return &instance;
+}
+
+GracefulRestart::GracefulRestart(): wakeFd_(-1), action_(NONE), readySock_(-1), child_(-1) {}
+
+void GracefulRestart::Init(int argc, char* argv[]) {
+    argv_.assign(argv, argv + argc);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnSignal_;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, nullptr);
+    sigaction(SIGQUIT, &sa, nullptr);
+}
+
+// 可能在任何线程中执行，只记下动作并唤醒主线程
+void GracefulRestart::OnSignal_(int sig) {
+    int savedErrno = errno;
+    GracefulRestart* self = Instance();
+    self->action_.store(sig == SIGUSR2 ? UPGRADE : DRAIN);
+    int fd = self->wakeFd_.load();
+    if(fd >= 0) {
+        uint64_t one = 1;
+        ssize_t ret = write(fd, &one, sizeof(one));
+        (void)ret;
+    }
+    errno = savedErrno;
+}
+
+int GracefulRestart::Spawn(int listenFd) {
+    if(argv_.empty() || child_ > 0) { return -1; }
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) { return -1; }
+
+    // fork之后子进程只能调用异步信号安全的函数，参数和环境变量事先准备好
+    vector<char*> args;
+    for(string& arg: argv_) { args.push_back(&arg[0]); }
+    args.push_back(nullptr);
+    string env = string(ENV_NAME) + "=" + to_string(CHILD_FD);
+    size_t nameLen = strlen(ENV_NAME);
+    vector<char*> envp;
+    for(char** e = environ; *e; e++) {
+        if(strncmp(*e, ENV_NAME, nameLen) != 0 || (*e)[nameLen] != '=') { envp.push_back(*e); }
+    }
+    envp.push_back(&env[0]);
+    envp.push_back(nullptr);
+    long maxFd = sysconf(_SC_OPEN_MAX);
+
+    pid_t pid = fork();
+    if(pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if(pid == 0) {
+        // Unix socket放到固定的fd，关闭其他继承来的fd(客户端连接、日志文件、epoll等)
+        if(sv[1] == CHILD_FD) {
+            fcntl(CHILD_FD, F_SETFD, 0);
+        } else {
+            dup2(sv[1], CHILD_FD);
+        }
+#ifdef SYS_close_range
+        if(syscall(SYS_close_range, CHILD_FD + 1, ~0U, 0) != 0)
+#endif
+        for(long fd = CHILD_FD + 1; fd < maxFd; fd++) { close(fd); }
+        execvpe(args[0], args.data(), envp.data());
+        _exit(127);
+    }
+    close(sv[1]);
+    if(!SendFd_(sv[0], listenFd)) {
+        close(sv[0]);
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        return -1;
+    }
+    child_ = pid;
+    return sv[0];
+}
+
+bool GracefulRestart::CheckReady(int sock) {
+    char c = 0;
+    ssize_t len = read(sock, &c, 1);
+    close(sock);
+    if(len != 1 && child_ > 0 && waitpid(child_, nullptr, WNOHANG) == 0) {
+        // 关闭socket时子进程可能还没退出完(或者没有收到监听socket还在运行)，结束它并回收
+        kill(child_, SIGKILL);
+        waitpid(child_, nullptr, 0);
+    }
+    child_ = -1;
+    return len == 1;
+}
+
+int GracefulRestart::InheritListenFd() {
+    const char* env = getenv(ENV_NAME);
+    if(!env) { return -1; }
+    int sock = atoi(env);
+    unsetenv(ENV_NAME);
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    struct timeval tv = { 5, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int fd = RecvFd_(sock);
+    if(fd < 0) {
+        close(sock);
+        return -1;
+    }
+    readySock_ = sock;
+    return fd;
+}
+
+void GracefulRestart::NotifyReady() {
+    if(readySock_ < 0) { return; }
+    char c = 'R';
+    ssize_t ret = write(readySock_, &c, 1);
+    (void)ret;
+    close(readySock_);
+    readySock_ = -1;
+}
+
+bool GracefulRestart::SendFd_(int sock, int fd) {
+    char data = 'L';
+    struct iovec iov = { &data, 1 };
+    char ctrl[CMSG_SPACE(sizeof(int))];
+    memset(ctrl, 0, sizeof(ctrl));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+int GracefulRestart::RecvFd_(int sock) {
+    char data;
+    struct iovec iov = { &data, 1 };
+    char ctrl[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    if(recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) { return -1; }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if(!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) { return -1; }
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
@@ -0,0 +1,56 @@
+#ifndef GRACEFUL_RESTART_H
+#define GRACEFUL_RESTART_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// 平滑重启(升级程序不断服务)：收到SIGUSR2时fork+exec同一路径的程序(可能已替换为新版本)，
+// 通过Unix socket(SCM_RIGHTS)把监听socket交给它；新进程开始服务后通知旧进程，旧进程停止accept，
+// 进行中的请求处理完(有期限)后退出。两个进程共用同一个监听socket，accept队列里的连接不会丢
+// 收到SIGQUIT时不启动新进程，只停止accept、处理完进行中的请求后退出
+class GracefulRestart {
+public:
+    enum ACTION {
+        NONE = 0,
+        UPGRADE,    // SIGUSR2
+        DRAIN,      // SIGQUIT
+    };
+
+    static GracefulRestart* Instance();
+
+    // main中调用：记录启动参数，安装信号处理函数；不调用时(测试、压测程序)不响应这两个信号
+    void Init(int argc, char* argv[]);
+    // 信号处理函数写这个eventfd唤醒epoll_wait
+    void SetWakeFd(int fd) { wakeFd_.store(fd); }
+    ACTION TakeAction() { return static_cast<ACTION>(action_.exchange(NONE)); }
+
+    // 新进程：由旧进程启动时收下交过来的监听socket，否则返回-1
+    int InheritListenFd();
+    // 新进程开始服务后通知旧进程
+    void NotifyReady();
+
+    // 旧进程：启动新进程并交出listenFd，返回等待就绪通知的socket(可读时调用CheckReady)，失败返回-1
+    int Spawn(int listenFd);
+    // 新进程已就绪返回true；新进程启动失败(没有通知就关闭了socket)时回收子进程，返回false；关闭sock
+    bool CheckReady(int sock);
+
+    static const char* ENV_NAME;    // 新进程从这个环境变量得到Unix socket的fd
+
+private:
+    GracefulRestart();
+    ~GracefulRestart() = default;
+
+    static void OnSignal_(int sig);
+    static bool SendFd_(int sock, int fd);
+    static int RecvFd_(int sock);
+
+    std::vector<std::string> argv_;
+    std::atomic<int> wakeFd_;
+    std::atomic<int> action_;
+    int readySock_;     // 新进程：通知旧进程的socket
+    pid_t child_;       // 旧进程：正在启动的新进程
+};
+
+#endif //GRACEFUL_RESTART_H
@@ -1,4 +1,8 @@
 #include "webserver.h"
+#include "../auth/fileauthstore.h"
+#ifndef NO_MYSQL
+#include "../auth/mysqlauthstore.h"
+#endif
 
 using namespace std;
 
@@ -6,9 +10,16 @@ WebServer::WebServer(
             int port, int trigMode, int timeoutMS, bool OptLinger,
             int sqlPort, const char* sqlUser, const  char* sqlPwd,
             const char* dbName, int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize):
-            port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-            timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
+            bool openLog, int logLevel, int logQueSize,
+            bool openAccessLog, int accessLogFormat, double accessLogSample,
+            bool sqlLazyInit, const char* authStorePath, bool openMetrics,
+            int slowLogMs, int slowLogPerSec, const char* tlsCert, const char* tlsKey,
+            int maxBodyMB, int maxBodyTotalMB, int keepAliveMax, int headerTimeoutMS, int memLimitMB,
+            int shedDelayMs, int ipMaxConns, int ipRps, int ipBurst, int drainTimeoutMS):
+            port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false), wakeFd_(-1), spareFd_(-1),
+            restartFd_(-1), drainTimeoutMS_(drainTimeoutMS), drainDeadline_(0), lastSweep_(0),
+            timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)),
+            authpool_(new ThreadPool(connPoolNum)), epoller_(new Epoller())
     {
     // /home/nowcoder/WebServer-master/
     srcDir_ = getcwd(nullptr, 256); // 获取当前的工作路径
@@ -16,12 +27,38 @@ WebServer::WebServer(
     // /home/nowcoder/WebServer-master/resources/
     strncat(srcDir_, "/resources/", 16);    // 拼接资源路径
     
+    // 客户端在响应发送中途断开时，写socket会触发SIGPIPE终止进程，忽略它由writev返回EPIPE
+    signal(SIGPIPE, SIG_IGN);
+
     // 当前所有连接数
     HttpConn::userCount = 0;
     HttpConn::srcDir = srcDir_;
 
-    // 初始化数据库连接池
-    SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
+    // WebSocket/SSE连接空闲时，发布消息的线程通过它注册EPOLLOUT
+    HttpConn::pushArm = [this](int fd, uint32_t events) { epoller_->ModFd(fd, connEvent_ | events); };
+
+    // 请求体上限：超过64KB的请求体转存到临时文件，单个请求和所有连接合计的大小都有上限
+    HttpRequest::maxBodySize = static_cast<size_t>(maxBodyMB) << 20;
+    HttpRequest::maxBodyTotal = static_cast<size_t>(maxBodyTotalMB) << 20;
+
+    // 长连接策略：连接数接近fd上限或内存接近memLimitMB时缩短空闲超时
+    struct rlimit rl;
+    int maxConns = MAX_FD;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t)MAX_FD) {
+        maxConns = static_cast<int>(rl.rlim_cur);
+    }
+    KeepAlivePolicy::Instance()->Init(timeoutMS, headerTimeoutMS, keepAliveMax, maxConns,
+                                      static_cast<size_t>(memLimitMB) << 20);
+
+    // 过载保护：I/O任务排队延迟持续超过shedDelayMs，或负载接近fd/内存上限时，新请求直接回复503
+    Admission::Instance()->Init(threadpool_.get(), shedDelayMs);
+    spareFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    // 按客户端IP限制并发连接数和请求频率，超过时回复429
+    IpLimiter::Instance()->Init(ipMaxConns, ipRps, ipBurst);
+
+    // 用户凭证缓存，热点用户登录不再访问数据库
+    CredentialCache::Instance()->Init();
 
     // 初始化事件的模式
     InitEventMode_(trigMode);
@@ -42,15 +79,82 @@ WebServer::WebServer(
             LOG_INFO("LogSys level: %d", logLevel);
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
             LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            LOG_INFO("KeepAlive max requests: %d, header timeout: %dms, max conns: %d, memory limit: %dMB",
+                     keepAliveMax, headerTimeoutMS, maxConns, memLimitMB);
+            LOG_INFO("Load shedding: %s, queue delay target: %dms", shedDelayMs > 0 ? "on" : "off", shedDelayMs);
+            LOG_INFO("Per-IP limits: max conns: %d, requests/s: %d, burst: %d", ipMaxConns, ipRps, ipBurst);
+        }
+    }
+
+    // 初始化用户验证的存储后端：默认MySQL，指定authStorePath(或没有编译MySQL)时使用本地文件
+#ifndef NO_MYSQL
+    if(!authStorePath) {
+        // 平时保持一半的连接，验证请求多时扩展到connPoolNum(与验证线程数一致)
+        // sqlLazyInit时不等待数据库，后台预热，静态资源可以立即访问
+        authStore_.reset(new MysqlAuthStore("localhost", sqlPort, sqlUser, sqlPwd, dbName,
+                                            connPoolNum > 1 ? connPoolNum / 2 : 1, connPoolNum,
+                                            sqlLazyInit));
+    }
+#endif
+    if(!authStore_) {
+        authStore_.reset(new FileAuthStore(authStorePath ? authStorePath : "./data/user.db"));
+    }
+    HttpRequest::authStore = authStore_.get();
+    LOG_INFO("AuthStore: %s", authStore_->Name());
+
+    if(tlsCert && tlsKey) {
+        // 只有一个reactor，SSL_CTX在所有连接间共享，会话票据和会话缓存对所有连接有效
+        tlsCtx_.reset(new TlsContext());
+        if(tlsCtx_->Init(tlsCert, tlsKey)) {
+            HttpConn::tlsCtx = tlsCtx_.get();
+            LOG_INFO("TLS: cert %s, key %s", tlsCert, tlsKey);
+        } else {
+            isClose_ = true;
         }
     }
+
+    if(openMetrics) {
+        // 各线程分别计数，/metrics请求时合并
+        Metrics::Instance()->Init();
+        HttpConn::metricsHandler = std::bind(&WebServer::RenderMetrics_, this);
+        LOG_INFO("Metrics: /metrics");
+    }
+
+    if(openAccessLog && !isClose_) {
+        // 访问日志写到单独的文件，使用自己的异步写线程
+        AccessLog::Instance()->init("./log", "access.log", accessLogFormat, accessLogSample,
+                                    logQueSize > 0 ? logQueSize : 1024);
+        LOG_INFO("AccessLog format: %d, sample: %.3f", accessLogFormat, accessLogSample);
+    }
+
+    if(slowLogMs > 0 && !isClose_) {
+        // 超过slowLogMs的请求记录各阶段耗时，每秒最多slowLogPerSec条
+        SlowLog::Instance()->init(slowLogMs, slowLogPerSec, "./log", "slow.log");
+        LOG_INFO("SlowLog threshold: %dms, limit: %d/s", slowLogMs, slowLogPerSec);
+    }
 }
 
 WebServer::~WebServer() {
-    close(listenFd_);
+    // 工作线程是分离的，先等队列中的任务执行完(I/O任务可能再投递验证任务)，之后才能释放连接和验证存储
+    threadpool_->Close();
+    authpool_->Close();
+    CredentialCache* cache = CredentialCache::Instance();
+    LOG_INFO("CredentialCache hits: %llu, negative hits: %llu, misses: %llu",
+             (unsigned long long)cache->Hits(), (unsigned long long)cache->NegativeHits(),
+             (unsigned long long)cache->Misses());
+    if(listenFd_ >= 0) { close(listenFd_); }
+    if(restartFd_ >= 0) { close(restartFd_); }
+    GracefulRestart::Instance()->SetWakeFd(-1);
+    if(wakeFd_ >= 0) { close(wakeFd_); }
+    if(spareFd_ >= 0) { close(spareFd_); }
     isClose_ = true;
     free(srcDir_);
-    SqlConnPool::Instance()->ClosePool();
+    HttpRequest::authStore = nullptr;
+    HttpConn::metricsHandler = nullptr;
+    HttpConn::tlsCtx = nullptr;
+    HttpConn::pushArm = nullptr;
+    Admission::Instance()->Init(nullptr, 0);
+    KeepAlivePolicy::Instance()->SetDraining(false);
 }
 
 // 设置监听的文件描述符和通信的文件描述符的模式
@@ -82,19 +186,34 @@ void WebServer::InitEventMode_(int trigMode) {
 // 启动服务器
 void WebServer::Start() {
     int timeMS = -1;  /* epoll wait timeout == -1 无事件将阻塞 */
-    if(!isClose_) { LOG_INFO("========== Server start =========="); }
+    if(!isClose_) {
+        LOG_INFO("========== Server start ==========");
+        GracefulRestart::Instance()->NotifyReady();     // 由旧进程启动时，旧进程随后停止accept
+    }
     while(!isClose_) {
+        if(drainDeadline_ > 0) {
+            if(HttpConn::userCount == 0 || KeepAlivePolicy::NowMs() >= drainDeadline_) {
+                LOG_INFO("Drain finished, %d connections left", (int)HttpConn::userCount);
+                break;
+            }
+            CloseIdle_();
+        }
 
         // 如果设置了超时时间，例如60s,则只要一个连接60秒没有读写操作，则关闭
         if(timeoutMS_ > 0) {
             // 通过定时器GetNextTick(),清除超时的节点，然后获取最先要超时的连接的超时的时间
             timeMS = timer_->GetNextTick();
         }
+        if(drainDeadline_ > 0) {
+            timeMS = timeMS < 0 ? DRAIN_CHECK_MS : std::min(timeMS, static_cast<int>(DRAIN_CHECK_MS));
+        }
 
         // timeMS是最先要超时的连接的超时的时间，传递到epoll_wait()函数中
         // 当timeMS时间内有事件发生，epoll_wait()返回，否则等到了timeMS时间后才返回
         // 这样做的目的是为了让epoll_wait()调用次数变少，提高效率
         int eventCnt = epoller_->Wait(timeMS);
+        KeepAlivePolicy::Instance()->Update(HttpConn::userCount);
+        bool woken = false, restartReady = false;   // 信号和新进程就绪在这批事件之后处理(可能关闭监听fd)
 
         // 循环处理每一个事件
         for(int i = 0; i < eventCnt; i++) {
@@ -103,9 +222,26 @@ void WebServer::Start() {
             uint32_t events = epoller_->GetEvents(i);   // 获取事件的类型
             
             // 监听的文件描述符有事件，说明有新的连接进来
-            if(fd == listenFd_) {  
+            if(fd == wakeFd_) {
+                uint64_t cnt;
+                ssize_t ret = read(wakeFd_, &cnt, sizeof(cnt));
+                (void)ret;
+                woken = true;
+                continue;
+            }
+            else if(fd == restartFd_) {
+                restartReady = true;
+                continue;
+            }
+            else if(fd == listenFd_) {  
                 DealListen_();  // 处理监听的操作，接受客户端连接(可能存在有多个客户端连接进来)
             }                   // 这是在主线程中完成的
+
+            // WebSocket/SSE连接可能被发布消息的线程重新注册过事件，已经在工作线程中时丢弃重复的事件
+            // (工作线程结束时Park()会按当前状态重新注册)
+            else if(users_[fd].UpgradedPush() && !users_[fd].UpgradedPush()->Claim()) {
+                continue;
+            }
             
             // 错误的一些情况
             else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
@@ -127,86 +263,403 @@ void WebServer::Start() {
                 LOG_ERROR("Unexpected event");
             }
         }
+        if(restartReady) {
+            epoller_->DelFd(restartFd_);
+            if(GracefulRestart::Instance()->CheckReady(restartFd_)) {
+                LOG_INFO("New process is serving, draining");
+                Drain_();
+            } else {
+                LOG_ERROR("New process failed to start, keep serving");
+            }
+            restartFd_ = -1;
+        }
+        if(woken) { OnSignal_(); }
     }
 }
 
-// 发送错误提示信息
-void WebServer::SendError_(int fd, const char*info) {
-    assert(fd > 0);
-    int ret = send(fd, info, strlen(info), 0);
-    if(ret < 0) {
-        LOG_WARN("send error to client[%d] error!", fd);
+void WebServer::OnSignal_() {
+    GracefulRestart* restart = GracefulRestart::Instance();
+    GracefulRestart::ACTION action = restart->TakeAction();
+    if(action == GracefulRestart::NONE || drainDeadline_ > 0) { return; }
+    if(action == GracefulRestart::DRAIN) {
+        LOG_INFO("Received SIGQUIT, draining");
+        Drain_();
+        return;
     }
+    if(restartFd_ >= 0) {
+        LOG_WARN("Upgrade already in progress");
+        return;
+    }
+    // 新进程收到监听socket、开始服务后发来就绪通知，在那之前旧进程照常服务
+    restartFd_ = restart->Spawn(listenFd_);
+    if(restartFd_ < 0 || !epoller_->AddFd(restartFd_, EPOLLIN)) {
+        LOG_ERROR("Upgrade: failed to start new process!");
+        if(restartFd_ >= 0) { restart->CheckReady(restartFd_); }
+        restartFd_ = -1;
+        return;
+    }
+    LOG_INFO("Upgrade: new process started, waiting for it to take over");
+}
+
+// 停止accept(新进程共用同一个监听socket，没有新进程时客户端立即被拒绝)，之后的响应都带Connection: close
+// 进行中的请求继续处理，连接都关闭或到期限时Start()返回
+void WebServer::Drain_() {
+    drainDeadline_ = KeepAlivePolicy::NowMs() + drainTimeoutMS_;
+    lastSweep_ = 0;
+    KeepAlivePolicy::Instance()->SetDraining(true);
+    if(listenFd_ >= 0) {
+        epoller_->DelFd(listenFd_);
+        close(listenFd_);
+        listenFd_ = -1;
+    }
+    LOG_INFO("Draining: %d connections, deadline %dms", (int)HttpConn::userCount, drainTimeoutMS_);
+    CloseIdle_();
+}
+
+// WebSocket/SSE连接和空闲超过DRAIN_IDLE_MS的长连接正在epoll中等待(不在工作线程中)，
+// 关闭读方向后由主线程在EPOLLRDHUP事件中关闭，不和工作线程争用连接
+// 只看原子的phase_：push_和连接的其他状态由工作线程修改，主线程不读；
+// 工作线程关闭连接时先清除阶段再close(fd)，已关闭的连接不会被当作空闲(fd号可能已被复用)
+void WebServer::CloseIdle_() {
+    int64_t now = KeepAlivePolicy::NowMs();
+    if(now - lastSweep_ < DRAIN_CHECK_MS) { return; }
+    lastSweep_ = now;
+    int64_t since;
+    for(auto& user: users_) {
+        HttpConn& client = user.second;
+        HttpConn::PHASE phase = client.Phase(&since);
+        if(phase == HttpConn::PUSH || (phase == HttpConn::IDLE && now - since >= DRAIN_IDLE_MS)) {
+            shutdown(user.first, SHUT_RD);
+        }
+    }
+}
+
+void WebServer::Stop() {
+    isClose_ = true;
+    if(wakeFd_ >= 0) {
+        uint64_t one = 1;
+        ssize_t ret = write(wakeFd_, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+// 拒绝连接：明文连接回复预先生成的503/429，TLS连接还没有握手，直接关闭
+void WebServer::Reject_(int fd, int code) {
+    assert(fd > 0);
+    Admission::Instance()->Reject(fd, !tlsCtx_, code);
     close(fd);
 }
 
 // 关闭连接（从epoll中删除，解除响应对象中的内存映射，用户数递减，关闭文件描述符）
 void WebServer::CloseConn_(HttpConn* client) {
     assert(client);
-    LOG_INFO("Client[%d] quit!", client->GetFd());
+    LOG_DEBUG("Client[%d] quit!", client->GetFd());
+    TRACE_PROBE1(close, client->GetFd());
     epoller_->DelFd(client->GetFd());
     client->Close();
 }
 
 // 添加客户端
-void WebServer::AddClient_(int fd, sockaddr_in addr) {
+void WebServer::AddClient_(int fd, sockaddr_in addr, int ipSlot) {
     assert(fd > 0);
-    users_[fd].init(fd, addr);
+    users_[fd].init(fd, addr, ipSlot);
+    TRACE_PROBE3(accept, fd, addr.sin_addr.s_addr, ntohs(addr.sin_port));
     if(timeoutMS_ > 0) {  // timeoutMS_ = 60000ms
         // 添加到定时器对象中，当检测到超时时执行CloseConn_函数进行关闭连接
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
+        timer_->add(fd, CheckInterval_(&users_[fd]), std::bind(&WebServer::OnTimeout_, this, &users_[fd]));
     }
     // 添加到epoll中进行管理
     epoller_->AddFd(fd, EPOLLIN | connEvent_);
     // 设置文件描述符非阻塞
     SetFdNonblock(fd);
-    LOG_INFO("Client[%d] in!", users_[fd].GetFd());
+    LOG_DEBUG("Client[%d] in!", users_[fd].GetFd());
 }
 
 void WebServer::DealListen_() {
     struct sockaddr_in addr; // 保存连接的客户端的信息
     socklen_t len = sizeof(addr);
+    Admission* admission = Admission::Instance();
     // 如果监听文件描述符设置的是 ET模式(和非阻塞一起使用)，则需要循环把所有连接处理了
     do {
         int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
+        if(fd < 0 && (errno == EMFILE || errno == ENFILE) && spareFd_ >= 0) {
+            // fd用完时连接一直留在accept队列中(ET模式下不会再通知)，用预留的fd接受并拒绝
+            close(spareFd_);
+            fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
+            if(fd >= 0) {
+                Metrics::Instance()->Add(Metrics::SHED_CONNS);
+                Reject_(fd);
+            }
+            spareFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            LOG_WARN("Out of file descriptors!");
+            if(fd < 0) { return; }
+            continue;
+        }
         if(fd <= 0) { return;}
-        else if(HttpConn::userCount >= MAX_FD) {
-            SendError_(fd, "Server busy!");
-            LOG_WARN("Clients is full!");
-            return;
+        else if(HttpConn::userCount >= MAX_FD || admission->Overloaded()) {
+            Metrics::Instance()->Add(Metrics::SHED_CONNS);
+            Reject_(fd);
+            continue;
         }
-        AddClient_(fd, addr);   // 添加客户端
+        int ipSlot;
+        if(!IpLimiter::Instance()->Connect(addr.sin_addr, &ipSlot)) {
+            Reject_(fd, 429);   // 这个IP的并发连接数已达上限
+            continue;
+        }
+        Metrics::Instance()->Add(Metrics::ACCEPTS);
+        AddClient_(fd, addr, ipSlot);   // 添加客户端
     } while(listenEvent_ & EPOLLET);
 }
 
 // 处理读
 void WebServer::DealRead_(HttpConn* client) {
     assert(client);
-    ExtentTime_(client);   // 延长这个客户端的超时时间(延长了60s)
+    if(!ExtentTime_(client)) {   // 延长这个客户端的超时时间(延长了60s)
+        CloseConn_(client);
+        return;
+    }
+    if(client->CanShed() && Admission::Instance()->Overloaded()) {
+        // 新请求在主线程中直接拒绝，不再往积压的线程池里加任务
+        Metrics::Instance()->Add(Metrics::SHED_REQUESTS);
+        Admission::Instance()->Reject(client->GetFd(), true);
+        CloseConn_(client);
+        return;
+    }
+    TRACE_PROBE1(read_queued, client->GetFd());
+    client->MarkReadQueued();
     // 加入到队列中等待线程池中的线程处理（读取数据）
-    threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
+    AddTask_(threadpool_.get(), Metrics::IO_TASK_WAIT, std::bind(&WebServer::OnRead_, this, client));
 }
 
 // 处理写
 void WebServer::DealWrite_(HttpConn* client) {
     assert(client);
-    ExtentTime_(client);// 延长这个客户端的超时时间(延长了60s)
+    if(!ExtentTime_(client)) {  // 延长这个客户端的超时时间(延长了60s)
+        CloseConn_(client);
+        return;
+    }
+    TRACE_PROBE1(write_queued, client->GetFd());
     // 加入到队列中等待线程池中的线程处理（写数据）
-    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+    AddTask_(threadpool_.get(), Metrics::IO_TASK_WAIT, std::bind(&WebServer::OnWrite_, this, client));
+}
+
+void WebServer::AddTask_(ThreadPool* pool, Metrics::HISTOGRAM waitHist, std::function<void()> task) {
+    if(!Metrics::Instance()->IsOpen()) {
+        pool->AddTask(std::move(task));
+        return;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pool->AddTask([waitHist, start, task] {
+        Metrics::Instance()->Observe(waitHist, Metrics::SinceUs(start));
+        task();
+    });
 }
 
-// 延长客户端的超时时间
-void WebServer::ExtentTime_(HttpConn* client) {
+void WebServer::OnTimeout_(HttpConn* client) {
+    if(client->IsVerifying()) {
+        // 连接交给了验证线程，完成后由它重新注册事件；这时关闭会和验证线程争用连接，稍后再检查
+        timer_->add(client->GetFd(), CheckInterval_(client), std::bind(&WebServer::OnTimeout_, this, client));
+        return;
+    }
+    PushConn* push = client->UpgradedPush();
+    if(push) {
+        // WebSocket/SSE连接不因空闲关闭，到期时发ping或心跳；对端失联(上一次的没有回应或写不出去)才关闭
+        // 连接正在工作线程中时不能在主线程关闭，稍后再检查
+        if(push->Ping() || !push->Claim()) {
+            timer_->add(client->GetFd(), push->PingInterval(timeoutMS_),
+                        std::bind(&WebServer::OnTimeout_, this, client));
+            return;
+        }
+    }
+    if(!push) {
+        // 定时器只是按间隔检查，按连接当前的阶段计算真正的期限
+        HttpConn::PHASE phase;
+        int64_t left = TimeLeft_(client, &phase);
+        if(left > 0) {
+            timer_->add(client->GetFd(), std::min(static_cast<int>(left), CheckInterval_(client)),
+                        std::bind(&WebServer::OnTimeout_, this, client));
+            return;
+        }
+        if(phase == HttpConn::WAIT_HEADER) {
+            Metrics::Instance()->Add(Metrics::HEADER_TIMEOUTS);
+            LOG_DEBUG("Client[%d] request header timeout", client->GetFd());
+        }
+    }
+    Metrics::Instance()->Add(Metrics::TIMER_EXPIRED);
+    TRACE_PROBE1(timer_expire, client->GetFd());
+    CloseConn_(client);
+}
+
+std::string WebServer::RenderMetrics_() {
+    std::string out;
+    Metrics::Instance()->Render(out);
+    Metrics::RenderValue(out, "gauge", "webserver_active_connections",
+                         "Open client connections.", HttpConn::userCount);
+    Metrics::RenderValue(out, "gauge", "webserver_threadpool_queue_depth",
+                         "Tasks waiting in the thread pool queue.", threadpool_->QueueSize(), "pool=\"io\"");
+    Metrics::RenderValue(out, "gauge", "webserver_threadpool_queue_depth",
+                         nullptr, authpool_->QueueSize(), "pool=\"auth\"");
+    Metrics::RenderValue(out, "gauge", "webserver_request_body_bytes",
+                         "Request body bytes being received or held by in-flight requests.",
+                         HttpRequest::BodyBytesInFlight());
+    Metrics::RenderValue(out, "gauge", "webserver_overloaded",
+                         "Whether new requests are being shed, by signal.",
+                         Admission::Instance()->QueueOverloaded(), "signal=\"queue_delay\"");
+    Metrics::RenderValue(out, "gauge", "webserver_overloaded", nullptr,
+                         Admission::Instance()->LoadOverloaded(), "signal=\"load\"");
+    KeepAlivePolicy* keepAlive = KeepAlivePolicy::Instance();
+    Metrics::RenderValue(out, "gauge", "webserver_keepalive_idle_timeout_seconds",
+                         "Current keep-alive idle timeout, shortened as load rises.",
+                         keepAlive->IdleTimeout() / 1000.0);
+    Metrics::RenderValue(out, "gauge", "webserver_load_ratio",
+                         "Larger of connections over the fd limit and memory over the memory limit.",
+                         keepAlive->Load());
+    Broadcaster* broadcaster = Broadcaster::Instance();
+    Metrics::RenderValue(out, "gauge", "webserver_websocket_connections",
+                         "Open WebSocket connections.", WebSocketConn::Count());
+    Metrics::RenderValue(out, "gauge", "webserver_sse_connections",
+                         "Open Server-Sent Events connections.", SseConn::Count());
+    // 同一个指标的样本要连在一起
+    const char* help = "Events published to each SSE stream.";
+    for(const auto& kv: HttpConn::sseStreams) {
+        std::string label = "stream=\"" + kv.first + "\"";
+        Metrics::RenderValue(out, "counter", "webserver_sse_events_total", help, kv.second->LastId(), label.c_str());
+        help = nullptr;
+    }
+    help = "Events skipped by SSE subscribers that fell behind the ring buffer.";
+    for(const auto& kv: HttpConn::sseStreams) {
+        std::string label = "stream=\"" + kv.first + "\"";
+        Metrics::RenderValue(out, "counter", "webserver_sse_events_skipped_total", help,
+                             kv.second->Skipped(), label.c_str());
+        help = nullptr;
+    }
+    Metrics::RenderValue(out, "counter", "webserver_websocket_broadcasts_total",
+                         "Messages published to WebSocket topics.", broadcaster->Published());
+    Metrics::RenderValue(out, "counter", "webserver_websocket_broadcast_deliveries_total",
+                         "Per-subscriber deliveries of published messages by result.",
+                         broadcaster->Delivered(), "result=\"queued\"");
+    Metrics::RenderValue(out, "counter", "webserver_websocket_broadcast_deliveries_total",
+                         nullptr, broadcaster->Dropped(), "result=\"dropped\"");
+    Metrics::RenderValue(out, "gauge", "webserver_log_queue_depth",
+                         "Log lines waiting for the async writer.", Log::Instance()->QueueSize());
+    Metrics::RenderValue(out, "counter", "webserver_access_log_dropped_total",
+                         "Access log records dropped because the queue was full.",
+                         AccessLog::Instance()->Dropped());
+    Metrics::RenderValue(out, "counter", "webserver_slow_log_records_total",
+                         "Slow requests by whether they were written or rate limited.",
+                         SlowLog::Instance()->Written(), "result=\"written\"");
+    Metrics::RenderValue(out, "counter", "webserver_slow_log_records_total",
+                         nullptr, SlowLog::Instance()->Suppressed(), "result=\"suppressed\"");
+    if(tlsCtx_) {
+        Metrics::RenderValue(out, "counter", "webserver_tls_handshakes_total",
+                             "TLS handshakes by result.", tlsCtx_->Handshakes() - tlsCtx_->Resumed(),
+                             "result=\"full\"");
+        Metrics::RenderValue(out, "counter", "webserver_tls_handshakes_total",
+                             nullptr, tlsCtx_->Resumed(), "result=\"resumed\"");
+        Metrics::RenderValue(out, "counter", "webserver_tls_handshakes_total",
+                             nullptr, tlsCtx_->Failed(), "result=\"failed\"");
+        Metrics::RenderValue(out, "counter", "webserver_tls_ktls_send_total",
+                             "TLS connections with kernel TLS transmit offload.", tlsCtx_->KtlsSend());
+    }
+    IpLimiter* ipLimiter = IpLimiter::Instance();
+    if(ipLimiter->IsOpen()) {
+        Metrics::RenderValue(out, "counter", "webserver_iplimit_rejected_total",
+                             "Connections and requests rejected with 429 by per-IP limits.",
+                             ipLimiter->ConnRejected(), "limit=\"connections\"");
+        Metrics::RenderValue(out, "counter", "webserver_iplimit_rejected_total",
+                             nullptr, ipLimiter->RequestRejected(), "limit=\"requests\"");
+        Metrics::RenderValue(out, "counter", "webserver_iplimit_table_full_total",
+                             "Connections not tracked because the per-IP table had no free slot.",
+                             ipLimiter->TableFull());
+        Metrics::RenderValue(out, "gauge", "webserver_iplimit_tracked_ips",
+                             "Client IPs with open connections or a partly drained token bucket.",
+                             ipLimiter->Tracked());
+    }
+    CredentialCache* cache = CredentialCache::Instance();
+    Metrics::RenderValue(out, "counter", "webserver_credential_cache_lookups_total",
+                         "Credential cache lookups by result.", cache->Hits(), "result=\"hit\"");
+    Metrics::RenderValue(out, "counter", "webserver_credential_cache_lookups_total",
+                         nullptr, cache->NegativeHits(), "result=\"negative_hit\"");
+    Metrics::RenderValue(out, "counter", "webserver_credential_cache_lookups_total",
+                         nullptr, cache->Misses(), "result=\"miss\"");
+#ifndef NO_MYSQL
+    SqlConnPool::Stats stats = SqlConnPool::Instance()->GetStats();
+    Metrics::RenderValue(out, "gauge", "webserver_sql_conn",
+                         "Database connections by state.", stats.inUse, "state=\"in_use\"");
+    Metrics::RenderValue(out, "gauge", "webserver_sql_conn", nullptr, stats.free, "state=\"free\"");
+    Metrics::RenderValue(out, "gauge", "webserver_sql_conn_max",
+                         "Maximum database connections.", stats.maxConn);
+    Metrics::RenderValue(out, "counter", "webserver_sql_conn_gets_total",
+                         "Database connections handed out.", stats.gets);
+    Metrics::RenderValue(out, "counter", "webserver_sql_conn_timeouts_total",
+                         "Waits for a database connection that timed out.", stats.timeouts);
+    Metrics::RenderValue(out, "counter", "webserver_sql_conn_reconnects_total",
+                         "Database reconnects.", stats.reconnects);
+#endif
+    return out;
+}
+
+// 延长客户端的超时时间；请求头的期限不因收到数据而延长，已经过了期限返回false
+bool WebServer::ExtentTime_(HttpConn* client) {
     assert(client);
-    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
+    if(timeoutMS_ <= 0) { return true; }
+    int interval = CheckInterval_(client);
+    if(!client->UpgradedPush()) {
+        HttpConn::PHASE phase;
+        int64_t left = TimeLeft_(client, &phase);
+        if(phase == HttpConn::WAIT_HEADER) {
+            if(left <= 0) {
+                Metrics::Instance()->Add(Metrics::HEADER_TIMEOUTS);
+                Metrics::Instance()->Add(Metrics::TIMER_EXPIRED);
+                LOG_DEBUG("Client[%d] request header timeout", client->GetFd());
+                return false;
+            }
+            interval = std::min(interval, static_cast<int>(left));
+        }
+    }
+    timer_->adjust(client->GetFd(), interval);
+    return true;
+}
+
+// 连接当前阶段的期限还剩多少毫秒：空闲按(随负载缩短的)空闲超时，等待请求头按请求头期限，
+// 其他时候(收请求体、写响应)按最后一次读写之后timeoutMS_
+int64_t WebServer::TimeLeft_(HttpConn* client, HttpConn::PHASE* phase) {
+    KeepAlivePolicy* policy = KeepAlivePolicy::Instance();
+    int64_t since;
+    *phase = client->Phase(&since);
+    int limit = timeoutMS_;
+    if(*phase == HttpConn::IDLE) {
+        limit = policy->IdleTimeout();
+    } else if(*phase == HttpConn::WAIT_HEADER && policy->HeaderTimeout() > 0) {
+        limit = policy->HeaderTimeout();
+    }
+    return since + limit - KeepAlivePolicy::NowMs();
+}
+
+// 连接的阶段在工作线程中变化，主线程不知道什么时候开始空闲或收到请求头的第一部分，
+// 所以定时器按最短的期限检查，到期时再按阶段计算(OnTimeout_)
+int WebServer::CheckInterval_(HttpConn* client) {
+    if(PushConn* push = client->UpgradedPush()) {
+        return push->PingInterval(timeoutMS_);
+    }
+    KeepAlivePolicy* policy = KeepAlivePolicy::Instance();
+    int interval = std::min(timeoutMS_, policy->IdleTimeout());
+    if(policy->HeaderTimeout() > 0) {
+        interval = std::min(interval, policy->HeaderTimeout());
+    }
+    return interval;
 }
 
 // 这个方法是在子线程中执行的（读取数据）
 void WebServer::OnRead_(HttpConn* client) {
     assert(client);
+    if(!client->IsHandshakeDone() && !OnHandshake_(client)) {
+        return;
+    }
     int ret = -1;
     int readErrno = 0;
     ret = client->read(&readErrno); // 读取客户端的数据
+    TRACE_PROBE2(read_done, client->GetFd(), ret);
     if(ret <= 0 && readErrno != EAGAIN) {
         CloseConn_(client);
         return;
@@ -216,25 +669,86 @@ void WebServer::OnRead_(HttpConn* client) {
     OnProcess(client);
 }
 
+// TLS握手：缺数据时等EPOLLIN，发送缓冲满时等EPOLLOUT；完成后同一任务里接着读请求
+bool WebServer::OnHandshake_(HttpConn* client) {
+    switch(client->Handshake()) {
+    case TlsConn::DONE:
+        return true;
+    case TlsConn::WANT_READ:
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+        return false;
+    case TlsConn::WANT_WRITE:
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+        return false;
+    default:
+        CloseConn_(client);
+        return false;
+    }
+}
+
 // 业务逻辑的处理
 void WebServer::OnProcess(HttpConn* client) {
-    if(client->process()) {
+    bool ret = client->process();
+    if(client->Push()) {
+        ParkPush_(client);
+        return;
+    }
+    if(ret) {
+        if(client->IsVerifyPending()) {
+            // 连接挂起(EPOLLONESHOT未重新注册)，验证完成后由数据库线程注册EPOLLOUT
+            uint32_t token = client->BeginVerify();
+            AddTask_(authpool_.get(), Metrics::AUTH_TASK_WAIT, std::bind(&WebServer::OnVerify_, this, client, token));
+            return;
+        }
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
     } else {
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
     }
 }
 
+// WebSocket/SSE连接处理完一次读写后交还给epoll，关闭握手完成且关闭帧已写出时关闭连接
+void WebServer::ParkPush_(HttpConn* client) {
+    if(client->Push()->IsDone()) {
+        CloseConn_(client);
+        return;
+    }
+    client->Push()->Park();
+}
+
+// 用户验证（查询数据库），完成后恢复连接，写出响应
+void WebServer::OnVerify_(HttpConn* client, uint32_t token) {
+    assert(client);
+    client->Verify();
+    // 先交还给epoll再清除标记：清除之前定时器不会关闭连接，ModFd不会作用于已关闭(可能被复用)的fd；
+    // 交还之后连接可能已经写完响应、开始了下一个验证，这时标记属于新的任务，不清除
+    epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+    client->EndVerify(token);
+}
+
 // 写数据
 void WebServer::OnWrite_(HttpConn* client) {
     assert(client);
+    if(!client->IsHandshakeDone()) {
+        OnRead_(client);    // 握手在等待可写，继续握手
+        return;
+    }
     int ret = -1;
     int writeErrno = 0;
     ret = client->write(&writeErrno);   // 写数据
+    if(client->Push()) {
+        if(ret < 0 && writeErrno != EAGAIN) {
+            CloseConn_(client);
+        } else {
+            ParkPush_(client);
+        }
+        return;
+    }
 
     // 如果将要写的字节等于0，说明写完了，判断是否要保持连接，保持连接继续去处理
     if(client->ToWriteBytes() == 0) {
         /* 传输完成 */
+        TRACE_PROBE3(write_done, client->GetFd(), client->StatusCode(), client->ResponseBytes());
+        client->LogAccess();
         if(client->IsKeepAlive()) {
             OnProcess(client);
             return;
@@ -252,9 +766,41 @@ void WebServer::OnWrite_(HttpConn* client) {
 
 /* Create listenFd */
 bool WebServer::InitSocket_() {
+    // 由旧进程平滑重启时使用它交过来的监听socket(端口还被旧进程占用，不能再bind)
+    listenFd_ = GracefulRestart::Instance()->InheritListenFd();
+    if(listenFd_ >= 0) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        getsockname(listenFd_, (struct sockaddr *)&addr, &len);
+        port_ = ntohs(addr.sin_port);
+    } else if(!CreateListenFd_()) {
+        return false;
+    }
+
+    int ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN);
+    if(ret == 0) {
+        LOG_ERROR("Add listen error!");
+        close(listenFd_);
+        return false;
+    }
+    SetFdNonblock(listenFd_);
+
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wakeFd_ < 0 || !epoller_->AddFd(wakeFd_, EPOLLIN)) {
+        LOG_ERROR("Add wakeup fd error!");
+        close(listenFd_);
+        return false;
+    }
+    GracefulRestart::Instance()->SetWakeFd(wakeFd_);
+    LOG_INFO("Server port:%d", port_);
+    return true;
+}
+
+bool WebServer::CreateListenFd_() {
     int ret;
     struct sockaddr_in addr;
-    if(port_ > 65535 || port_ < 1024) {
+    // 端口为0时由系统分配(压测程序使用)
+    if(port_ > 65535 || (port_ < 1024 && port_ != 0)) {
         LOG_ERROR("Port:%d error!",  port_);
         return false;
     }
@@ -300,21 +846,18 @@ bool WebServer::InitSocket_() {
         return false;
     }
 
+    if(port_ == 0) {
+        socklen_t len = sizeof(addr);
+        getsockname(listenFd_, (struct sockaddr *)&addr, &len);
+        port_ = ntohs(addr.sin_port);
+    }
+
     ret = listen(listenFd_, 6);
     if(ret < 0) {
         LOG_ERROR("Listen port:%d error!", port_);
         close(listenFd_);
         return false;
     }
-
-    ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN);
-    if(ret == 0) {
-        LOG_ERROR("Add listen error!");
-        close(listenFd_);
-        return false;
-    }
-    SetFdNonblock(listenFd_);
-    LOG_INFO("Server port:%d", port_);
     return true;
 }
 
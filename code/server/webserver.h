@@ -9,14 +9,24 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <sys/resource.h>   // getrlimit
+#include <atomic>
+#include <algorithm>
 
 #include "epoller.h"
 #include "../log/log.h"
 #include "../timer/heaptimer.h"
-#include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
-#include "../pool/sqlconnRAII.h"
+#include "../auth/authstore.h"
 #include "../http/httpconn.h"
+#include "../http/broadcaster.h"
+#include "../http/iplimiter.h"
+#include "../metrics/metrics.h"
+#include "../tls/tlscontext.h"
+#include "admission.h"
+#include "restart.h"
 
 class WebServer {
 public:
@@ -24,45 +34,82 @@ public:
         int port, int trigMode, int timeoutMS, bool OptLinger, 
         int sqlPort, const char* sqlUser, const  char* sqlPwd, 
         const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize);
+        bool openLog, int logLevel, int logQueSize,
+        bool openAccessLog = false, int accessLogFormat = 0, double accessLogSample = 1.0,
+        bool sqlLazyInit = true, const char* authStorePath = nullptr,
+        bool openMetrics = false, int slowLogMs = 0, int slowLogPerSec = 10,
+        const char* tlsCert = nullptr, const char* tlsKey = nullptr,
+        int maxBodyMB = 100, int maxBodyTotalMB = 1024,
+        int keepAliveMax = 0, int headerTimeoutMS = 0, int memLimitMB = 0,
+        int shedDelayMs = 0, int ipMaxConns = 0, int ipRps = 0, int ipBurst = 0,
+        int drainTimeoutMS = 10000);
 
     ~WebServer();
     void Start();
+    void Stop();    // 可在其他线程调用，唤醒epoll_wait，Start()返回
+    int Port() const { return port_; }  // 端口为0时是系统分配的端口
 
 private:
     bool InitSocket_(); 
+    bool CreateListenFd_();
     void InitEventMode_(int trigMode);
-    void AddClient_(int fd, sockaddr_in addr);
+    void AddClient_(int fd, sockaddr_in addr, int ipSlot);
   
     void DealListen_();
     void DealWrite_(HttpConn* client);
     void DealRead_(HttpConn* client);
 
-    void SendError_(int fd, const char*info);
-    void ExtentTime_(HttpConn* client);
+    void Reject_(int fd, int code = 503);   // 过载(503)或单个IP连接过多(429)：回复后关闭，不进线程池
+    bool ExtentTime_(HttpConn* client);
+    int CheckInterval_(HttpConn* client);  // 定时器检查连接的间隔
+    int64_t TimeLeft_(HttpConn* client, HttpConn::PHASE* phase);
     void CloseConn_(HttpConn* client);
 
     void OnRead_(HttpConn* client);  // 子线程中执行
     void OnWrite_(HttpConn* client);  // 子线程中执行
     void OnProcess(HttpConn* client);  // 子线程中执行
+    void ParkPush_(HttpConn* client);  // 子线程中执行
+    void OnVerify_(HttpConn* client, uint32_t token);  // 验证线程中执行，token为BeginVerify的返回值
+    bool OnHandshake_(HttpConn* client);  // 推进TLS握手，完成返回true，否则重新注册事件或关闭连接
+    void OnTimeout_(HttpConn* client);  // 定时器到期，主线程中执行
+    void OnSignal_();   // 平滑重启/退出的信号，主线程中执行
+    void Drain_();      // 停止accept，处理完进行中的请求后退出
+    void CloseIdle_();  // 平滑退出时关闭空闲的连接
+
+    // 投递任务，开启指标时记录任务在队列中的等待时间
+    void AddTask_(ThreadPool* pool, Metrics::HISTOGRAM waitHist, std::function<void()> task);
+    std::string RenderMetrics_();   // /metrics的响应体，在工作线程中执行
 
     static const int MAX_FD = 65536;    // 最大的文件描述符的个数
+    static const int DRAIN_CHECK_MS = 100;  // 平滑退出时检查连接的间隔
+    // 平滑退出时长连接空闲超过它才关闭；正在连续发请求的客户端在下一个响应中收到Connection: close，
+    // 不会在发出请求的同时遇到连接被关闭
+    static const int DRAIN_IDLE_MS = 1000;
 
     static int SetFdNonblock(int fd);   // 设置文件描述符非阻塞
 
     int port_;          // 端口
     bool openLinger_;   // 是否打开优雅关闭
-    int timeoutMS_;     // 定时时间
-    bool isClose_;      // 是否关闭
+    int timeoutMS_;     // 定时时间(读写之间的超时，也是负载低时长连接的空闲超时)
+    std::atomic<bool> isClose_;      // 是否关闭
     int listenFd_;      // 监听的文件描述符
+    int wakeFd_;        // Stop()通过eventfd唤醒epoll_wait
+    int spareFd_;       // 预留的fd：fd用完时关闭它，腾出一个fd接受连接、回复503
+    int restartFd_;     // 平滑重启：等待新进程就绪通知的socket
+    int drainTimeoutMS_;    // 平滑退出时等待进行中的请求的期限
+    int64_t drainDeadline_; // 非0时正在平滑退出
+    int64_t lastSweep_;     // 上一次检查空闲连接的时间
     char* srcDir_;      // 资源的目录
     
     uint32_t listenEvent_;  // 监听的文件描述符的事件
     uint32_t connEvent_;    // 连接的文件描述符的事件
    
     std::unique_ptr<HeapTimer> timer_;  // 定时器
+    std::unique_ptr<AuthStore> authStore_;      // 用户验证的存储后端，在验证线程池之后析构
     std::unique_ptr<ThreadPool> threadpool_;    // 线程池
+    std::unique_ptr<ThreadPool> authpool_;      // 验证线程池，专门执行用户验证(访问数据库)，避免阻塞I/O线程
     std::unique_ptr<Epoller> epoller_;      // epoll对象
+    std::unique_ptr<TlsContext> tlsCtx_;    // 开启TLS时所有连接共用的SSL_CTX(证书、会话缓存、票据密钥)
     std::unordered_map<int, HttpConn> users_;   // 保存的是客户端连接的信息，通过文件描述符进行映射
 };
 
@@ -0,0 +1,136 @@
+#include "tlsconn.h"
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include "../log/log.h"
+
+#ifndef NO_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+TlsConn::TlsConn(TlsContext* ctx, int fd): ctx_(ctx), ssl_(nullptr), established_(false), ktlsSend_(false) {
+    assert(ctx && ctx->Get());
+    ssl_ = SSL_new(ctx->Get());
+    if(ssl_) {
+        SSL_set_fd(ssl_, fd);
+        SSL_set_accept_state(ssl_);
+    }
+}
+
+TlsConn::~TlsConn() {
+    if(ssl_) { SSL_free(ssl_); }
+}
+
+TlsConn::HANDSHAKE TlsConn::Handshake() {
+    if(!ssl_) { return FAILED; }
+    ERR_clear_error();  // 错误队列是线程局部的，先清掉同一线程上其他连接留下的错误
+    int ret = SSL_do_handshake(ssl_);
+    if(ret == 1) {
+        established_ = true;
+#ifdef BIO_get_ktls_send    // OpenSSL 3.0起才有内核TLS
+        ktlsSend_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+#endif
+        ctx_->CountHandshake(true, SSL_session_reused(ssl_), ktlsSend_);
+        LOG_DEBUG("TLS handshake done: %s %s, resumed: %d, ktls send: %d",
+                  SSL_get_version(ssl_), SSL_get_cipher_name(ssl_),
+                  SSL_session_reused(ssl_), (int)ktlsSend_);
+        return DONE;
+    }
+    int err = SSL_get_error(ssl_, ret);
+    if(err == SSL_ERROR_WANT_READ) { return WANT_READ; }
+    if(err == SSL_ERROR_WANT_WRITE) { return WANT_WRITE; }
+    char buf[256];
+    ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+    LOG_WARN("TLS handshake failed: %d %s", err, buf);
+    ctx_->CountHandshake(false, false, false);
+    return FAILED;
+}
+
+ssize_t TlsConn::Read(Buffer& buff, int* saveErrno, size_t maxLen) {
+    static const int READ_CHUNK = 16384;    // 一条TLS记录的最大明文长度
+    ssize_t total = 0;
+    ERR_clear_error();
+    while(true) {
+        buff.EnsureWriteable(READ_CHUNK);
+        int n = SSL_read(ssl_, buff.BeginWrite(), READ_CHUNK);
+        if(n > 0) {
+            buff.HasWritten(n);
+            total += n;
+            if(buff.ReadableBytes() >= maxLen && SSL_pending(ssl_) == 0) {
+                *saveErrno = 0;
+                return total;
+            }
+            continue;
+        }
+        int err = SSL_get_error(ssl_, n);
+        if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            *saveErrno = EAGAIN;
+        } else if(err == SSL_ERROR_ZERO_RETURN) {
+            *saveErrno = 0;     // 对端发了close_notify
+            return total;
+        } else {
+            *saveErrno = (err == SSL_ERROR_SYSCALL && errno) ? errno : EIO;
+        }
+        return total > 0 ? total : -1;
+    }
+}
+
+ssize_t TlsConn::Writev(const struct iovec* iov, int iovCnt) {
+    // 响应头、HTTP/2帧头这类小块先拼起来，避免每块单独成为一条TLS记录
+    // 拼接只取决于iov的内容，重试被WANT_WRITE打断的SSL_write时得到同样的数据
+    static const size_t COALESCE = 16384;
+    char buf[COALESCE];
+    ssize_t total = 0;
+    int i = 0;
+    ERR_clear_error();
+    while(i < iovCnt) {
+        const char* data = static_cast<const char*>(iov[i].iov_base);
+        size_t len = iov[i].iov_len;
+        int next = i + 1;
+        if(len < COALESCE) {
+            len = 0;
+            for(; i < iovCnt && len + iov[i].iov_len <= COALESCE; i++) {
+                memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+                len += iov[i].iov_len;
+            }
+            data = buf;
+            next = i;
+        }
+        if(len == 0) {
+            i = next;
+            continue;
+        }
+        int n = SSL_write(ssl_, data, len > INT32_MAX ? INT32_MAX : len);
+        if(n <= 0) {
+            int err = SSL_get_error(ssl_, n);
+            if(err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+                errno = EAGAIN;
+            } else if(err != SSL_ERROR_SYSCALL || errno == 0) {
+                errno = EIO;
+            }
+            return total > 0 ? total : -1;
+        }
+        total += n;
+        if(static_cast<size_t>(n) < len) { break; }   // 部分写，调用者前移iov后再写
+        i = next;
+    }
+    return total;
+}
+
+void TlsConn::Shutdown() {
+    if(ssl_ && established_) {
+        ERR_clear_error();
+        SSL_shutdown(ssl_);     // 非阻塞，写不出去就放弃
+    }
+}
+
+#else
+
+TlsConn::TlsConn(TlsContext* ctx, int): ctx_(ctx), ssl_(nullptr), established_(false), ktlsSend_(false) {}
+TlsConn::~TlsConn() {}
+TlsConn::HANDSHAKE TlsConn::Handshake() { return FAILED; }
+ssize_t TlsConn::Read(Buffer&, int* saveErrno, size_t) { *saveErrno = EIO; return -1; }
+ssize_t TlsConn::Writev(const struct iovec*, int) { errno = EIO; return -1; }
+void TlsConn::Shutdown() {}
+
+#endif
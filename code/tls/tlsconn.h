@@ -0,0 +1,46 @@
+#ifndef TLS_CONN_H
+#define TLS_CONN_H
+
+#include <sys/types.h>
+#include <sys/uio.h>     // iovec
+#include <stdint.h>      // SIZE_MAX
+
+#include "../buffer/buffer.h"
+#include "tlscontext.h"
+
+typedef struct ssl_st SSL;
+
+// 一个连接的TLS会话(非阻塞socket)：握手、读、写
+// 内核TLS发送(kTLS)生效后，调用者直接对fd用writev，文件内容不再经过用户态加密
+class TlsConn {
+public:
+    enum HANDSHAKE {
+        DONE = 0,
+        WANT_READ,      // 等待EPOLLIN后继续
+        WANT_WRITE,     // 等待EPOLLOUT后继续
+        FAILED,
+    };
+
+    TlsConn(TlsContext* ctx, int fd);
+    ~TlsConn();
+
+    HANDSHAKE Handshake();
+    bool IsEstablished() const { return established_; }
+    bool KtlsSend() const { return ktlsSend_; }
+
+    // 读出已到达的数据，读缓冲区超过maxLen且OpenSSL内部没有缓冲的明文时提前返回(剩下的仍在socket中)
+    // 返回读到的字节数，没有更多数据时saveErrno为EAGAIN，对端关闭返回0，出错返回-1
+    ssize_t Read(Buffer& buff, int* saveErrno, size_t maxLen = SIZE_MAX);
+    // 与writev语义相同：返回写出的字节数，写不进去时返回-1且errno为EAGAIN
+    ssize_t Writev(const struct iovec* iov, int iovCnt);
+
+    void Shutdown();    // 发送close_notify(不等待对端回应)
+
+private:
+    TlsContext* ctx_;
+    SSL* ssl_;
+    bool established_;
+    bool ktlsSend_;
+};
+
+#endif //TLS_CONN_H
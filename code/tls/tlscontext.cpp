@@ -0,0 +1,97 @@
+#include "tlscontext.h"
+#include "../log/log.h"
+
+#ifndef NO_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+TlsContext::TlsContext(): ctx_(nullptr), handshakes_(0), resumed_(0), failed_(0), ktlsSend_(0) {}
+
+TlsContext::~TlsContext() {
+#ifndef NO_TLS
+    if(ctx_) { SSL_CTX_free(ctx_); }
+#endif
+}
+
+void TlsContext::CountHandshake(bool ok, bool resumed, bool ktlsSend) {
+    if(!ok) {
+        failed_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    handshakes_.fetch_add(1, std::memory_order_relaxed);
+    if(resumed) { resumed_.fetch_add(1, std::memory_order_relaxed); }
+    if(ktlsSend) { ktlsSend_.fetch_add(1, std::memory_order_relaxed); }
+}
+
+#ifndef NO_TLS
+
+// ALPN：客户端同时支持时优先h2，之后的连接前言由HttpConn识别
+static int SelectAlpn(SSL*, const unsigned char** out, unsigned char* outLen,
+                      const unsigned char* in, unsigned int inLen, void*) {
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+    unsigned char* selected = nullptr;
+    if(SSL_select_next_proto(&selected, outLen, protos, sizeof(protos) - 1, in, inLen)
+            != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static void LogSslError(const char* what, const char* file) {
+    char err[256];
+    ERR_error_string_n(ERR_get_error(), err, sizeof(err));
+    LOG_ERROR("TLS %s %s error: %s", what, file ? file : "", err);
+}
+
+bool TlsContext::Init(const char* certFile, const char* keyFile) {
+    assert(certFile && keyFile);
+    ctx_ = SSL_CTX_new(TLS_server_method());
+    if(!ctx_) {
+        LogSslError("SSL_CTX_new", nullptr);
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+    long options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+#ifdef SSL_OP_ENABLE_KTLS
+    options |= SSL_OP_ENABLE_KTLS;              // 内核有tls模块且套件支持时，握手后把密钥交给内核
+#endif
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    options |= SSL_OP_IGNORE_UNEXPECTED_EOF;    // 客户端不发close_notify直接断开按正常关闭处理
+#endif
+    SSL_CTX_set_options(ctx_, options);
+    // 非阻塞写：写出部分记录就返回；重试时缓冲区地址可以变化(iov已前移)；空闲连接释放读写缓冲
+    SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                           SSL_MODE_RELEASE_BUFFERS);
+
+    if(SSL_CTX_use_certificate_chain_file(ctx_, certFile) != 1) {
+        LogSslError("certificate", certFile);
+        return false;
+    }
+    if(SSL_CTX_use_PrivateKey_file(ctx_, keyFile, SSL_FILETYPE_PEM) != 1 ||
+       SSL_CTX_check_private_key(ctx_) != 1) {
+        LogSslError("private key", keyFile);
+        return false;
+    }
+
+    // 会话恢复：TLS1.2的会话ID和会话票据(TLS1.3只用票据)都由这个SSL_CTX管理
+    // 票据密钥在SSL_CTX创建时随机生成，所有连接共用，进程重启后旧票据失效(退化为完整握手)
+    static const unsigned char sidCtx[] = "webserver";
+    SSL_CTX_set_session_id_context(ctx_, sidCtx, sizeof(sidCtx) - 1);
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx_, 20480);
+    SSL_CTX_set_timeout(ctx_, 3600);
+
+    SSL_CTX_set_alpn_select_cb(ctx_, SelectAlpn, nullptr);
+    return true;
+}
+
+#else
+
+bool TlsContext::Init(const char*, const char*) {
+    LOG_ERROR("TLS is not compiled in (built with WITH_TLS=0)");
+    return false;
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <atomic>
+#include <stdint.h>
+
+typedef struct ssl_ctx_st SSL_CTX;
+
+// 一个WebServer(reactor)共用一个SSL_CTX：证书、会话缓存和会话票据密钥在所有连接间共享
+// 开启SSL_OP_ENABLE_KTLS，内核支持时握手后由内核加密发送；ALPN优先选择h2
+// 编译时定义NO_TLS(make WITH_TLS=0)则不链接OpenSSL，Init总是失败
+class TlsContext {
+public:
+    TlsContext();
+    ~TlsContext();
+
+    bool Init(const char* certFile, const char* keyFile);
+    SSL_CTX* Get() const { return ctx_; }
+
+    // 握手结果统计，由各连接在握手结束时记录
+    void CountHandshake(bool ok, bool resumed, bool ktlsSend);
+    uint64_t Handshakes() const { return handshakes_.load(std::memory_order_relaxed); }
+    uint64_t Resumed() const { return resumed_.load(std::memory_order_relaxed); }
+    uint64_t Failed() const { return failed_.load(std::memory_order_relaxed); }
+    uint64_t KtlsSend() const { return ktlsSend_.load(std::memory_order_relaxed); }
+
+private:
+    SSL_CTX* ctx_;
+    std::atomic<uint64_t> handshakes_;  // 成功的握手(含恢复)
+    std::atomic<uint64_t> resumed_;     // 通过会话票据/会话缓存恢复的握手
+    std::atomic<uint64_t> failed_;
+    std::atomic<uint64_t> ktlsSend_;    // 启用内核TLS发送的连接
+};
+
+#endif //TLS_CONTEXT_H
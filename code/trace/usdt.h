@@ -0,0 +1,33 @@
+#ifndef USDT_H
+#define USDT_H
+
+/* 请求生命周期上的静态探针(USDT)，提供者为webserver
+ * 安装了systemtap-sdt-dev(<sys/sdt.h>)时每个探针编译成一条nop，只有bpftrace/perf挂上后才有开销；
+ * 没有该头文件或 make WITH_USDT=0 时为空宏，参数不求值。用法见 tools/bpftrace
+ *
+ *   accept(fd, ip, port)             新连接，ip为网络字节序
+ *   read_queued(fd) / read_done(fd, bytes)
+ *   parse_done(fd, ok, path)         path为char*
+ *   verify_done(fd)                  登录/注册验证完成(验证线程)
+ *   response_built(fd, status, bytes)
+ *   write_queued(fd) / write_done(fd, status, bytes)
+ *   timer_expire(fd) / close(fd)
+ */
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define WEBSERVER_USDT 1
+#endif
+#endif
+
+#ifdef WEBSERVER_USDT
+#define TRACE_PROBE1(name, a1)          DTRACE_PROBE1(webserver, name, a1)
+#define TRACE_PROBE2(name, a1, a2)      DTRACE_PROBE2(webserver, name, a1, a2)
+#define TRACE_PROBE3(name, a1, a2, a3)  DTRACE_PROBE3(webserver, name, a1, a2, a3)
+#else
+#define TRACE_PROBE1(name, a1)          do {} while(0)
+#define TRACE_PROBE2(name, a1, a2)      do {} while(0)
+#define TRACE_PROBE3(name, a1, a2, a3)  do {} while(0)
+#endif
+
+#endif //USDT_H
@@ -5,6 +5,33 @@
  */ 
 #include "../code/log/log.h"
 #include "../code/pool/threadpool.h"
+#include "../code/auth/credcache.h"
+#include "../code/auth/fileauthstore.h"
+#include "../code/metrics/metrics.h"
+#include "../code/log/slowlog.h"
+#include "../code/log/accesslog.h"
+#include "../code/http/hpack.h"
+#include "../code/http/http2conn.h"
+#include "../code/http/httprequest.h"
+#include "../code/http/httpresponse.h"
+#include "../code/http/broadcaster.h"
+#include "../code/http/sse.h"
+#include "../code/http/keepalive.h"
+#include "../code/http/iplimiter.h"
+#include "../code/http/httpconn.h"
+#include "../code/server/restart.h"
+#ifndef NO_TLS
+#include "../code/tls/tlsconn.h"
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+#endif
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
 #include <features.h>
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
@@ -48,9 +75,828 @@ void TestThreadPool() {
         threadpool.AddTask(std::bind(ThreadLogTask, i % 4, i * 10000));
     }
     getchar();
+    threadpool.Close();     // 等队列中的任务都执行完
+    std::atomic<int> done(0);
+    ThreadPool pool(2);
+    for(int i = 0; i < 8; i++) {
+        pool.AddTask([&done] { usleep(1000); done++; });
+    }
+    pool.Close();
+    assert(done == 8);
+}
+
+void TestCredentialCache() {
+    CredentialCache* cache = CredentialCache::Instance();
+    cache->Init(4, 1000, 1000, 1);
+    bool match = false;
+    assert(cache->Lookup("alice", "123", match) == CredentialCache::MISS);
+    cache->Put("alice", "123");
+    assert(cache->Lookup("alice", "123", match) == CredentialCache::USER_EXISTS && match);
+    assert(cache->Lookup("alice", "456", match) == CredentialCache::USER_EXISTS && !match);
+    cache->PutAbsent("bob");
+    assert(cache->Lookup("bob", "", match) == CredentialCache::USER_ABSENT);
+    cache->Put("bob", "pwd");   // 注册写穿覆盖负缓存
+    assert(cache->Lookup("bob", "pwd", match) == CredentialCache::USER_EXISTS && match);
+    for(int i = 0; i < 8; i++) {
+        cache->Put("user" + std::to_string(i), "x");
+    }
+    assert(cache->Size() == 4);  // 超出容量淘汰最久未使用的
+    assert(cache->Lookup("alice", "123", match) == CredentialCache::MISS);
+    printf("CredentialCache hits:%llu misses:%llu\n",
+           (unsigned long long)cache->Hits(), (unsigned long long)cache->Misses());
+}
+
+void TestFileAuthStore() {
+    unlink("./testauth/user.db");
+    {
+        FileAuthStore store("./testauth/user.db", 4);
+        assert(store.IsReady());
+        std::string pwd;
+        assert(store.Lookup("alice", pwd) == 0);
+        assert(store.Insert("alice", "123"));
+        assert(!store.Insert("alice", "456"));  // 用户名已存在
+        for(int i = 0; i < 100; i++) {          // 触发扩容
+            assert(store.Insert("user" + std::to_string(i), std::to_string(i)));
+        }
+        assert(store.Lookup("alice", pwd) == 1 && pwd == "123");
+        assert(store.Lookup("user42", pwd) == 1 && pwd == "42");
+    }
+    /* 模拟写到一半崩溃：尾部追加不完整的记录 */
+    FILE* fp = fopen("./testauth/user.db", "a");
+    fputs("broken", fp);
+    fclose(fp);
+    FileAuthStore store("./testauth/user.db");
+    std::string pwd;
+    assert(store.Size() == 101);
+    assert(store.Lookup("user99", pwd) == 1 && pwd == "99");
+    assert(store.Insert("bob", "pwd"));
+    printf("FileAuthStore users:%d\n", (int)store.Size());
+}
+
+void TestMetrics() {
+    Metrics* metrics = Metrics::Instance();
+    metrics->Init();
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++) {
+        threads.emplace_back([metrics] {   // 每个线程写自己的分片
+            for(int i = 0; i < 1000; i++) {
+                metrics->Add(Metrics::REQUESTS);
+                metrics->Observe(Metrics::PARSE, i < 500 ? 10 : 5000000);
+            }
+        });
+    }
+    for(auto& t: threads) { t.join(); }
+    assert(metrics->Counter(Metrics::REQUESTS) == 4000);
+    Metrics::HistogramValue value = metrics->Histogram(Metrics::PARSE);
+    assert(value.count == 4000);
+    assert(value.buckets[0] == 2000 && value.buckets[Metrics::BUCKET_COUNT - 1] == 2000);
+    std::string out;
+    metrics->Render(out);
+    assert(out.find("webserver_requests_total 4000\n") != std::string::npos);
+    assert(out.find("webserver_request_parse_seconds_bucket{le=\"+Inf\"} 4000\n") != std::string::npos);
+    printf("Metrics rendered %d bytes\n", (int)out.size());
+}
+
+void TestSlowLog() {
+    remove("./testlog_slow/slow.log");
+    SlowLog* slowLog = SlowLog::Instance();
+    slowLog->init(0, 2, "./testlog_slow", "slow.log", 4);
+    RequestPhases phases;
+    phases.queued = phases.dequeued = phases.firstRead = std::chrono::steady_clock::now();
+    phases.parsed = phases.built = phases.firstWrite = phases.firstRead + std::chrono::milliseconds(1);
+    phases.lastWrite = phases.firstWrite + std::chrono::milliseconds(30);
+    SlowLog::Record rec = {{htonl(INADDR_LOOPBACK)}, 50000, 5, "GET", "/index.html", 200, 1024, &phases};
+    int written = 0;
+    for(int i = 0; i < 3; i++) {    // 每秒最多2条
+        written += slowLog->write(rec) ? 1 : 0;
+    }
+    assert(written == 2 || slowLog->Suppressed() == 0);  // 跨秒时限流窗口重置
+    struct stat st;
+    assert(stat("./testlog_slow/slow.log", &st) == 0 && st.st_size == written * SlowLog::SLOT_SIZE);
+    printf("SlowLog written:%d suppressed:%d\n", written, (int)slowLog->Suppressed());
+}
+
+// RFC 7541 附录C.4：带Huffman编码的连续两个请求，第二个引用第一个插入动态表的条目
+// 等异步写线程写出一行，返回文件内容
+static std::string ReadAccessLog(const char* name) {
+    std::string content;
+    for(int i = 0; i < 200 && (content.empty() || content.back() != '\n'); i++) {
+        usleep(5000);
+        AccessLog::Instance()->flush();
+        content.clear();
+        FILE* fp = fopen(name, "r");
+        if(!fp) { continue; }
+        char buf[512];
+        for(size_t len; (len = fread(buf, 1, sizeof(buf), fp)) > 0; ) { content.append(buf, len); }
+        fclose(fp);
+    }
+    return content;
+}
+
+void TestAccessLog() {
+    BlockDeque<std::string> deque(2);
+    std::string a = "a", b = "b", c = "c";
+    assert(deque.try_push_back(std::move(a)) && deque.try_push_back(std::move(b)));
+    assert(!deque.try_push_back(std::move(c)) && c == "c" && deque.size() == 2);   // 满时不阻塞，不移走
+
+    AccessLog::Record rec = {};
+    inet_pton(AF_INET, "127.0.0.1", &rec.addr);
+    rec.method = "GET";
+    rec.path = "/a\"b";
+    rec.version = "1.1";
+    rec.referer = "";
+    rec.userAgent = "curl/8";
+    rec.status = 200;
+    rec.bytes = 1234;
+    rec.durationUs = 56;
+    const char* names[] = { "clf.log", "combined.log", "json.log" };
+    const char* expect[] = {
+        "] \"GET /a\\\"b HTTP/1.1\" 200 1234 56\n",
+        "] \"GET /a\\\"b HTTP/1.1\" 200 1234 \"-\" \"curl/8\" 56\n",
+        "\",\"ip\":\"127.0.0.1\",\"method\":\"GET\",\"path\":\"/a\\\"b\",\"version\":\"1.1\",\"status\":200,"
+        "\"bytes\":1234,\"duration_us\":56,\"referer\":\"-\",\"user_agent\":\"curl/8\"}\n",
+    };
+    AccessLog* log = AccessLog::Instance();
+    for(int format = AccessLog::CLF; format <= AccessLog::JSON; format++) {
+        std::string path = std::string("./testlog_access/") + names[format];
+        remove(path.c_str());
+        log->init("./testlog_access", names[format], format);
+        log->write(rec);
+        std::string line = ReadAccessLog(path.c_str());
+        size_t pos = line.size() - strlen(expect[format]);
+        assert(line.size() > strlen(expect[format]) && line.compare(pos, std::string::npos, expect[format]) == 0);
+        assert(line.compare(0, format == AccessLog::JSON ? 9 : 15,
+                            format == AccessLog::JSON ? "{\"time\":\"" : "127.0.0.1 - - [") == 0);
+    }
+
+    // 采样：0全部不记录，1全部记录，0.25约四分之一
+    log->init("./testlog_access", "json.log", AccessLog::JSON, 0.0);
+    assert(!log->Sample());
+    log->init("./testlog_access", "json.log", AccessLog::JSON, 1.0);
+    assert(log->Sample());
+    log->init("./testlog_access", "json.log", AccessLog::JSON, 0.25);
+    int sampled = 0;
+    for(int i = 0; i < 100000; i++) { sampled += log->Sample(); }
+    assert(sampled > 22000 && sampled < 28000);
+    log->init("./testlog_access", "json.log", AccessLog::JSON, 0.0);
+    printf("AccessLog ok, sampled %d/100000\n", sampled);
+}
+
+void TestHpack() {
+    const uint8_t req1[] = {0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a,
+                            0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff};
+    const uint8_t req2[] = {0x82, 0x86, 0x84, 0xbe, 0x58, 0x86, 0xa8, 0xeb, 0x10, 0x64, 0x9c, 0xbf};
+    HpackDecoder decoder;
+    HeaderList headers;
+    assert(decoder.Decode(req1, sizeof(req1), headers));
+    assert(headers.size() == 4 && headers[3].first == ":authority" && headers[3].second == "www.example.com");
+    assert(decoder.TableSize() == 57);
+    headers.clear();
+    assert(decoder.Decode(req2, sizeof(req2), headers));
+    assert(headers.size() == 5 && headers[3].second == "www.example.com");
+    assert(headers[4].first == "cache-control" && headers[4].second == "no-cache");
+    assert(decoder.TableSize() == 110);
+
+    // 编码后再解码得到同样的头部
+    HeaderList resp = {{":status", "200"}, {"content-type", "text/css"}, {"x-custom", "v"}};
+    std::string block;
+    HpackEncoder::Encode(resp, block);
+    HpackDecoder decoder2;
+    headers.clear();
+    assert(decoder2.Decode(reinterpret_cast<const uint8_t*>(block.data()), block.size(), headers));
+    assert(headers == resp);
+
+    // 一个接近4KB(动态表能放下)的带索引字面量之后，每个字节0xbe都引用这个条目：解码后的头部列表超过上限即失败
+    std::string bomb = "\x40";
+    HpackEncoder::EncodeString(bomb, "x-big");
+    HpackEncoder::EncodeString(bomb, std::string(4000, 'a'));
+    bomb.append(60000, '\xbe');
+    HpackDecoder decoder3;
+    headers.clear();
+    assert(!decoder3.Decode(reinterpret_cast<const uint8_t*>(bomb.data()), bomb.size(), headers));
+    assert(decoder3.TableSize() == 4037 && headers.size() == 16);  // 17 * (5 + 4000 + 32) > 64KB
+    printf("Hpack ok, encoded %d bytes\n", (int)block.size());
+}
+
+static std::string H2Frame(uint8_t type, uint8_t flags, uint32_t streamId, const std::string& payload) {
+    std::string frame;
+    frame += static_cast<char>(payload.size() >> 16);
+    frame += static_cast<char>(payload.size() >> 8);
+    frame += static_cast<char>(payload.size());
+    frame += static_cast<char>(type);
+    frame += static_cast<char>(flags);
+    for(int shift = 24; shift >= 0; shift -= 8) { frame += static_cast<char>(streamId >> shift); }
+    return frame + payload;
+}
+
+struct H2FrameOut {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t streamId;
+    std::string payload;
+};
+
+// 写出连接的全部待发送数据，按帧拆开
+static std::vector<H2FrameOut> DrainH2Frames(Http2Conn& conn) {
+    std::string out;
+    struct iovec iov[64];
+    for(int cnt; (cnt = conn.FillIov(iov, 64)) > 0; ) {
+        size_t len = 0;
+        for(int i = 0; i < cnt; i++) {
+            out.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+            len += iov[i].iov_len;
+        }
+        conn.Consume(len);
+    }
+    std::vector<H2FrameOut> frames;
+    for(size_t pos = 0; pos + 9 <= out.size(); ) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(out.data() + pos);
+        size_t len = (p[0] << 16) | (p[1] << 8) | p[2];
+        uint32_t streamId = (p[5] & 0x7f) << 24 | p[6] << 16 | p[7] << 8 | p[8];
+        frames.push_back(H2FrameOut{p[3], p[4], streamId, out.substr(pos + 9, len)});
+        pos += 9 + len;
+    }
+    return frames;
+}
+
+// 返回流1的DATA负载字节数，收到END_STREAM时设置*end
+static size_t DrainH2(Http2Conn& conn, bool* end) {
+    size_t data = 0;
+    for(const H2FrameOut& frame: DrainH2Frames(conn)) {
+        if(frame.type == Http2Conn::DATA && frame.streamId == 1) {
+            data += frame.payload.size();
+            if(frame.flags & 0x1) { *end = true; }
+        }
+    }
+    return data;
+}
+
+void TestHttp2Stream() {
+    // 分段生成的响应按发送窗口逐段取：窗口耗尽时不再调用生产者，WINDOW_UPDATE后继续
+    int calls = 0;
+    std::unordered_map<std::string, StreamHandler> handlers;
+    handlers["/gen"] = StreamHandler{"text/plain", [&calls](const HttpRequest&) {
+        return BodyProducer([&calls](std::string& chunk) {
+            chunk.assign(20000, static_cast<char>('a' + calls));
+            return ++calls < 10;
+        });
+    }};
+    Http2Conn conn("", sockaddr_in(), nullptr, &handlers);
+    HeaderList req = {{":method", "GET"}, {":scheme", "http"}, {":path", "/gen"}, {":authority", "t"}};
+    std::string block;
+    HpackEncoder::Encode(req, block);
+    Buffer buff;
+    buff.Append(std::string(Http2Conn::PREFACE, Http2Conn::PREFACE_LEN));
+    buff.Append(H2Frame(Http2Conn::SETTINGS, 0, 0, ""));
+    buff.Append(H2Frame(Http2Conn::HEADERS, 0x4 | 0x1, 1, block));
+    assert(conn.Process(buff));
+    bool end = false;
+    size_t sent = DrainH2(conn, &end);
+    assert(sent == 65535 && !end && calls == 4);    // 默认窗口65535字节，只取了4段
+
+    std::string inc = {'\0', '\x10', '\0', '\0'};  // 1MB
+    buff.Append(H2Frame(Http2Conn::WINDOW_UPDATE, 0, 0, inc));
+    buff.Append(H2Frame(Http2Conn::WINDOW_UPDATE, 0, 1, inc));
+    conn.Process(buff);
+    sent += DrainH2(conn, &end);
+    assert(sent == 200000 && end && calls == 10);
+    printf("Http2Stream ok\n");
+}
+
+void TestHttp2Body() {
+    // 请求体计入单个请求的上限，流的窗口在计入之后才归还；超过上限时提前回413，之后让对端停止发送
+    size_t maxBody = HttpRequest::maxBodySize;
+    size_t inFlight = HttpRequest::BodyBytesInFlight();
+    HttpRequest::maxBodySize = 100000;
+    {
+        Http2Conn conn("./", sockaddr_in());
+        HeaderList req = {{":method", "POST"}, {":scheme", "http"}, {":path", "/upload"}, {":authority", "t"}};
+        std::string block;
+        HpackEncoder::Encode(req, block);
+        Buffer buff;
+        buff.Append(std::string(Http2Conn::PREFACE, Http2Conn::PREFACE_LEN));
+        buff.Append(H2Frame(Http2Conn::SETTINGS, 0, 0, ""));
+        buff.Append(H2Frame(Http2Conn::HEADERS, 0x4, 1, block));
+        std::string chunk(16384, 'x');
+        for(int i = 0; i < 4; i++) { buff.Append(H2Frame(Http2Conn::DATA, 0, 1, chunk)); }
+        conn.Process(buff);
+        int streamUpdates = 0;
+        bool windowAdvertised = false;
+        for(const H2FrameOut& frame: DrainH2Frames(conn)) {
+            if(frame.type == Http2Conn::WINDOW_UPDATE && frame.streamId == 1) { streamUpdates++; }
+            if(frame.type == Http2Conn::SETTINGS && frame.payload.find(std::string("\0\x4\0\x1\0\0", 6)) != std::string::npos) {
+                windowAdvertised = true;
+            }
+        }
+        assert(windowAdvertised && streamUpdates == 4);     // 64KB的窗口，计入之后逐帧归还
+        assert(HttpRequest::BodyBytesInFlight() == inFlight + 65536);
+
+        for(int i = 0; i < 3; i++) { buff.Append(H2Frame(Http2Conn::DATA, 0, 1, chunk)); }
+        assert(conn.Process(buff));
+        std::vector<H2FrameOut> frames = DrainH2Frames(conn);
+        streamUpdates = 0;
+        std::string status;
+        bool end = false, reset = false;
+        for(const H2FrameOut& frame: frames) {
+            if(frame.streamId != 1) { continue; }
+            if(frame.type == Http2Conn::WINDOW_UPDATE) { streamUpdates++; }
+            if(frame.type == Http2Conn::HEADERS) {
+                HpackDecoder decoder;
+                HeaderList headers;
+                assert(decoder.Decode(reinterpret_cast<const uint8_t*>(frame.payload.data()), frame.payload.size(), headers));
+                status = headers[0].second;
+            }
+            if(frame.type == Http2Conn::DATA && (frame.flags & 0x1)) { end = true; }
+            if(frame.type == Http2Conn::RST_STREAM) {
+                assert(end && frame.payload == std::string(4, '\0'));     // 响应之后的RST_STREAM(NO_ERROR)
+                reset = true;
+            }
+        }
+        assert(streamUpdates == 2 && status == "413" && end && reset);   // 第3帧超过100000字节
+    }
+    assert(HttpRequest::BodyBytesInFlight() == inFlight);  // 流结束后释放额度
+    HttpRequest::maxBodySize = maxBody;
+    printf("Http2Body ok\n");
+}
+
+void TestChunked() {
+    // chunked请求体分多次到达，后面紧跟流水线中的下一个请求
+    std::string req = "POST /form HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+                      "Content-Type: application/x-www-form-urlencoded\r\n\r\n"
+                      "9\r\nusername=\r\n6;ext=1\r\nab&pas\r\nb\r\nsword=cd123\r\n0\r\nX-Trailer: t\r\n\r\n"
+                      "GET /index.html HTTP/1.1\r\nContent-Length: 0\r\n\r\n";
+    Buffer buff;
+    HttpRequest request;
+    size_t sent = 0;
+    for(; sent < req.size() && !request.IsFinished(); sent += 7) {
+        buff.Append(req.data() + sent, std::min<size_t>(7, req.size() - sent));
+        assert(request.parse(buff));
+    }
+    assert(request.IsFinished());
+    assert(request.GetPost("username") == "ab" && request.GetPost("password") == "cd123");
+    if(sent < req.size()) { buff.Append(req.data() + sent, req.size() - sent); }
+    request.Init();
+    assert(request.parse(buff) && request.IsFinished() && request.path() == "/index.html");
+    assert(buff.ReadableBytes() == 0);
+
+    request.Init();
+    buff.Append("POST /x HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n");
+    assert(!request.parse(buff));
+
+    Buffer out;
+    HttpResponse::AppendChunk(out, "hello world, chunked", 20);
+    HttpResponse::AppendLastChunk(out);
+    assert(out.RetrieveAllToStr() == "14\r\nhello world, chunked\r\n0\r\n\r\n");
+    printf("Chunked ok\n");
+}
+
+void TestStreamWrite() {
+    // 分段生成的响应经socketpair写出：发送缓冲满时EAGAIN，对端读走一部分后接着写，最后是结束块
+    int calls = 0;
+    HttpConn::srcDir = "./";
+    HttpConn::streamHandlers["/gen"] = StreamHandler{"text/plain", [&calls](const HttpRequest&) {
+        return BodyProducer([&calls](std::string& chunk) {
+            chunk.assign(30000, static_cast<char>('a' + calls));
+            return ++calls < 10;
+        });
+    }};
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    int sndBuf = 16384;
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndBuf, sizeof(sndBuf));
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+    HttpConn conn;
+    conn.init(sv[0], sockaddr_in());
+    assert(conn.CanShed());     // 还没有收到数据，过载时可以直接拒绝
+    const char req[] = "GET /gen HTTP/1.1\r\nHost: t\r\nConnection: keep-alive\r\n\r\n";
+    assert(write(sv[1], req, 20) == 20);
+    int err = 0;
+    conn.read(&err);    // 读到EAGAIN为止
+    assert(err == EAGAIN && !conn.process() && !conn.CanShed());  // 请求头收到一部分
+    assert(write(sv[1], req + 20, sizeof(req) - 21) == sizeof(req) - 21);
+    conn.read(&err);
+    assert(err == EAGAIN && conn.process() && !conn.CanShed());
+    assert(calls < 10);     // 只生成到写缓冲区的水位
+
+    std::string out;
+    char buf[8192];
+    int again = 0;
+    while(conn.ToWriteBytes() > 0) {
+        if(conn.write(&err) < 0) {
+            assert(err == EAGAIN);
+            again++;
+            ssize_t len = read(sv[1], buf, sizeof(buf));
+            assert(len > 0);
+            out.append(buf, len);
+        }
+    }
+    shutdown(sv[0], SHUT_WR);
+    for(ssize_t len; (len = read(sv[1], buf, sizeof(buf))) > 0; ) { out.append(buf, len); }
+    assert(again > 0 && calls == 10);
+    assert(!conn.process() && conn.CanShed());  // 响应写完，空闲的长连接
+
+    size_t pos = out.find("\r\n\r\n");
+    assert(pos != std::string::npos && out.find("Transfer-Encoding: chunked") < pos);
+    std::string body;
+    for(pos += 4; ; ) {
+        size_t lineEnd = out.find("\r\n", pos);
+        assert(lineEnd != std::string::npos);
+        size_t size = strtoul(out.substr(pos, lineEnd - pos).c_str(), nullptr, 16);
+        pos = lineEnd + 2;
+        if(size == 0) { break; }
+        body.append(out, pos, size);
+        pos += size + 2;
+    }
+    assert(out.compare(pos, std::string::npos, "\r\n") == 0);
+    assert(body.size() == 300000 && body[0] == 'a' && body.back() == 'j');
+
+    // 前一个验证任务交还连接后，流水线中的下一个请求又开始验证：前一个任务结束时不清除新任务的标记
+    uint32_t first = conn.BeginVerify();
+    uint32_t second = conn.BeginVerify();
+    conn.EndVerify(first);
+    assert(conn.IsVerifying());
+    conn.EndVerify(second);
+    assert(!conn.IsVerifying());
+    conn.Close();
+    close(sv[1]);
+    HttpConn::streamHandlers.clear();
+    printf("StreamWrite ok, %d EAGAIN\n", again);
 }
 
+void TestRequestBody() {
+    // 超过bodyMemLimit的请求体转存到临时文件
+    std::string body(200 * 1024, 'x');
+    Buffer buff;
+    buff.Append("PUT /upload HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n");
+    HttpRequest request;
+    assert(request.parse(buff) && !request.IsFinished() && request.CanSpliceBody());
+    buff.Append(body);
+    assert(request.parse(buff) && request.IsFinished());
+    assert(request.BodyFd() >= 0 && request.BodyLength() == body.size());
+    char tail[4] = {0};
+    assert(pread(request.BodyFd(), tail, 3, body.size() - 3) == 3 && std::string(tail) == "xxx");
+    assert(HttpRequest::BodyBytesInFlight() == body.size());
+    request.Init();
+    assert(HttpRequest::BodyBytesInFlight() == 0);
+
+    // 单个请求体超过上限时在接收之前返回413
+    size_t maxBody = HttpRequest::maxBodySize;
+    HttpRequest::maxBodySize = 1024;
+    buff.Append("POST /x HTTP/1.1\r\nContent-Length: 2048\r\n\r\n");
+    assert(!request.parse(buff) && request.ErrorCode() == 413);
+    HttpRequest::maxBodySize = maxBody;
+    printf("RequestBody ok\n");
+}
+
+void TestWebSocket() {
+    assert(WebSocketConn::AcceptKey("dGhlIHNhbXBsZSBub25jZQ==") == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+
+    // SIMD去掩码与逐字节异或的结果一致(各种长度和起始对齐)
+    const uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    std::string plain(300, '\0');
+    for(size_t i = 0; i < plain.size(); i++) { plain[i] = static_cast<char>(i * 7); }
+    for(size_t off = 0; off < 3; off++) {
+        for(size_t len = 0; len + off <= plain.size(); len += 13) {
+            std::string data = plain.substr(off, len);
+            for(size_t i = 0; i < len; i++) { data[i] ^= mask[i & 3]; }
+            WebSocketConn::Unmask(&data[0], len, mask);
+            assert(data == plain.substr(off, len));
+        }
+    }
+
+    // 分片消息和夹在中间的ping：收到完整消息后回调，ping排入pong
+    std::string got;
+    WsHandler handler{ nullptr, [&got](const WsConnPtr&, int opcode, const std::string& msg) {
+        assert(opcode == WebSocketConn::TEXT);
+        got = msg;
+    }, nullptr };
+    PushConn::ArmFunc arm = [](int, uint32_t) {};
+    WsConnPtr conn = std::make_shared<WebSocketConn>(-1, sockaddr_in(), &handler, &arm);
+    auto masked = [&mask](int first, const std::string& payload) {
+        std::string frame(1, static_cast<char>(first));
+        frame += static_cast<char>(0x80 | payload.size());
+        frame.append(reinterpret_cast<const char*>(mask), 4);
+        for(size_t i = 0; i < payload.size(); i++) { frame += payload[i] ^ mask[i & 3]; }
+        return frame;
+    };
+    std::string frames = masked(0x01, "Hel") + masked(0x89, "p") + masked(0x80, "lo");
+    Buffer buff;
+    buff.Append(frames.data(), frames.size() - 1);  // 最后一帧不完整
+    conn->Process(buff);
+    assert(got.empty() && conn->ToWriteBytes() == 3);
+    buff.Append(frames.data() + frames.size() - 1, 1);
+    conn->Process(buff);
+    assert(got == "Hello" && buff.ReadableBytes() == 0);
+
+    // 64位长度：最高位为1，或者加上已收到的分片后溢出，都直接关闭连接，不越界读
+    for(uint8_t top: { 0xFF, 0x7F }) {
+        WsConnPtr bad = std::make_shared<WebSocketConn>(-1, sockaddr_in(), &handler, &arm);
+        std::string huge = masked(0x01, "a");
+        huge += '\x80';
+        huge += static_cast<char>(0x80 | 127);
+        huge += static_cast<char>(top);
+        huge.append(7, '\xFF');
+        huge.append(reinterpret_cast<const char*>(mask), 4);
+        huge += "xyz";
+        Buffer badBuff;
+        badBuff.Append(huge.data(), huge.size());
+        bad->Process(badBuff);
+        assert(badBuff.ReadableBytes() == 0 && bad->ToWriteBytes() == 4);   // 关闭帧(带状态码)
+        bad->Shutdown();
+    }
+
+    // 广播：同一个帧被订阅者的发送队列共享
+    assert(Broadcaster::Instance()->Subscribe("test", conn));
+    assert(Broadcaster::Instance()->Publish("test", "news") == 1);
+    struct iovec iov[4];
+    assert(conn->FillIov(iov, 4) == 2 && iov[1].iov_len == 6);
+    conn->Shutdown();
+    assert(Broadcaster::Instance()->Subscribers("test") == 0);
+    printf("WebSocket ok\n");
+}
+
+void TestSse() {
+    // 多行data拆成多个data:行；块大小行是事件部分的长度
+    EventStream stream(4);
+    assert(stream.Publish("a\r\nb", "tick") == 1);
+    std::vector<EventStream::Event> events;
+    uint64_t next = 1;
+    assert(stream.Read(next, events, 16) == 0 && next == 2 && events.size() == 1);
+    const EventStream::Event& ev = events[0];
+    std::string body = ev.wire->substr(ev.bodyOff, ev.bodyLen);
+    assert(body == "id: 1\nevent: tick\ndata: a\ndata: b\n\n");
+    assert(strtoul(ev.wire->c_str(), nullptr, 16) == body.size());
+    assert(ev.wire->substr(ev.bodyOff - 2) == "\r\n" + body + "\r\n");
+
+    // 落后超过容量的读者跳到最老的事件
+    for(int i = 0; i < 6; i++) { stream.Publish(std::to_string(i)); }
+    events.clear();
+    assert(stream.Read(next, events, 2) == 2 && next == 6 && events[0].id == 4);
+    assert(stream.Read(next, events, 16) == 0 && next == 8 && events.size() == 4);
+    assert(stream.Skipped() == 2 && stream.LastId() == 7);
+
+    // 订阅的连接：先发响应头，之后只发新事件
+    PushConn::ArmFunc arm = [](int, uint32_t) {};
+    auto conn = std::make_shared<SseConn>(-1, true, std::make_shared<EventStream>(4), &arm);
+    conn->Open("HEAD", "");
+    struct iovec iov[4];
+    assert(conn->FillIov(iov, 4) == 1 && iov[0].iov_len == 4);
+    conn->Consume(4);
+    assert(conn->ToWriteBytes() == 0);
+    conn->Shutdown();
+    printf("SSE ok\n");
+}
+
+void TestKeepAlive() {
+    KeepAlivePolicy* policy = KeepAlivePolicy::Instance();
+    policy->Init(60000, 10000, 3, 100, 0);
+    assert(policy->RequestsLeft(1) == 2 && policy->RequestsLeft(3) == 0 && policy->RequestsLeft(5) == 0);
+    // 负载低于一半时不缩短，一半到九成之间线性缩短，九成以上为最小值
+    policy->Update(50);
+    assert(policy->IdleTimeout() == 60000);
+    policy->Update(70);
+    assert(policy->IdleTimeout() == 60000 - 58000 / 2);
+    policy->Update(95);
+    assert(policy->IdleTimeout() == KeepAlivePolicy::MIN_IDLE_MS);
+    policy->Update(10);
+    assert(policy->IdleTimeout() == 60000 && policy->HeaderTimeout() == 10000);
+    policy->Init(60000, 0, 0, 65536, 0);
+    assert(policy->RequestsLeft(100) == -1);
+    printf("KeepAlive ok\n");
+}
+
+void TestQueueDelay() {
+    // 任务持续排队超过目标时过载，队列排空后恢复
+    ThreadPool pool(1);
+    pool.SetDelayTarget(std::chrono::milliseconds(2), std::chrono::milliseconds(10));
+    assert(!pool.Overloaded());
+    std::atomic<int> done(0);
+    for(int i = 0; i < 8; i++) {
+        pool.AddTask([&done] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            done++;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(25));
+    assert(pool.Overloaded());
+    while(done < 8) { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+    assert(!pool.Overloaded());
+    printf("QueueDelay ok\n");
+}
+
+void TestIpLimiter() {
+    // 每个IP最多2个连接；每秒1个请求，突发4个：桶满时连续取4个令牌，1秒内不会再补充一个
+    IpLimiter* limiter = IpLimiter::Instance();
+    limiter->Init(2, 1, 4);
+    in_addr a, b;
+    inet_pton(AF_INET, "10.0.0.1", &a);
+    inet_pton(AF_INET, "10.0.0.2", &b);
+    int s1, s2, s3, s4;
+    assert(limiter->Connect(a, &s1) && s1 >= 0);
+    assert(limiter->Connect(a, &s2) && s2 == s1);
+    assert(!limiter->Connect(a, &s3) && s3 == -1);
+    assert(limiter->Connect(b, &s4) && s4 != s1);
+    limiter->Release(s2);
+    assert(limiter->Connect(a, &s2) && s2 == s1);
+    int ok = 0;
+    for(int i = 0; i < 10; i++) { ok += limiter->Request(s1); }
+    assert(ok == 4 && limiter->RequestRejected() == 6);
+    assert(!limiter->Request(s2));  // 同一IP的连接共用令牌桶
+    assert(limiter->Request(s4));   // 另一个IP的令牌桶不受影响
+    assert(limiter->ConnRejected() == 1 && limiter->Tracked() == 2);
+    // 每秒1000个请求：取完令牌后每毫秒补充一个
+    limiter->Init(2, 1000, 4);
+    assert(limiter->Connect(a, &s1) && s1 >= 0);
+    for(int i = 0; i < 100000 && limiter->Request(s1); i++) {}
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    assert(limiter->Request(s1));
+    limiter->Init(0, 0, 0);
+    assert(!limiter->IsOpen() && limiter->Connect(a, &s1) && s1 == -1 && limiter->Request(s1));
+    printf("IpLimiter ok\n");
+}
+
+void TestGracefulRestart() {
+    // 平滑退出时之后的响应都带Connection: close
+    KeepAlivePolicy* policy = KeepAlivePolicy::Instance();
+    policy->Init(60000, 0, 0, 65536, 0);
+    policy->SetDraining(true);
+    assert(policy->RequestsLeft(1) == 0);
+    policy->Init(60000, 0, 0, 65536, 0);
+    assert(!policy->IsDraining() && policy->RequestsLeft(1) == -1);
+    // 新进程(再次执行本程序，见RestartChild)收下监听socket，就绪后用它accept一个连接并回应
+    GracefulRestart* restart = GracefulRestart::Instance();
+    assert(restart->InheritListenFd() == -1);
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(addr);
+    assert(bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(listenFd, 8) == 0);
+    assert(getsockname(listenFd, (struct sockaddr*)&addr, &addrLen) == 0);
+    char self[] = "/proc/self/exe";
+    char* childArgv[] = { self };
+    restart->Init(1, childArgv);
+    int sock = restart->Spawn(listenFd);
+    assert(sock >= 0 && restart->CheckReady(sock));
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    assert(connect(client, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    char reply[16] = {};
+    size_t got = 0;
+    for(ssize_t len = 1; len > 0 && got < sizeof(reply) - 1; got += len) {
+        len = read(client, reply + got, sizeof(reply) - 1 - got);
+        if(len <= 0) { break; }
+    }
+    close(client);
+    assert(strcmp(reply, "inherited") == 0);
+    int status = 0;
+    assert(wait(&status) > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // 没有通知就退出：子进程退出得早时Spawn可能已经失败(发送监听socket时EPIPE)，两种情况旧进程都继续服务
+    char sh[] = "/bin/sh", c[] = "-c", fail[] = "exit 1";
+    char* failArgv[] = { sh, c, fail };
+    restart->Init(3, failArgv);
+    sock = restart->Spawn(listenFd);
+    assert(sock < 0 || !restart->CheckReady(sock));
+    assert(waitpid(-1, nullptr, WNOHANG) < 0);  // 子进程已回收
+    close(listenFd);
+    printf("GracefulRestart ok\n");
+}
+
+// TestGracefulRestart启动的新进程
+int RestartChild() {
+    GracefulRestart* restart = GracefulRestart::Instance();
+    int listenFd = restart->InheritListenFd();
+    if(listenFd < 0) { return 1; }
+    restart->NotifyReady();
+    int fd = accept(listenFd, nullptr, nullptr);
+    if(fd < 0) { return 1; }
+    ssize_t len = write(fd, "inherited", 9);
+    close(fd);
+    close(listenFd);
+    return len == 9 ? 0 : 1;
+}
+
+#ifndef NO_TLS
+// 生成自签名证书(EC P-256)和私钥，写成PEM文件
+static bool MakeTestCert(const char* certFile, const char* keyFile) {
+    EVP_PKEY* key = nullptr;
+    EVP_PKEY_CTX* kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    bool ok = kctx && EVP_PKEY_keygen_init(kctx) > 0 &&
+              EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) > 0 &&
+              EVP_PKEY_keygen(kctx, &key) > 0;
+    EVP_PKEY_CTX_free(kctx);
+    X509* cert = X509_new();
+    if(ok) {
+        X509_set_version(cert, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME* name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        ok = X509_sign(cert, key, EVP_sha256()) > 0;
+    }
+    FILE* certFp = fopen(certFile, "w");
+    FILE* keyFp = fopen(keyFile, "w");
+    ok = ok && certFp && keyFp && PEM_write_X509(certFp, cert) &&
+         PEM_write_PrivateKey(keyFp, key, nullptr, nullptr, 0, nullptr, nullptr);
+    if(certFp) { fclose(certFp); }
+    if(keyFp) { fclose(keyFp); }
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return ok;
+}
+
+// 在socketpair上交替推进客户端和TlsConn的握手，然后服务端发一段数据(TLS1.3的会话票据随之到达)
+// 返回客户端协商到的ALPN，握手失败返回空串；*session为空时保存会话，否则用它恢复
+static std::string TlsLoopback(TlsContext* ctx, SSL_CTX* clientCtx, const char* alpn, size_t alpnLen,
+                               SSL_SESSION** session, bool* resumed) {
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+    TlsConn server(ctx, sv[0]);
+    SSL* client = SSL_new(clientCtx);
+    SSL_set_fd(client, sv[1]);
+    SSL_set_connect_state(client);
+    SSL_set_alpn_protos(client, reinterpret_cast<const unsigned char*>(alpn), alpnLen);
+    if(*session) { SSL_set_session(client, *session); }
+    std::string selected;
+    bool clientDone = false, serverDone = false;
+    for(int i = 0; i < 100 && !(clientDone && serverDone); i++) {
+        if(!clientDone) { clientDone = SSL_do_handshake(client) == 1; }
+        if(!serverDone) {
+            TlsConn::HANDSHAKE state = server.Handshake();
+            if(state == TlsConn::FAILED) { break; }
+            serverDone = state == TlsConn::DONE;
+        }
+    }
+    if(clientDone && serverDone) {
+        struct iovec iov = { const_cast<char*>("hello"), 5 };
+        assert(server.Writev(&iov, 1) == 5);
+        char buf[16];
+        assert(SSL_read(client, buf, sizeof(buf)) == 5 && memcmp(buf, "hello", 5) == 0);
+        const unsigned char* proto = nullptr;
+        unsigned int protoLen = 0;
+        SSL_get0_alpn_selected(client, &proto, &protoLen);
+        selected.assign(reinterpret_cast<const char*>(proto), protoLen);
+        *resumed = SSL_session_reused(client);
+        if(!*session) { *session = SSL_get1_session(client); }
+        // 正常关闭：没有close_notify就释放时OpenSSL认为会话不可靠，不能再用于恢复
+        server.Shutdown();
+        SSL_shutdown(client);
+    }
+    SSL_free(client);
+    close(sv[0]);
+    close(sv[1]);
+    return selected;
+}
+
+void TestTls() {
+    // 生成的证书上完成握手：ALPN优先h2，只支持HTTP/1.1的客户端得到http/1.1，第二次连接用会话票据恢复
+    mkdir("./testtls", 0777);
+    assert(MakeTestCert("./testtls/cert.pem", "./testtls/key.pem"));
+    TlsContext ctx;
+    assert(ctx.Init("./testtls/cert.pem", "./testtls/key.pem"));
+    SSL_CTX* clientCtx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_session_cache_mode(clientCtx, SSL_SESS_CACHE_CLIENT);
+    SSL_SESSION* session = nullptr;
+    bool resumed = true;
+    const char both[] = "\x02h2\x08http/1.1", http1[] = "\x08http/1.1";
+    assert(TlsLoopback(&ctx, clientCtx, both, sizeof(both) - 1, &session, &resumed) == "h2");
+    assert(!resumed && session && ctx.Handshakes() == 1 && ctx.Resumed() == 0);
+    assert(TlsLoopback(&ctx, clientCtx, http1, sizeof(http1) - 1, &session, &resumed) == "http/1.1");
+    assert(resumed && ctx.Handshakes() == 2 && ctx.Resumed() == 1 && ctx.Failed() == 0);
+    SSL_SESSION_free(session);
+    SSL_CTX_free(clientCtx);
+    unlink("./testtls/cert.pem");
+    unlink("./testtls/key.pem");
+    rmdir("./testtls");
+    printf("Tls ok\n");
+}
+#endif
+
 int main() {
+    if(getenv(GracefulRestart::ENV_NAME)) { return RestartChild(); }
     TestLog();
+    TestCredentialCache();
+    TestFileAuthStore();
+    TestMetrics();
+    TestSlowLog();
+    TestAccessLog();
+    TestHpack();
+    TestHttp2Stream();
+    TestHttp2Body();
+    TestChunked();
+    TestStreamWrite();
+    TestRequestBody();
+    TestWebSocket();
+    TestSse();
+    TestKeepAlive();
+    TestQueueDelay();
+    TestIpLimiter();
+    TestGracefulRestart();
+#ifndef NO_TLS
+    TestTls();
+#endif
     TestThreadPool();
 }
\ No newline at end of file
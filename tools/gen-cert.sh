@@ -0,0 +1,12 @@
+#!/bin/sh
+# 生成本机测试用的自签名证书(ECDSA P-256，SAN为localhost和127.0.0.1)
+#   sh tools/gen-cert.sh [输出目录，默认./cert]
+#   ./bin/server -c cert/server.crt -k cert/server.key
+#   curl -k https://127.0.0.1:1316/
+set -e
+DIR=${1:-./cert}
+mkdir -p "$DIR"
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 365 \
+    -subj "/CN=localhost" -addext "subjectAltName=DNS:localhost,IP:127.0.0.1" \
+    -keyout "$DIR/server.key" -out "$DIR/server.crt"
+echo "$DIR/server.crt $DIR/server.key"